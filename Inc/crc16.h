@@ -0,0 +1,22 @@
+/**
+ * @brief   XMODEM CRC-16
+ */
+
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <stdint.h>
+
+// Implementations, smallest first; tools/crc16bench.c compares their speed
+#define CRC16_NIBBLE    1           // two 16-entry tables, 64 bytes
+#define CRC16_TABLE     2           // one 256-entry table, 512 bytes
+#define CRC16_SLICE4    3           // four 256-entry tables, 2K, four bytes per step
+
+#ifndef CRC16_METHOD
+#define CRC16_METHOD    CRC16_TABLE
+#endif
+
+/* The CRC-16 of a buffer, continuing from a previous result; start from zero. */
+uint16_t crc16_xmodem(uint16_t, const uint8_t *, uint32_t);
+
+#endif
@@ -0,0 +1,25 @@
+/**
+ * @brief   Running CRC-32 of a byte stream on the CRC peripheral
+ */
+
+#ifndef CRC32_H
+#define CRC32_H
+
+#include "stm32f4xx_hal.h"
+
+/* Take ownership of the CRC peripheral. */
+HAL_StatusTypeDef crc32_init(CRC_HandleTypeDef *);
+
+/* Begin a new stream, discarding the old one. There is only one stream at a time. */
+void crc32_start(void);
+
+/* Add bytes to the stream. They needn't be aligned or a multiple of four. */
+void crc32_update(const uint8_t *, uint32_t);
+
+/* The standard (zlib, IEEE 802.3) CRC-32 of the stream so far. The stream may carry on afterwards. */
+uint32_t crc32_value(void);
+
+/* The CRC-32 of a buffer in software, leaving the stream alone. Pass zero, or a previous result to continue it. */
+uint32_t crc32_buffer(uint32_t, const uint8_t *, uint32_t);
+
+#endif
@@ -10,23 +10,59 @@
 #define SPI_ROM_MANUFACTURER_WINBOND        0xEF        // manufacturer ID
 #define SPI_ROM_WINBOND_W25Q32xV            0x4016      // device ID
 
-#define SPI_ROM_SECTOR_MASK                 0xFFF       // 4K mask
-#define SPI_ROM_BLOCK_MASK                  0x7FFF      // 32K mask
-#define SPI_ROM_LARGE_BLOCK_MASK            0xFFFF      // 64K mask
+#define SPI_ROM_ERASE_TYPES                 4           // SFDP describes up to four erase granularities
 
-#define SPI_ROM_ERASE_SECTOR                1
-#define SPI_ROM_ERASE_BLOCK                 2
-#define SPI_ROM_ERASE_LARGE_BLOCK           3
+// One erase granularity the device supports
+typedef struct __SPI_ROM_EraseTypeDef {
+    uint32_t size;                  // bytes erased, a power of two; zero if this slot is unused
+    uint8_t opcode;
+    uint32_t typical_us;            // typical duration, refined by measurement
+    uint32_t max_ms;                // maximum duration before giving up
+} SPI_ROM_EraseTypeDef;
+
+// Geometry and timing of the attached device, filled in by spi_rom_detect()
+typedef struct __SPI_ROM_DeviceDef {
+    uint8_t manufacturer;
+    uint16_t device_id;
+    uint8_t sfdp;                   // true if the description came from the device's SFDP table
+    uint32_t capacity;              // bytes
+    uint16_t page_size;             // bytes per page program
+    uint32_t prescaler;             // SPI_BAUDRATEPRESCALER_x to talk to the device at
+    uint32_t program_typical_us;
+    uint32_t program_max_ms;
+    uint32_t chip_erase_typical_us;
+    uint32_t chip_erase_max_ms;
+    SPI_ROM_EraseTypeDef erase[SPI_ROM_ERASE_TYPES];   // sorted smallest first, unused slots last
+} SPI_ROM_DeviceDef;
+
+// A minimum-time set of erases covering a region, built by spi_rom_plan_erase()
+typedef struct __SPI_ROM_ErasePlanDef {
+    uint32_t start;                 // region start, rounded down to the smallest erase
+    uint32_t end;                   // region end, rounded up to the smallest erase
+    uint8_t chip;                   // true if one chip erase is quicker than erasing the region piecemeal
+    uint8_t direct[SPI_ROM_ERASE_TYPES];    // true where an erase type beats erasing its parts separately
+    uint32_t typical_ms;            // expected total erase time
+} SPI_ROM_ErasePlanDef;
 
 typedef struct __SPI_ROM_ConfigDef {
     SPI_HandleTypeDef *hspi;
     GPIO_TypeDef* ss_port;
     uint16_t ss_pin;
+    SPI_ROM_DeviceDef *device;
 } SPI_ROM_ConfigDef;
 
+HAL_StatusTypeDef spi_rom_init(const SPI_ROM_ConfigDef *);
+HAL_StatusTypeDef spi_rom_detect(const SPI_ROM_ConfigDef *);
 HAL_StatusTypeDef spi_rom_read_jedec_id(const SPI_ROM_ConfigDef *, uint8_t *, uint16_t *);
-HAL_StatusTypeDef spi_rom_erase(const SPI_ROM_ConfigDef *, uint32_t, uint8_t);
+HAL_StatusTypeDef spi_rom_calibrate(const SPI_ROM_ConfigDef *);
+void spi_rom_set_prescaler(SPI_HandleTypeDef *, uint32_t);
+uint32_t spi_rom_clock_hz(const SPI_ROM_ConfigDef *);
+HAL_StatusTypeDef spi_rom_erase(const SPI_ROM_ConfigDef *, uint32_t, uint32_t);
+void spi_rom_plan_erase(const SPI_ROM_ConfigDef *, uint32_t, uint32_t, uint8_t, SPI_ROM_ErasePlanDef *);
+uint32_t spi_rom_plan_step(const SPI_ROM_ConfigDef *, const SPI_ROM_ErasePlanDef *, uint32_t);
 HAL_StatusTypeDef spi_rom_program(const SPI_ROM_ConfigDef *, uint32_t, const uint8_t *, uint16_t);
+HAL_StatusTypeDef spi_rom_program_erased(const SPI_ROM_ConfigDef *, uint32_t, const uint8_t *, uint16_t);
+HAL_StatusTypeDef spi_rom_read(const SPI_ROM_ConfigDef *, uint32_t, uint8_t *, uint32_t);
 HAL_StatusTypeDef spi_rom_read_page(const SPI_ROM_ConfigDef *, uint32_t, uint8_t *);
 
-#endif
\ No newline at end of file
+#endif
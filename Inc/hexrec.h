@@ -0,0 +1,42 @@
+/**
+ * @brief   Streaming Intel HEX and Motorola S-record parser
+ */
+
+#ifndef HEXREC_H
+#define HEXREC_H
+
+#include "stm32f4xx_hal.h"
+
+#define HEXREC_INTEL            0           // Intel HEX: ":LLAAAATT...CC" records
+#define HEXREC_SREC             1           // Motorola S-records: "SnCC..." records
+
+#define HEXREC_CHUNK            1024        // largest write; writes never cross a multiple of this
+
+typedef HAL_StatusTypeDef (*HexRec_CB_Seek)(void *, uint32_t);
+typedef HAL_StatusTypeDef (*HexRec_CB_Write)(void *, const uint8_t *, uint16_t);
+
+typedef struct __HexRec_ControlDef {
+    /* User data argument to pass to the callbacks */
+    void *cb_data;
+
+    /* The following writes go at this address. Called before the first write, and wherever the data jumps. */
+    HexRec_CB_Seek seek;
+
+    /*
+     * Consume data for the current address, which then moves on by its size. Consecutive records are gathered up
+     * and written in pieces aligned to HEXREC_CHUNK. Any status other than HAL_OK stops parsing.
+     */
+    HexRec_CB_Write write;
+
+} HexRec_ControlDef;
+
+/* Begin parsing a new file of the given HEXREC_XXXX format. There is only one parser. */
+void hexrec_start(const HexRec_ControlDef *, uint8_t);
+
+/* Parse the next part of the file. Records may be split anywhere. Anything after the end record is ignored. */
+HAL_StatusTypeDef hexrec_feed(const uint8_t *, uint32_t);
+
+/* Write out the last of the data. Returns HAL_OK if the end record was seen, HAL_ERROR otherwise. */
+HAL_StatusTypeDef hexrec_finish(void);
+
+#endif
@@ -0,0 +1,43 @@
+/**
+ * @brief   Streaming LZ4 frame decoder
+ */
+
+#ifndef LZ4FRAME_H
+#define LZ4FRAME_H
+
+#include "stm32f4xx_hal.h"
+
+#define LZ4_FRAME_WINDOW        65536       // history kept for matches: the longest offset LZ4 can encode
+#define LZ4_FRAME_CHUNK         1024        // decompressed bytes handed on at a time; divides the window
+
+typedef HAL_StatusTypeDef (*LZ4_Frame_CB_Header)(void *, uint32_t);
+typedef HAL_StatusTypeDef (*LZ4_Frame_CB_Write)(void *, const uint8_t *, uint16_t);
+
+typedef struct __LZ4_Frame_ControlDef {
+    /* User data argument to pass to the callbacks */
+    void *cb_data;
+
+    /*
+     * Optional: called once the frame header has been read, with the decompressed size, or zero if the frame
+     * doesn't give one. Any status other than HAL_OK stops decoding.
+     */
+    LZ4_Frame_CB_Header header;
+
+    /*
+     * Consume decompressed data. The size is LZ4_FRAME_CHUNK, except for the last chunk of the frame. Any status
+     * other than HAL_OK stops decoding.
+     */
+    LZ4_Frame_CB_Write write;
+
+} LZ4_Frame_ControlDef;
+
+/* Begin decoding a new frame. There is only one decoder. */
+void lz4_frame_start(const LZ4_Frame_ControlDef *);
+
+/* Decode the next part of the frame. Bytes after the end of the frame are ignored. */
+HAL_StatusTypeDef lz4_frame_feed(const uint8_t *, uint32_t);
+
+/* Returns HAL_OK if a whole frame has been decoded and passed its checksums, HAL_ERROR otherwise. */
+HAL_StatusTypeDef lz4_frame_finish(void);
+
+#endif
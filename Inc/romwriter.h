@@ -0,0 +1,54 @@
+/**
+ * @brief   Background ROM programming queue
+ */
+
+#ifndef ROMWRITER_H
+#define ROMWRITER_H
+
+#include "stm32f4xx_hal.h"
+
+#define ROM_WRITER_SLOTS        2           // double buffered
+#define ROM_WRITER_SLOT_SIZE    1024        // one YMODEM 1K packet per slot
+
+typedef HAL_StatusTypeDef (*ROM_Writer_CB_Program)(void *, uint32_t, const uint8_t *, uint16_t);
+typedef HAL_StatusTypeDef (*ROM_Writer_CB_Prepare)(void *);
+
+typedef struct __ROM_Writer_ControlDef {
+    /* User data argument to pass to the callback */
+    void *cb_data;
+
+    /*
+     * Erase (if needed) and program one slot's worth of data at the given address. This runs on the writer
+     * thread. Any status other than HAL_OK stops the writer: later submissions are refused with that status.
+     * An empty submission arrives with a size of zero, which callbacks that buffer data can treat as a flush.
+     */
+    ROM_Writer_CB_Program program;
+
+    /*
+     * Optional: do one bounded step of work ahead of the data, such as erasing the next block. This runs on the
+     * writer thread whenever no slot is waiting, after rom_writer_prepare(). Return HAL_BUSY while more work remains
+     * and HAL_OK once done; any other status stops the writer as for program.
+     */
+    ROM_Writer_CB_Prepare prepare;
+
+} ROM_Writer_ControlDef;
+
+/* Create the writer thread and its queues. Call once, from a thread. */
+HAL_StatusTypeDef rom_writer_init(void);
+
+/* Begin a new programming session. Any previous session must have been finished. */
+void rom_writer_start(const ROM_Writer_ControlDef *);
+
+/* Have the writer call the session's prepare callback whenever it would otherwise be idle. */
+void rom_writer_prepare(void);
+
+/* Copy data into a free slot and queue it for programming, blocking while both slots are busy. */
+HAL_StatusTypeDef rom_writer_submit(uint32_t, const uint8_t *, uint16_t);
+
+/* The session's status so far, without waiting: the first failure of anything already programmed or prepared. */
+HAL_StatusTypeDef rom_writer_status(void);
+
+/* Wait for all queued data to be programmed, stop any preparation, and return the session's final status. */
+HAL_StatusTypeDef rom_writer_finish(void);
+
+#endif
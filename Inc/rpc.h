@@ -0,0 +1,63 @@
+/**
+ * @brief   Framed binary request/response protocol for scripted hosts
+ */
+
+#ifndef RPC_H
+#define RPC_H
+
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+#include "uartrx.h"
+
+#define RPC_VERSION             1
+#define RPC_MAX_DATA            1024        // largest arguments or results of one request
+#define RPC_WINDOW              UART_RX_STREAM_SIZE     // most encoded request bytes a host may have unanswered
+#define RPC_IDLE_MS             10000       // rpc_serve() gives up after this long without a frame
+
+// Operations
+#define RPC_OP_IDENTIFY         0x01        // -> protocol and device details
+#define RPC_OP_READ             0x02        // target, address, length (u16) -> data
+#define RPC_OP_ERASE            0x03        // target, address, length (u32), both erase-aligned
+#define RPC_OP_PROGRAM          0x04        // target, address, data: into erased ROM, queued behind earlier ones
+#define RPC_OP_CRC              0x05        // target, address, length (u32) -> CRC-32 (u32)
+#define RPC_OP_CLOCK            0x06        // SPI clock in Hz (u32), or zero to calibrate -> clock in Hz (u32)
+#define RPC_OP_EXIT             0x07        // back to the character menu
+
+// Targets
+#define RPC_TARGET_SPI          0
+#define RPC_TARGET_SST          1
+
+// Response status
+#define RPC_OK                  0
+#define RPC_UNKNOWN             1           // no such operation
+#define RPC_BAD_REQUEST         2           // wrong length, bad target, unaligned or out of range
+#define RPC_NO_DEVICE           3           // the target ROM didn't answer
+#define RPC_FAILED              4           // the ROM operation failed
+#define RPC_PROGRAM_FAILED      5           // an earlier PROGRAM failed after its response; nothing was done
+
+// rpc_serve() results
+#define RPC_EXIT                0           // the host asked to leave
+#define RPC_IDLE                1           // nothing arrived for RPC_IDLE_MS
+
+/*
+ * Carry out one request. The arguments are the request's bytes after its header; results go in the buffer given,
+ * which holds up to RPC_MAX_DATA bytes, with their size set through the last pointer. Returns an RPC_XXXX status.
+ */
+typedef uint8_t (*RPC_CB_Request)(void *, uint8_t, const uint8_t *, uint16_t, uint8_t *, uint16_t *);
+
+typedef struct __RPC_ControlDef {
+    /* The UART to transmit on. Data is received through uartrx.h, which must be started on the same UART. */
+    UART_HandleTypeDef *huart;
+
+    /* User data argument to pass to the callback */
+    void *cb_data;
+
+    /* Called for every well-formed request except RPC_OP_EXIT, in the order they arrive. */
+    RPC_CB_Request request;
+
+} RPC_ControlDef;
+
+/* Answer requests until the host exits or goes quiet. Returns RPC_EXIT or RPC_IDLE. */
+uint8_t rpc_serve(const RPC_ControlDef *);
+
+#endif
@@ -0,0 +1,60 @@
+/**
+ * @brief   Streaming parser for sparse ROM images
+ */
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "stm32f4xx_hal.h"
+
+#define SPARSE_MAGIC            0x534D4F52U // "ROMS"
+#define SPARSE_VERSION          1
+#define SPARSE_MAX_CHUNKS       64
+
+// Chunk types
+#define SPARSE_DATA             0           // bytes to program, sent in the image
+#define SPARSE_FILL             1           // bytes that must read as 0xFF: erased, but not sent or programmed
+#define SPARSE_DONT_CARE        2           // bytes left as they are
+
+// One entry of the chunk table, as it appears in the image: little-endian, twelve bytes
+typedef struct __Sparse_ChunkDef {
+    uint32_t address;
+    uint32_t length;
+    uint32_t type;
+} Sparse_ChunkDef;
+
+typedef HAL_StatusTypeDef (*Sparse_CB_Table)(void *, const Sparse_ChunkDef *, uint16_t);
+typedef HAL_StatusTypeDef (*Sparse_CB_Seek)(void *, uint32_t);
+typedef HAL_StatusTypeDef (*Sparse_CB_Write)(void *, const uint8_t *, uint16_t);
+
+typedef struct __Sparse_ControlDef {
+    /* User data argument to pass to the callbacks */
+    void *cb_data;
+
+    /*
+     * Called once the chunk table has been read and checked, before any data. Chunks are in ascending address
+     * order and don't overlap. Any status other than HAL_OK stops parsing.
+     */
+    Sparse_CB_Table table;
+
+    /* The following writes go at this address. Addresses only ever increase. */
+    Sparse_CB_Seek seek;
+
+    /*
+     * Consume data for the current address, which then moves on by its size. Fill chunks arrive as writes of 0xFF,
+     * at most 1K at a time. Any status other than HAL_OK stops parsing.
+     */
+    Sparse_CB_Write write;
+
+} Sparse_ControlDef;
+
+/* Begin parsing a new image. There is only one parser. */
+void sparse_start(const Sparse_ControlDef *);
+
+/* Parse the next part of the image. Bytes after the last chunk's data are ignored. */
+HAL_StatusTypeDef sparse_feed(const uint8_t *, uint32_t);
+
+/* Returns HAL_OK if every chunk has been passed on, HAL_ERROR otherwise. */
+HAL_StatusTypeDef sparse_finish(void);
+
+#endif
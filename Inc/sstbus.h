@@ -0,0 +1,183 @@
+/**
+ * @brief   Register-level SST39LF020 parallel bus cycles
+ */
+
+#ifndef SSTBUS_H
+#define SSTBUS_H
+
+#include "stm32f4xx_hal.h"
+
+#include "main.h"
+#include "sstaddr.h"
+
+#define SST_COMMAND_WRITE   0xA0        // write one byte
+#define SST_COMMAND_ERASE   0x80        // sector/chip erase
+#define SST_COMMAND_IDMODE  0x90        // access software ID
+#define SST_COMMAND_EXIT    0xF0        // exit software ID mode
+
+#define SST_BUS_DQ6                 0x40            // toggle bit
+#define SST_BUS_DQ7                 0x80            // Data# polling bit
+
+#define SST_BUS_DATA_MODER_MASK     0x0000ffffU     // MODER bits for PC0-PC7
+#define SST_BUS_DATA_MODER_OUTPUT   0x00005555U     // general purpose output mode for PC0-PC7
+
+// Control line BSRR words: /WE and /OE share port A, /CE is on port C with the data bus
+#define SST_BUS_CE_LOW              ((uint32_t)SST_CE_Pin << 16)
+#define SST_BUS_CE_HIGH             ((uint32_t)SST_CE_Pin)
+#define SST_BUS_WE_LOW              ((uint32_t)SST_WE_Pin << 16)
+#define SST_BUS_WE_HIGH             ((uint32_t)SST_WE_Pin)
+#define SST_BUS_OE_LOW              ((uint32_t)SST_OE_Pin << 16)
+#define SST_BUS_OE_HIGH             ((uint32_t)SST_OE_Pin)
+
+// GPIOC->MODER values with the data bus as input or output, captured by sst_bus_begin()
+extern uint32_t sst_bus_moder_input;
+extern uint32_t sst_bus_moder_output;
+
+/* Deselect the ROM, and capture the port C mode words for switching the data bus direction. */
+void sst_bus_begin(void);
+
+/* Leave the data bus as input with the ROM deselected. */
+void sst_bus_end(void);
+
+/* Switch PC0-PC7 to outputs in a single store. */
+static inline void sst_bus_output(void)
+{
+    GPIOC->MODER = sst_bus_moder_output;
+}
+
+/* Switch PC0-PC7 to inputs in a single store. */
+static inline void sst_bus_input(void)
+{
+    GPIOC->MODER = sst_bus_moder_input;
+}
+
+/* Drive the address lines, which are all over the joint - see sstaddr.h, generated from main.h. */
+static inline void sst_bus_address(uint32_t address)
+{
+    sst_address_set(address);
+}
+
+/**
+ * Perform a write cycle. The data bus must be an output.
+ *
+ * The SST39LF020's timing constraints are:
+ *  T(AS) - address setup time          0ns
+ *  T(AH) - address hold time           30ns
+ *  T(CS) - /WE, /CS setup time         0ns
+ *  T(CH) - /WE, /CS hold time          0ns
+ *  T(CP) - /CE pulse width             40ns
+ *  T(WP) - /WE pulse width             40ns
+ *  T(CPH) - /CE pulse width high       30ns
+ *  T(WPH) - /WE pulse width high       30ns
+ *
+ * Set address, set data, lower /CE, lower /WE, wait 40ns or longer, raise /WE, raise /CE, wait 30ns or longer.
+ *
+ * The STM32F411 runs at 100MHz, so each clock cycle is 10ns. Four NOPs guarantee the 40ns pulse; the stores
+ * that follow a cycle's final edge cover the 30ns high time before the next one.
+ */
+static inline void sst_bus_write(uint32_t address, uint8_t data)
+{
+
+    sst_bus_address(address);
+    *((volatile uint8_t *)&GPIOC->ODR) = data;
+
+    GPIOC->BSRR = SST_BUS_CE_LOW;
+    GPIOA->BSRR = SST_BUS_WE_LOW;
+
+    __NOP();
+    __NOP();
+    __NOP();
+    __NOP();
+
+    GPIOA->BSRR = SST_BUS_WE_HIGH;
+    GPIOC->BSRR = SST_BUS_CE_HIGH;
+
+}
+
+/**
+ * Perform a read cycle. The data bus must be an input.
+ *
+ * The SST39LF020 has 55ns access time from address or /CE, and 30ns from /OE.
+ */
+static inline uint8_t sst_bus_read(uint32_t address)
+{
+
+    uint8_t data;
+
+    sst_bus_address(address);
+
+    GPIOC->BSRR = SST_BUS_CE_LOW;
+    GPIOA->BSRR = SST_BUS_OE_LOW;
+
+    __NOP();
+    __NOP();
+    __NOP();
+    __NOP();
+    __NOP();
+    __NOP();
+
+    data = *((volatile uint8_t *)&GPIOC->IDR);
+
+    GPIOA->BSRR = SST_BUS_OE_HIGH;
+    GPIOC->BSRR = SST_BUS_CE_HIGH;
+
+    return data;
+
+}
+
+/**
+ * Issue the software data protection sequence and command byte for a byte program, then the byte itself. The data
+ * bus is driven for the four write cycles and left as input, ready for polling.
+ */
+static inline void sst_bus_program_byte(uint32_t address, uint8_t data)
+{
+
+    sst_bus_output();
+
+    sst_bus_write(0x5555, 0xaa);
+    sst_bus_write(0x2aaa, 0x55);
+    sst_bus_write(0x5555, SST_COMMAND_WRITE);
+    sst_bus_write(address, data);
+
+    sst_bus_input();
+
+}
+
+/**
+ * Poll a running program or erase. While it runs, DQ6 toggles on every read and DQ7 reads as the complement of the
+ * byte being written (or 0 for an erase). Two /OE pulses are made at a held address with /CE held low.
+ *
+ * Returns zero once the operation is complete: DQ6 has stopped toggling and DQ7 matches the data. Otherwise the
+ * result has SST_BUS_DQ6 set if the chip is still toggling, and SST_BUS_DQ7 set if DQ7 doesn't match.
+ */
+static inline uint8_t sst_bus_poll(uint32_t address, uint8_t data)
+{
+
+    uint8_t first, second;
+
+    sst_bus_address(address);
+    GPIOC->BSRR = SST_BUS_CE_LOW;
+
+    GPIOA->BSRR = SST_BUS_OE_LOW;
+    __NOP();
+    __NOP();
+    __NOP();
+    first = *((volatile uint8_t *)&GPIOC->IDR);
+    GPIOA->BSRR = SST_BUS_OE_HIGH;
+
+    __NOP();
+
+    GPIOA->BSRR = SST_BUS_OE_LOW;
+    __NOP();
+    __NOP();
+    __NOP();
+    second = *((volatile uint8_t *)&GPIOC->IDR);
+    GPIOA->BSRR = SST_BUS_OE_HIGH;
+
+    GPIOC->BSRR = SST_BUS_CE_HIGH;
+
+    return ((first ^ second) & SST_BUS_DQ6) | ((second ^ data) & SST_BUS_DQ7);
+
+}
+
+#endif
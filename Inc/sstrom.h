@@ -10,9 +10,19 @@
 #define SST_ROM_ERASE_SECTOR        0
 #define SST_ROM_ERASE_ALL           1
 
+#define SST_ROM_SIZE                (256 * 1024)    // SST39LF020 capacity
+#define SST_ROM_SECTOR_SIZE         4096            // smallest erase
+
+/* Claim a timer, with DMA linked for its update and channel 1 requests, to pace bulk reads. Call from a thread. */
+HAL_StatusTypeDef sst_rom_init(TIM_HandleTypeDef *);
+
 HAL_StatusTypeDef sst_rom_read_id(uint8_t *, uint8_t *);
 HAL_StatusTypeDef sst_rom_erase(uint32_t, uint8_t);
 HAL_StatusTypeDef sst_rom_program(uint32_t, const uint8_t *, uint32_t);
+HAL_StatusTypeDef sst_rom_program_erased(uint32_t, const uint8_t *, uint32_t);
+HAL_StatusTypeDef sst_rom_read_start(uint32_t, uint8_t *, uint32_t);
+HAL_StatusTypeDef sst_rom_read_wait(void);
+HAL_StatusTypeDef sst_rom_read(uint32_t, uint8_t *, uint32_t);
 HAL_StatusTypeDef sst_rom_read_sector(uint32_t, uint8_t *);
 
 #endif
\ No newline at end of file
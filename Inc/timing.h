@@ -0,0 +1,42 @@
+/**
+ * @brief   Microsecond timing: DWT cycle counting and timer-driven short sleeps
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "stm32f4xx_hal.h"
+
+#define TIMING_SPIN_US          20          // sleeps shorter than this spin rather than pay for two context switches
+
+/* Enable the cycle counter and take ownership of a one-pulse 1MHz timer for sleeping. Call once, from a thread. */
+HAL_StatusTypeDef timing_init(TIM_HandleTypeDef *);
+
+/* Block the calling thread for at least the given number of microseconds, yielding the CPU where worthwhile. */
+void timing_sleep_us(uint32_t);
+
+/* Called from HAL_TIM_PeriodElapsedCallback() for the timing timer. */
+void timing_timer_elapsed(TIM_HandleTypeDef *);
+
+/* The free-running CPU cycle counter. It wraps after about 42 seconds at 100MHz. */
+static inline uint32_t timing_cycles(void)
+{
+    return DWT->CYCCNT;
+}
+
+/* Microseconds since a timing_cycles() reading. */
+static inline uint32_t timing_elapsed_us(uint32_t since)
+{
+    return (DWT->CYCCNT - since) / (SystemCoreClock / 1000000);
+}
+
+/* Spin for at least the given number of microseconds without yielding. */
+static inline void timing_spin_us(uint32_t us)
+{
+    uint32_t start = DWT->CYCCNT;
+    uint32_t cycles = us * (SystemCoreClock / 1000000);
+
+    while (DWT->CYCCNT - start < cycles) {}
+}
+
+#endif
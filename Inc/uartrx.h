@@ -0,0 +1,34 @@
+/**
+ * @brief   Buffered UART receive: circular DMA into a FreeRTOS stream buffer
+ */
+
+#ifndef UARTRX_H
+#define UARTRX_H
+
+#include "stm32f4xx_hal.h"
+
+#define UART_RX_DMA_SIZE        512         // circular DMA buffer; drained at half, full, and line idle
+#define UART_RX_STREAM_SIZE     2048        // room for a YMODEM 1K packet and more while the reader is busy
+
+/* Start, or restart, receiving on a UART with a circular RX DMA stream linked. Call from a thread. */
+HAL_StatusTypeDef uart_rx_start(UART_HandleTypeDef *);
+
+/* Receive exactly the given number of bytes, like HAL_UART_Receive(). HAL_MAX_DELAY waits forever. */
+HAL_StatusTypeDef uart_rx_read(uint8_t *, uint16_t, uint32_t);
+
+/* Receive up to the given number of bytes, waiting only for the first. Returns how many, zero on timeout. */
+uint16_t uart_rx_read_some(uint8_t *, uint16_t, uint32_t);
+
+/* Discard everything received so far. */
+void uart_rx_flush(void);
+
+/* Bytes lost because the stream buffer was full. */
+uint32_t uart_rx_dropped(void);
+
+/* Called from the UART interrupt, before HAL_UART_IRQHandler(), to pass data on when the line goes idle. */
+void uart_rx_irq(UART_HandleTypeDef *);
+
+/* Called from HAL_UART_ErrorCallback(): an overrun or framing error stops the DMA, so start it again. */
+void uart_rx_error(UART_HandleTypeDef *);
+
+#endif
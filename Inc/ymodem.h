@@ -12,9 +12,10 @@
 typedef int (*YModem_CB_Open)(void *, const char *, uint32_t);
 typedef int (*YModem_CB_Write)(void *, const uint8_t *, uint16_t);
 typedef void (*YModem_CB_Close)(void *, uint8_t);
+typedef int (*YModem_CB_Read)(void *, uint32_t, uint8_t *, uint16_t);
 
 typedef struct __YModem_ControlDef {
-    /* The UART to communicate across. */
+    /* The UART to transmit on. Data is received through uartrx.h, which must be started on the same UART. */
     UART_HandleTypeDef *huart;
 
     /* User data argument to pass to all callbacks */
@@ -41,9 +42,37 @@ typedef struct __YModem_ControlDef {
      */
     YModem_CB_Close close;
 
+    /*
+     * True to ask for YMODEM-g: the sender streams packets without waiting for ACKs, and any error cancels the
+     * transfer. The write callback must keep up with the line.
+     */
+    uint8_t streaming;
+
 } YModem_ControlDef;
 
+typedef struct __YModem_SendDef {
+    /* The UART to transmit on. Data is received through uartrx.h, which must be started on the same UART. */
+    UART_HandleTypeDef *huart;
+
+    /* User data argument to pass to the callback */
+    void *cb_data;
+
+    /* The file to send: its name, as the receiver will see it, and size in bytes */
+    const char *filename;
+    uint32_t size;
+
+    /*
+     * Fill a buffer with file data from the given offset. Return YMODEM_OK, or anything else to cancel.
+     * The size will be 1024, except for the final packet.
+     */
+    YModem_CB_Read read;
+
+} YModem_SendDef;
+
 /* Receive zero or more files using YMODEM. Returns one of the YMODEM_XXXX constants. */
 uint8_t ymodem_receive(const YModem_ControlDef *);
 
+/* Send one file using YMODEM, or YMODEM-g if the receiver asks. Returns one of the YMODEM_XXXX constants. */
+uint8_t ymodem_send(const YModem_SendDef *);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef ZMODEM_H
+#define ZMODEM_H
+
+#include <stdint.h>
+#include "stm32f4xx_hal.h"
+#include "ymodem.h"
+
+typedef int (*ZModem_CB_Open)(void *, const char *, uint32_t, uint32_t *);
+
+typedef struct __ZModem_ControlDef {
+    /* The UART to transmit on. Data is received through uartrx.h, which must be started on the same UART. */
+    UART_HandleTypeDef *huart;
+
+    /* User data argument to pass to all callbacks */
+    void *cb_data;
+
+    /*
+     * Return YMODEM_OK to accept the file and begin transfer, or anything else to cancel.
+     * The filename will always be supplied, but size may be zero if the sender did not provide it.
+     * The offset starts at zero; set it to have the sender skip that many bytes and resume from there.
+     */
+    ZModem_CB_Open open;
+
+    /*
+     * Return YMODEM_OK if the write was successful, or anything else to cancel the transfer.
+     * Data arrives in order from the offset given by open, in subpackets of at most 1024 bytes.
+     */
+    YModem_CB_Write write;
+
+    /*
+     * Terminate a transfer.
+     * This will be called with YMODEM_OK in the normal course of events, or one of the
+     * other YMODEM_XXXX constants if an abnormal termination occurs.
+     */
+    YModem_CB_Close close;
+
+} ZModem_ControlDef;
+
+/* Receive zero or more files using ZMODEM. Returns one of the YMODEM_XXXX constants. */
+uint8_t zmodem_receive(const ZModem_ControlDef *);
+
+#endif
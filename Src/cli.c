@@ -1,6 +1,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <inttypes.h>
 
 #include "cmsis_os.h"
 #include "task.h"
@@ -8,17 +9,134 @@
 #include "main.h"
 #include "cli.h"
 #include "ymodem.h"
+#include "zmodem.h"
+#include "romwriter.h"
 #include "sstrom.h"
 #include "sdcard.h"
-
-// When writing a ROM image, this structure tracks the work done so far.
+#include "crc32.h"
+#include "uartrx.h"
+#include "lz4frame.h"
+#include "sparse.h"
+#include "hexrec.h"
+#include "rpc.h"
+
+// A stretch of ROM to erase, for an image that doesn't cover it from address zero
+typedef struct __CLI_Range {
+    uint32_t start;
+    uint32_t end;
+} CLI_Range;
+
+// When writing a ROM image, this structure tracks the work done so far. The address is advanced as packets are
+// received, while erased is advanced by the writer thread as packets are programmed.
 typedef struct __CLI_ROM_Upload {
     SPI_ROM_ConfigDef *spi_rom;
     uint32_t address;
     uint32_t erased;
+    uint32_t blank;                 // start of the erased region nothing has been programmed into since
     uint32_t filesize;
+    SPI_ROM_ErasePlanDef plan;
+    HAL_StatusTypeDef status;
+    uint8_t streaming;              // true if the sender won't wait, so erases must finish before the data
+    uint8_t differential;           // true to only rewrite sectors that changed
+    uint32_t sector;                // differential: address of the sector being collected
+    uint32_t fill;                  // differential: bytes collected for that sector
+    uint32_t unchanged;             // differential: sectors left alone
+    uint32_t programmed;            // differential: sectors programmed without an erase
+    uint32_t rewritten;             // differential: sectors erased and programmed
+    const CLI_Range *ranges;        // sparse: the stretches to erase, in order; NULL to erase from the start
+    uint16_t range_count;
+    uint16_t range;                 // sparse: the stretch being erased
 } CLI_ROM_Upload;
 
+typedef struct __CLI_SST_Upload {
+    uint32_t address;               // next address to program
+    uint32_t erased;                // end of the erased region
+    uint32_t blank;                 // start of the erased region nothing has been programmed into since
+    uint32_t sectors;               // sector erases performed
+    uint8_t chip;                   // true if the whole chip was erased
+} CLI_SST_Upload;
+
+// A run of the image written contiguously to the ROM
+typedef struct __CLI_Verify_Segment {
+    uint32_t offset;                // where the run starts in the image
+    uint32_t address;               // and in the ROM
+} CLI_Verify_Segment;
+
+#define CLI_VERIFY_SEGMENTS     64
+
+// Uploads keep a CRC-32 of the received image, checkpointed every block. Reading the ROM back through the same CRC
+// finds the first block that differs without keeping a copy of the image. Images with holes are checked through a
+// map of where each run of data went.
+typedef struct __CLI_Verify {
+    uint32_t block;                 // bytes between checkpoints, a power of two
+    uint32_t length;                // bytes fed so far
+    uint32_t crc;                   // CRC-32 of the whole image, once received
+    uint32_t bad;                   // start of the first block that failed to match
+    uint32_t checkpoints[1024];     // CRC-32 of the image up to the end of each block
+    uint16_t segments;              // runs in the map, or zero if there were too many to keep track of
+    CLI_Verify_Segment map[CLI_VERIFY_SEGMENTS];
+} CLI_Verify;
+
+// A ZMODEM upload that failed part way, which sending the same file again can pick up from
+typedef struct __CLI_Resume {
+    char name[32];                  // the file, as the sender named it
+    uint32_t size;                  // its size, as the sender gave it
+    uint32_t committed;             // bytes programmed before the failure, zero if there's nothing to resume
+} CLI_Resume;
+
+// How an upload reaches a ROM, whatever form the image arrives in
+typedef struct __CLI_ROM_Ops {
+    YModem_CB_Open open;            // an image from address zero, of the given size or zero if unknown
+    Sparse_CB_Table table;          // optional: an image of just these chunks; otherwise opened with no size
+    Sparse_CB_Seek seek;            // the data that follows goes here, past anything written so far
+    YModem_CB_Write write;
+    YModem_CB_Close close;
+} CLI_ROM_Ops;
+
+// Image formats, chosen by file name
+#define CLI_FORMAT_BINARY       0           // the ROM's contents from address zero
+#define CLI_FORMAT_SPARSE       1           // *.sparse: see sparse.c
+#define CLI_FORMAT_HEX          2           // *.hex, *.ihx: Intel HEX records
+#define CLI_FORMAT_SREC         3           // *.srec, *.s19, *.s28, *.s37, *.mot: Motorola S-records
+
+// A YMODEM upload sits between the protocol and a ROM's own callbacks. It unpacks LZ4 compressed (*.lz4), sparse
+// and hex record images, so the ROM sees the data as if it had been sent as plain writes.
+typedef struct __CLI_Unpack {
+    void *cb_data;                  // the ROM's callbacks, and their argument
+    const CLI_ROM_Ops *rom;
+    LZ4_Frame_ControlDef frame;     // the decoders' callbacks, back into this structure
+    Sparse_ControlDef sparse;
+    HexRec_ControlDef hexrec;
+    char name[32];                  // the file, as the sender named it
+    uint8_t compressed;             // true if the file is an LZ4 frame
+    uint8_t format;                 // CLI_FORMAT_XXXX of the file, once decompressed
+    uint8_t opened;                 // true once the ROM's open callback has been called
+    uint8_t failed;                 // true once a failure has set upload_error
+    uint8_t incomplete;             // true if the transfer ended before the image did
+    uint8_t streaming;              // true if the sender won't wait for erases: YMODEM-g
+} CLI_Unpack;
+
+// A range of a ROM being sent back to the host
+typedef struct __CLI_Dump {
+    const SPI_ROM_ConfigDef *spi_rom;
+    uint32_t start;                 // ROM address of the first byte sent
+} CLI_Dump;
+
+// Binary mode keeps the writer programming in the background between requests
+typedef struct __CLI_RPC {
+    CLI_SetupTypeDef *config;
+    const ROM_Writer_ControlDef *writer;
+    uint8_t writing;                // RPC_TARGET_XXXX the writer is programming, or CLI_RPC_IDLE
+    uint32_t capacity;              // of the ROM being programmed
+} CLI_RPC;
+
+typedef HAL_StatusTypeDef (*CLI_Verify_Read)(void *, uint32_t, uint8_t *, uint32_t);
+
+#define CLI_DIFF_SECTOR_SIZE    4096        // largest smallest-erase a differential upload can handle
+#define CLI_VERIFY_BLOCKS       (sizeof(cli_verify.checkpoints) / sizeof(cli_verify.checkpoints[0]))
+#define CLI_VERIFY_CHUNK        CLI_DIFF_SECTOR_SIZE    // bytes read back at a time, into diff_rom
+#define CLI_VERIFY_OK           0xffffffffU // no bad block
+
 // State machine transitions
 #define STATE_IDLE      0           // waiting for a system command
 #define STATE_SDCARD    1           // waiting for an SD card command
@@ -28,14 +146,39 @@ typedef struct __CLI_ROM_Upload {
 #define CMD_HELP        '?'         // show help message
 #define CMD_SPI_INFO    'i'         // retrieve ROM information
 #define CMD_SPI_UPLOAD  'u'         // upload ROM image
+#define CMD_SPI_DIFF    'd'         // upload ROM image, rewriting only changed sectors
+#define CMD_SPI_ZMODEM  'w'         // upload ROM image by ZMODEM, resuming a failed upload
 #define CMD_SPI_PEEK    'p'         // dump the first page of the ROM
+#define CMD_SPI_CLOCK   'c'         // calibrate the ROM's SPI clock
 #define CMD_SST_INFO    'x'         // retrieve parallel ROM information
 #define CMD_SST_PEEK    'o'         // dump first 128 bytes of parallel ROM
 #define CMD_SST_PANIC   'z'         // dump 128 bytes at 0x12000 of SST ROM
 #define CMD_SST_UPLOAD  'r'         // upload parallel ROM image
+#define CMD_SST_SUM     'k'         // read the whole parallel ROM and checksum it
 #define CMD_SD_MODE     's'         // open SD menu
+#define CMD_BAUD        'b'         // change the UART baud rate
+#define CMD_STREAMING   'g'         // toggle YMODEM-g streaming uploads
+#define CMD_SPI_DUMP    'e'         // send a range of the ROM by YMODEM
+#define CMD_SST_DUMP    'y'         // send a range of the parallel ROM by YMODEM
+#define CMD_RPC         '\0'        // a frame delimiter: switch to binary mode, see rpc.c
+
+#define CLI_BAUD_DEFAULT        115200      // the rate the UART starts at, and falls back to
+#define CLI_BAUD_CONFIRM_MS     10000       // how long a new rate has to prove itself with a command
+#define CLI_DUMP_PROMPT_MS      30000       // how long to wait for each key of a dump's address range
+#define CLI_RPC_IDLE            0xff        // no programming in progress
 
 static uint32_t sst_peek_address = 0;
+static uint8_t cli_streaming = 0;       // true to upload with YMODEM-g
+
+static CLI_Verify cli_verify;
+static CLI_Range cli_ranges[SPARSE_MAX_CHUNKS];
+static CLI_Resume cli_resume;
+
+// A differential upload compares incoming sectors against the ROM in these. Nothing else runs while one is in
+// progress, and verifying only starts once the writer is finished, so read-backs and the SST checksum borrow them
+// rather than keep buffers of their own.
+static uint8_t diff_data[CLI_DIFF_SECTOR_SIZE];
+static uint8_t diff_rom[CLI_DIFF_SECTOR_SIZE];
 
 void cli_rom_info(const CLI_SetupTypeDef *config)
 {
@@ -44,16 +187,27 @@ void cli_rom_info(const CLI_SetupTypeDef *config)
     static char *busy = "Error: SPI system is busy\r\n";
     static char *timeout = "Error: SPI timeout\r\n";
     static char *error = "Error: unknown SPI error\r\n";
+    const SPI_ROM_DeviceDef *device = config->spi_rom.device;
     HAL_StatusTypeDef result;
-    uint8_t manufacturer;
-    uint16_t device_id;
+    uint8_t i;
 
-    result = spi_rom_read_jedec_id(&config->spi_rom, &manufacturer, &device_id);
+    result = spi_rom_detect(&config->spi_rom);
 
     switch (result) {
         case HAL_OK:
             snprintf(buffer, sizeof(buffer), "Manufacturer: %02x\r\nDevice ID: %04x\r\n",
-                manufacturer, device_id);
+                device->manufacturer, device->device_id);
+            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            snprintf(buffer, sizeof(buffer), "Capacity: %" PRIu32 " bytes (%s)\r\nPage: %u bytes, %" PRIu32 " us\r\n",
+                device->capacity, device->sfdp ? "SFDP" : "JEDEC ID", device->page_size, device->program_typical_us);
+            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            for (i = 0; i < SPI_ROM_ERASE_TYPES && device->erase[i].size != 0; i++) {
+                snprintf(buffer, sizeof(buffer), "Erase: %" PRIu32 "K, opcode %02x, %" PRIu32 " ms\r\n",
+                    device->erase[i].size / 1024, device->erase[i].opcode, device->erase[i].typical_us / 1000);
+                HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            }
+            snprintf(buffer, sizeof(buffer), "Chip erase: %" PRIu32 " ms\r\nSPI clock: %" PRIu32 " kHz\r\n",
+                device->chip_erase_typical_us / 1000, spi_rom_clock_hz(&config->spi_rom) / 1000);
             HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
             break;
         case HAL_BUSY:
@@ -71,348 +225,1967 @@ void cli_rom_info(const CLI_SetupTypeDef *config)
 
 }
 
+void cli_rom_calibrate(const CLI_SetupTypeDef *config)
+{
+
+    static char buffer[64];
+    static char *nodevice = "Error: no SPI device\r\n";
+    static char *error = "Error: calibration failed, SPI ROM may need reprogramming\r\n";
+
+    if (spi_rom_detect(&config->spi_rom) != HAL_OK) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)nodevice, strlen(nodevice), HAL_MAX_DELAY);
+        return;
+    }
+
+    if (spi_rom_calibrate(&config->spi_rom) != HAL_OK) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)error, strlen(error), HAL_MAX_DELAY);
+    }
+
+    snprintf(buffer, sizeof(buffer), "SPI clock: %" PRIu32 " kHz\r\n", spi_rom_clock_hz(&config->spi_rom) / 1000);
+    HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+}
+
 void cli_prom_info(const CLI_SetupTypeDef *config)
 {
 
-    static char buffer[128];
+    static char buffer[128];
+
+    uint8_t manufacturer;
+    uint8_t device_id;
+
+    sst_rom_read_id(&manufacturer, &device_id);
+
+    snprintf(buffer, sizeof(buffer), "Manufacturer: %02x\r\nDevice ID: %02x\r\n",
+        manufacturer, device_id);
+    HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+    sst_peek_address = 0;
+
+}
+
+static char *upload_error = "unknown error\r\n";
+
+static HAL_StatusTypeDef cli_erase_step(CLI_ROM_Upload *);
+
+// Begin checksumming an image for a ROM of the given capacity
+static void cli_verify_start(uint32_t capacity)
+{
+
+    cli_verify.block = 256;
+    while (cli_verify.block * CLI_VERIFY_BLOCKS < capacity) {
+        cli_verify.block <<= 1;
+    }
+
+    cli_verify.length = 0;
+    cli_verify.bad = CLI_VERIFY_OK;
+    cli_verify.segments = 1;
+    cli_verify.map[0].offset = 0;
+    cli_verify.map[0].address = 0;
+
+    // A resumed upload is checked against the checkpoints about to be overwritten
+    cli_resume.committed = 0;
+
+    crc32_start();
+
+}
+
+// Add data to the CRC, recording checkpoints or, when checking, comparing against them
+static void cli_verify_feed(const uint8_t *data, uint32_t size, uint8_t check)
+{
+
+    uint32_t chunk, index;
+
+    while (size > 0) {
+
+        chunk = cli_verify.block - (cli_verify.length & (cli_verify.block - 1));
+        chunk = chunk < size ? chunk : size;
+
+        crc32_update(data, chunk);
+        cli_verify.length += chunk;
+        data += chunk;
+        size -= chunk;
+
+        index = cli_verify.length / cli_verify.block - 1;
+        if ((cli_verify.length & (cli_verify.block - 1)) != 0 || index >= CLI_VERIFY_BLOCKS) {
+            continue;
+        }
+
+        if (!check) {
+            cli_verify.checkpoints[index] = crc32_value();
+        } else if (cli_verify.bad == CLI_VERIFY_OK && crc32_value() != cli_verify.checkpoints[index]) {
+            cli_verify.bad = index * cli_verify.block;
+        }
+
+    }
+
+}
+
+// The image carries on at a new ROM address
+static void cli_verify_seek(uint32_t address)
+{
+
+    CLI_Verify_Segment *last;
+
+    if (cli_verify.segments == 0) {
+        return;
+    }
+
+    last = &cli_verify.map[cli_verify.segments - 1];
+    if (last->address + (cli_verify.length - last->offset) == address) {
+        return;
+    }
+
+    // Nothing went to the old address, so the run just starts somewhere else
+    if (last->offset == cli_verify.length) {
+        last->address = address;
+        return;
+    }
+
+    if (cli_verify.segments == CLI_VERIFY_SEGMENTS) {
+        cli_verify.segments = 0;
+        return;
+    }
+
+    last++;
+    last->offset = cli_verify.length;
+    last->address = address;
+    cli_verify.segments++;
+
+}
+
+// The ROM address an offset in the image went to
+static uint32_t cli_verify_address(uint32_t offset)
+{
+
+    uint16_t segment = 0;
+
+    while (segment + 1 < cli_verify.segments && cli_verify.map[segment + 1].offset <= offset) {
+        segment++;
+    }
+
+    return cli_verify.map[segment].address + (offset - cli_verify.map[segment].offset);
+
+}
+
+/**
+ * Read back the image just received, using the given read function, and report whether it matches. Called once the
+ * ROM is idle.
+ */
+static void cli_verify_report(CLI_SetupTypeDef *config, CLI_Verify_Read read, void *arg)
+{
+
+    static char *error = "Verify: read error\r\n";
+    static char *scattered = "Verify: skipped, image too scattered\r\n";
+    char buffer[80];
+    uint32_t length = cli_verify.length, offset, chunk, next;
+    uint16_t segment = 0;
+
+    if (cli_verify.segments == 0) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)scattered, strlen(scattered), HAL_MAX_DELAY);
+        return;
+    }
+
+    cli_verify.crc = crc32_value();
+    cli_verify.length = 0;
+    crc32_start();
+
+    for (offset = 0; offset < length; offset += chunk) {
+
+        chunk = length - offset < CLI_VERIFY_CHUNK ? length - offset : CLI_VERIFY_CHUNK;
+
+        // Reads stop at the end of each run
+        if (segment + 1 < cli_verify.segments && cli_verify.map[segment + 1].offset == offset) {
+            segment++;
+        }
+        next = segment + 1 < cli_verify.segments ? cli_verify.map[segment + 1].offset : length;
+        chunk = chunk < next - offset ? chunk : next - offset;
+
+        if (read(arg, cli_verify.map[segment].address + (offset - cli_verify.map[segment].offset), diff_rom,
+                 chunk) != HAL_OK) {
+            HAL_UART_Transmit(config->huart, (uint8_t *)error, strlen(error), HAL_MAX_DELAY);
+            return;
+        }
+
+        cli_verify_feed(diff_rom, chunk, 1);
+
+    }
+
+    // A difference in the last, partial block is only caught by the final CRC
+    if (cli_verify.bad == CLI_VERIFY_OK && crc32_value() != cli_verify.crc) {
+        cli_verify.bad = (length - 1) & ~(cli_verify.block - 1);
+    }
+
+    if (cli_verify.bad == CLI_VERIFY_OK) {
+        snprintf(buffer, sizeof(buffer), "Verify: match, CRC32 %08" PRIx32 " over %" PRIu32 " bytes\r\n",
+            cli_verify.crc, length);
+    } else {
+        snprintf(buffer, sizeof(buffer), "Verify: MISMATCH, first bad address in %06" PRIx32 "-%06" PRIx32 "\r\n",
+            cli_verify_address(cli_verify.bad), cli_verify_address(cli_verify.bad + cli_verify.block - 1));
+    }
+    HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+}
+
+static HAL_StatusTypeDef cli_verify_read_spi(void *arg, uint32_t address, uint8_t *data, uint32_t size)
+{
+
+    return spi_rom_read((const SPI_ROM_ConfigDef *)arg, address, data, size);
+
+}
+
+static HAL_StatusTypeDef cli_verify_read_sst(void *arg, uint32_t address, uint8_t *data, uint32_t size)
+{
+
+    UNUSED(arg);
+
+    return sst_rom_read(address, data, size);
+
+}
+
+// Check the start of the ROM against the checkpoints of an earlier upload, leaving the CRC ready to carry on
+static HAL_StatusTypeDef cli_verify_resume(const SPI_ROM_ConfigDef *spi_rom, uint32_t offset)
+{
+
+    uint32_t address, chunk;
+
+    for (address = 0; address < offset; address += chunk) {
+
+        chunk = offset - address < CLI_VERIFY_CHUNK ? offset - address : CLI_VERIFY_CHUNK;
+
+        if (spi_rom_read(spi_rom, address, diff_rom, chunk) != HAL_OK) {
+            return HAL_ERROR;
+        }
+
+        cli_verify_feed(diff_rom, chunk, 1);
+
+    }
+
+    return cli_verify.bad == CLI_VERIFY_OK ? HAL_OK : HAL_ERROR;
+
+}
+
+// Round the sparse ranges out to whole sectors, merging any that then meet so no sector is erased twice. Returns
+// the end of the last range.
+static uint32_t cli_merge_ranges(CLI_ROM_Upload *upload)
+{
+
+    CLI_Range *ranges = cli_ranges;
+    uint32_t sector = upload->spi_rom->device->erase[0].size;
+    uint16_t i, count = 0;
+
+    for (i = 0; i < upload->range_count; i++) {
+
+        ranges[i].start &= ~(sector - 1);
+        ranges[i].end = (ranges[i].end + sector - 1) & ~(sector - 1);
+
+        if (count > 0 && ranges[i].start <= ranges[count - 1].end) {
+            ranges[count - 1].end = ranges[i].end;
+        } else {
+            ranges[count++] = ranges[i];
+        }
+
+    }
+
+    upload->range_count = count;
+
+    return ranges[count - 1].end;
+
+}
+
+// Prepare SPI for an image upload starting at *offset, which is set back to zero if the ROM doesn't match up to it
+static int cli_open_image(CLI_ROM_Upload *upload, uint32_t size, uint32_t *offset)
+{
+
+    // Is there an SPI device present, and what is it?
+    if (spi_rom_detect(upload->spi_rom) != HAL_OK) {
+        upload_error = "bad SPI device\r\n";
+        return YMODEM_ERROR;
+    }
+
+    if (size > upload->spi_rom->device->capacity
+            || (upload->range_count > 0 && cli_merge_ranges(upload) > upload->spi_rom->device->capacity)) {
+        upload_error = "file too large for SPI device\r\n";
+        return YMODEM_ERROR;
+    }
+
+    cli_verify_start(upload->spi_rom->device->capacity);
+
+    // Everything before the offset must already be in the ROM, exactly as the checkpoints have it
+    if (*offset > 0 && cli_verify_resume(upload->spi_rom, *offset) != HAL_OK) {
+        cli_verify_start(upload->spi_rom->device->capacity);
+        *offset = 0;
+    }
+
+    upload->address = *offset;
+    upload->erased = *offset;
+    upload->blank = *offset;
+    upload->filesize = size;
+    upload->status = HAL_OK;
+    upload->fill = 0;
+    upload->unchanged = 0;
+    upload->programmed = 0;
+    upload->rewritten = 0;
+
+    if (upload->differential) {
+
+        // Nothing is erased until it's known to need it
+        if (upload->spi_rom->device->erase[0].size > CLI_DIFF_SECTOR_SIZE) {
+            upload_error = "sectors too large for differential upload\r\n";
+            return YMODEM_ERROR;
+        }
+
+    } else if (upload->range_count > 0) {
+
+        // A sparse image: only the sectors its chunks touch are erased, a range at a time, ahead of the data. The
+        // ranges aren't known until the first packet, so they're erased in the background.
+        upload->range = 0;
+        upload->erased = upload->ranges[0].start;
+        spi_rom_plan_erase(upload->spi_rom, upload->ranges[0].start, upload->ranges[0].end, 0, &upload->plan);
+
+        rom_writer_prepare();
+
+    } else {
+
+        // The image replaces the whole ROM, so a chip erase is fair game unless resuming. The writer works through
+        // the plan while it waits for data, so most of the erasing is done before the data arrives.
+        spi_rom_plan_erase(upload->spi_rom, *offset, size, *offset == 0, &upload->plan);
+
+        // A streaming sender won't wait for an erase, so finish it before asking for the data. The writer is idle.
+        while (upload->streaming && upload->erased < upload->plan.end) {
+            if (cli_erase_step(upload) != HAL_OK) {
+                return YMODEM_ERROR;
+            }
+        }
+
+        rom_writer_prepare();
+
+    }
+
+    // Flag that ROM programming is in progress
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
+
+    return YMODEM_OK;
+
+}
+
+// Prepare SPI for file upload
+static int cli_open_file(void *arg, const char *filename, uint32_t size)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+    uint32_t offset = 0;
+
+    UNUSED(filename);
+
+    upload->ranges = NULL;
+    upload->range_count = 0;
+
+    return cli_open_image(upload, size, &offset);
+
+}
+
+// Prepare SPI for file upload by ZMODEM, picking up where the last attempt at the same file failed
+static int cli_zmodem_open(void *arg, const char *filename, uint32_t size, uint32_t *offset)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+    uint32_t align;
+
+    upload->ranges = NULL;
+    upload->range_count = 0;
+
+    // Resume from the start of the erase sector and verify block the failure happened in
+    *offset = 0;
+    if (cli_resume.committed > 0 && cli_resume.size == size
+            && strncmp(cli_resume.name, filename, sizeof(cli_resume.name) - 1) == 0
+            && spi_rom_detect(upload->spi_rom) == HAL_OK) {
+        align = upload->spi_rom->device->erase[0].size;
+        align = align > cli_verify.block ? align : cli_verify.block;
+        *offset = cli_resume.committed & ~(align - 1);
+    }
+
+    if (cli_open_image(upload, size, offset) != YMODEM_OK) {
+        return YMODEM_ERROR;
+    }
+
+    strncpy(cli_resume.name, filename, sizeof(cli_resume.name) - 1);
+    cli_resume.size = size;
+
+    return YMODEM_OK;
+
+}
+
+// Prepare SPI for a sparse image, erasing only what its chunks cover
+static HAL_StatusTypeDef cli_open_sparse(void *arg, const Sparse_ChunkDef *chunks, uint16_t count)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+    uint32_t offset = 0;
+    uint16_t i;
+
+    if (upload->differential) {
+        upload_error = "sparse images can't be uploaded differentially\r\n";
+        return HAL_ERROR;
+    }
+
+    upload->ranges = cli_ranges;
+    upload->range_count = 0;
+
+    for (i = 0; i < count; i++) {
+        if (chunks[i].type != SPARSE_DONT_CARE) {
+            cli_ranges[upload->range_count].start = chunks[i].address;
+            cli_ranges[upload->range_count].end = chunks[i].address + chunks[i].length;
+            upload->range_count++;
+        }
+    }
+
+    return cli_open_image(upload, 0, &offset) == YMODEM_OK ? HAL_OK : HAL_ERROR;
+
+}
+
+// Move on to where the next data goes, leaving everything in between alone
+static HAL_StatusTypeDef cli_seek(void *arg, uint32_t address)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+
+    if (address == upload->address) {
+        return HAL_OK;
+    }
+
+    // The differential sector buffer and the writer's erase frontier only move forwards
+    if (upload->differential || address < upload->address) {
+        upload_error = upload->differential ? "images with holes can't be uploaded differentially\r\n"
+                                            : "image out of order\r\n";
+        return HAL_ERROR;
+    }
+
+    cli_verify_seek(address);
+    upload->address = address;
+
+    return HAL_OK;
+
+}
+
+// Perform the next erase in the plan - runs on the writer thread
+static HAL_StatusTypeDef cli_erase_step(CLI_ROM_Upload *upload)
+{
+
+    HAL_StatusTypeDef result;
+    uint32_t erase;
+
+    // A sparse image's next range follows on once this one is done
+    if (upload->erased >= upload->plan.end && upload->range + 1 < upload->range_count) {
+        upload->range++;
+        upload->erased = upload->ranges[upload->range].start;
+        spi_rom_plan_erase(upload->spi_rom, upload->erased, upload->ranges[upload->range].end, 0, &upload->plan);
+    }
+
+    erase = spi_rom_plan_step(upload->spi_rom, &upload->plan, upload->erased);
+
+    if ((result = spi_rom_erase(upload->spi_rom, upload->erased, erase)) != HAL_OK) {
+        upload_error = "bad ROM erase\r\n";
+        return result;
+    }
+
+    upload->erased += erase;
+
+    return HAL_OK;
+
+}
+
+// Erase ahead of the data while the writer is idle
+static HAL_StatusTypeDef cli_prepare_data(void *arg)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+    HAL_StatusTypeDef result;
+
+    if (upload->erased >= upload->plan.end && upload->range + 1 >= upload->range_count) {
+        return HAL_OK;
+    }
+
+    if ((result = cli_erase_step(upload)) != HAL_OK) {
+        return result;
+    }
+
+    return upload->erased < upload->plan.end || upload->range + 1 < upload->range_count ? HAL_BUSY : HAL_OK;
+
+}
+
+// Erase and program SPI ROM - runs on the writer thread
+static HAL_StatusTypeDef cli_program_data(void *arg, uint32_t address, const uint8_t *data, uint16_t size)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+    HAL_StatusTypeDef result;
+
+    if (upload->range_count == 0) {
+
+        // A write past everything erased so far starts afresh at its own sector, leaving the hole before it alone
+        if (address > upload->erased) {
+            upload->erased = address & ~(upload->spi_rom->device->erase[0].size - 1);
+            upload->blank = upload->erased;
+        }
+
+        // no filesize given, or it wasn't right - plan just enough erasing for this write
+        if (address + size > upload->plan.end) {
+            spi_rom_plan_erase(upload->spi_rom, upload->erased, address + size, 0, &upload->plan);
+        }
+
+    }
+
+    // upload->erased holds the next address requiring erasing; it always lands on an erase boundary. A sparse
+    // image's ranges cover all of its data.
+    while (upload->erased < address + size) {
+        if (upload->erased >= upload->plan.end && upload->range + 1 >= upload->range_count) {
+            upload_error = "data outside the image's chunks\r\n";
+            return HAL_ERROR;
+        }
+        if ((result = cli_erase_step(upload)) != HAL_OK) {
+            return result;
+        }
+    }
+
+    // This will write in at most page-sized chunks. Everything from blank up to erased still reads as 0xFF, so
+    // pages of padding there needn't be programmed at all.
+    if (address >= upload->blank) {
+        result = spi_rom_program_erased(upload->spi_rom, address, data, size);
+        upload->blank = address + size;
+    } else {
+        result = spi_rom_program(upload->spi_rom, address, data, size);
+    }
+
+    if (result != HAL_OK) {
+        upload_error = "bad ROM program\r\n";
+    }
+
+    return result;
+
+}
+
+// Bring the collected sector up to date with the least work - runs on the writer thread
+static HAL_StatusTypeDef cli_diff_flush(CLI_ROM_Upload *upload)
+{
+
+    const SPI_ROM_DeviceDef *device = upload->spi_rom->device;
+    uint32_t sector_size = device->erase[0].size;
+    uint32_t page, run, i;
+    HAL_StatusTypeDef result;
+
+    if (upload->fill == 0) {
+        return HAL_OK;
+    }
+
+    if ((result = spi_rom_read(upload->spi_rom, upload->sector, diff_rom, sector_size)) != HAL_OK) {
+        upload_error = "bad ROM read\r\n";
+        return result;
+    }
+
+    // Bytes past the end of the image keep their current contents
+    memcpy(&diff_data[upload->fill], &diff_rom[upload->fill], sector_size - upload->fill);
+    upload->fill = 0;
+
+    if (memcmp(diff_data, diff_rom, sector_size) == 0) {
+        upload->unchanged++;
+        return HAL_OK;
+    }
+
+    // Programming can only clear bits; any bit going from 0 to 1 needs an erase
+    for (i = 0; i < sector_size; i++) {
+        if ((diff_rom[i] & diff_data[i]) != diff_data[i]) {
+            break;
+        }
+    }
+
+    if (i < sector_size) {
+
+        if ((result = spi_rom_erase(upload->spi_rom, upload->sector, sector_size)) != HAL_OK) {
+            upload_error = "bad ROM erase\r\n";
+            return result;
+        }
+
+        memset(diff_rom, 0xff, sector_size);
+        upload->rewritten++;
+
+    } else {
+
+        upload->programmed++;
+
+    }
+
+    // Program each run of pages that differ from what's now in the ROM
+    for (page = 0; page < sector_size; page = run) {
+
+        run = page + device->page_size;
+
+        if (memcmp(&diff_data[page], &diff_rom[page], device->page_size) == 0) {
+            continue;
+        }
+
+        while (run < sector_size && memcmp(&diff_data[run], &diff_rom[run], device->page_size) != 0) {
+            run += device->page_size;
+        }
+
+        result = spi_rom_program(upload->spi_rom, upload->sector + page, &diff_data[page], run - page);
+        if (result != HAL_OK) {
+            upload_error = "bad ROM program\r\n";
+            return result;
+        }
+
+    }
+
+    return HAL_OK;
+
+}
+
+// Collect data into whole sectors, flushing each as it fills - runs on the writer thread
+static HAL_StatusTypeDef cli_diff_data(void *arg, uint32_t address, const uint8_t *data, uint16_t size)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+    uint32_t sector_size = upload->spi_rom->device->erase[0].size;
+    uint32_t offset, chunk;
+    HAL_StatusTypeDef result;
+
+    // An empty write marks the end of the image
+    if (size == 0) {
+        return cli_diff_flush(upload);
+    }
+
+    while (size > 0) {
+
+        if (upload->fill > 0 && (address & ~(sector_size - 1)) != upload->sector) {
+            if ((result = cli_diff_flush(upload)) != HAL_OK) {
+                return result;
+            }
+        }
+
+        upload->sector = address & ~(sector_size - 1);
+        offset = address - upload->sector;
+        chunk = sector_size - offset < size ? sector_size - offset : size;
+
+        memcpy(&diff_data[offset], data, chunk);
+        upload->fill = offset + chunk;
+
+        if (upload->fill == sector_size) {
+            if ((result = cli_diff_flush(upload)) != HAL_OK) {
+                return result;
+            }
+        }
+
+        address += chunk;
+        data += chunk;
+        size -= chunk;
+
+    }
+
+    return HAL_OK;
+
+}
+
+// Queue data for writing to SPI ROM
+static int cli_write_data(void *arg, const uint8_t *data, uint16_t size)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+
+    if (upload->address + size > upload->spi_rom->device->capacity) {
+        upload_error = "file too large for SPI device\r\n";
+        return YMODEM_ERROR;
+    }
+
+    // The packet is programmed in the background while the next one is received
+    if (rom_writer_submit(upload->address, data, size) != HAL_OK) {
+        return YMODEM_ERROR;
+    }
+
+    cli_verify_feed(data, size, 0);
+
+    upload->address += size;
+
+    return YMODEM_OK;
+
+}
+
+// Finalise ROM write
+static void cli_close_file(void *arg, uint8_t status)
+{
+
+    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
+
+    UNUSED(status);
+
+    // A differential upload holds back the last partial sector until told the image is done
+    if (upload->differential) {
+        rom_writer_submit(upload->address, NULL, 0);
+    }
+
+    // The last packets were ACKed before being programmed, so wait for them to land
+    upload->status = rom_writer_finish();
+
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+
+}
+
+// Pass data on in the form the file takes once decompressed
+static HAL_StatusTypeDef cli_unpack_data(CLI_Unpack *unpack, const uint8_t *data, uint16_t size)
+{
+
+    if (unpack->format == CLI_FORMAT_SPARSE) {
+        if (sparse_feed(data, size) != HAL_OK) {
+            if (!unpack->failed) {
+                upload_error = "bad sparse image\r\n";
+                unpack->failed = 1;
+            }
+            return HAL_ERROR;
+        }
+        return HAL_OK;
+    }
+
+    if (unpack->format == CLI_FORMAT_HEX || unpack->format == CLI_FORMAT_SREC) {
+        if (hexrec_feed(data, size) != HAL_OK) {
+            if (!unpack->failed) {
+                upload_error = "bad hex record\r\n";
+                unpack->failed = 1;
+            }
+            return HAL_ERROR;
+        }
+        return HAL_OK;
+    }
+
+    if (unpack->rom->write(unpack->cb_data, data, size) != YMODEM_OK) {
+        unpack->failed = 1;
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+
+}
+
+// Open the ROM for a compressed binary once the frame header says how big it will be
+static HAL_StatusTypeDef cli_unpack_header(void *arg, uint32_t size)
+{
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+
+    if (unpack->opened || unpack->format != CLI_FORMAT_BINARY) {
+        return HAL_OK;
+    }
+
+    unpack->opened = 1;
+
+    if (unpack->rom->open(unpack->cb_data, unpack->name, size) != YMODEM_OK) {
+        unpack->failed = 1;
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+
+}
+
+static HAL_StatusTypeDef cli_unpack_output(void *arg, const uint8_t *data, uint16_t size)
+{
+
+    return cli_unpack_data((CLI_Unpack *)arg, data, size);
+
+}
+
+// Open the ROM for a sparse image once its chunks are known. A ROM that can't plan for them erases as it goes.
+static HAL_StatusTypeDef cli_unpack_table(void *arg, const Sparse_ChunkDef *chunks, uint16_t count)
+{
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+    HAL_StatusTypeDef result;
+
+    unpack->opened = 1;
+
+    if (unpack->rom->table != NULL) {
+        result = unpack->rom->table(unpack->cb_data, chunks, count);
+    } else {
+        result = unpack->rom->open(unpack->cb_data, unpack->name, 0) == YMODEM_OK ? HAL_OK : HAL_ERROR;
+    }
+
+    unpack->failed = result != HAL_OK;
+
+    return result;
+
+}
+
+static HAL_StatusTypeDef cli_unpack_seek(void *arg, uint32_t address)
+{
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+
+    if (unpack->rom->seek(unpack->cb_data, address) != HAL_OK) {
+        unpack->failed = 1;
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+
+}
+
+static HAL_StatusTypeDef cli_unpack_write_rom(void *arg, const uint8_t *data, uint16_t size)
+{
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+
+    if (unpack->rom->write(unpack->cb_data, data, size) != YMODEM_OK) {
+        unpack->failed = 1;
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+
+}
+
+// True if the name ends with the given extension, which is then cut off
+static uint8_t cli_extension(char *name, const char *extension)
+{
+
+    size_t length = strlen(name), size = strlen(extension);
+
+    if (length <= size || strcmp(name + length - size, extension) != 0) {
+        return 0;
+    }
+
+    name[length - size] = '\0';
+
+    return 1;
+
+}
+
+// Work out what form the file takes from its name, and get ready to unpack it
+static int cli_unpack_open(void *arg, const char *filename, uint32_t size)
+{
+
+    static const struct {
+        const char *extension;
+        uint8_t format;
+    } formats[] = {
+        { ".sparse", CLI_FORMAT_SPARSE },
+        { ".hex", CLI_FORMAT_HEX },
+        { ".ihx", CLI_FORMAT_HEX },
+        { ".srec", CLI_FORMAT_SREC },
+        { ".s19", CLI_FORMAT_SREC },
+        { ".s28", CLI_FORMAT_SREC },
+        { ".s37", CLI_FORMAT_SREC },
+        { ".mot", CLI_FORMAT_SREC },
+    };
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+    char base[sizeof(unpack->name)];
+    size_t i;
+
+    strncpy(unpack->name, filename, sizeof(unpack->name) - 1);
+    unpack->name[sizeof(unpack->name) - 1] = '\0';
+    strcpy(base, unpack->name);
+
+    unpack->compressed = cli_extension(base, ".lz4");
+    unpack->format = CLI_FORMAT_BINARY;
+    unpack->opened = 0;
+    unpack->failed = 0;
+    unpack->incomplete = 0;
+
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (cli_extension(base, formats[i].extension)) {
+            unpack->format = formats[i].format;
+            break;
+        }
+    }
+
+    // Only a plain binary image says up front everything that needs erasing, so it can all be erased before the
+    // data is asked for. Anything else is erased as the data reaches it, which a streaming sender won't wait for.
+    if (unpack->streaming && (unpack->compressed || unpack->format != CLI_FORMAT_BINARY)) {
+        upload_error = "YMODEM-g takes plain binary images only\r\n";
+        return YMODEM_ERROR;
+    }
+
+    if (unpack->format == CLI_FORMAT_SPARSE) {
+        sparse_start(&unpack->sparse);
+    }
+
+    // Records carry their own addresses, so the ROM is opened with no size and erases a sector at a time as the
+    // data reaches it, passing over whatever the records don't cover
+    if (unpack->format == CLI_FORMAT_HEX || unpack->format == CLI_FORMAT_SREC) {
+        hexrec_start(&unpack->hexrec, unpack->format == CLI_FORMAT_HEX ? HEXREC_INTEL : HEXREC_SREC);
+        if (unpack->compressed) {
+            lz4_frame_start(&unpack->frame);
+        }
+        unpack->opened = 1;
+        return unpack->rom->open(unpack->cb_data, unpack->name, 0);
+    }
+
+    if (!unpack->compressed && unpack->format == CLI_FORMAT_BINARY) {
+        unpack->opened = 1;
+        return unpack->rom->open(unpack->cb_data, filename, size);
+    }
+
+    // The size given is the compressed size, so opening waits for the frame header
+    if (unpack->compressed) {
+        lz4_frame_start(&unpack->frame);
+    }
+
+    return YMODEM_OK;
+
+}
+
+static int cli_unpack_write(void *arg, const uint8_t *data, uint16_t size)
+{
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+
+    if (!unpack->compressed) {
+        return cli_unpack_data(unpack, data, size) == HAL_OK ? YMODEM_OK : YMODEM_ERROR;
+    }
+
+    if (lz4_frame_feed(data, size) != HAL_OK) {
+        if (!unpack->failed) {
+            upload_error = "bad compressed image\r\n";
+        }
+        return YMODEM_ERROR;
+    }
+
+    return YMODEM_OK;
+
+}
+
+static void cli_unpack_close(void *arg, uint8_t status)
+{
+
+    CLI_Unpack *unpack = (CLI_Unpack *)arg;
+
+    // YMODEM only knows the file all arrived, not that it held a whole image
+    if (status == YMODEM_OK) {
+        if (unpack->compressed && lz4_frame_finish() != HAL_OK) {
+            upload_error = "incomplete compressed image\r\n";
+            unpack->incomplete = 1;
+        } else if (unpack->format == CLI_FORMAT_SPARSE && sparse_finish() != HAL_OK) {
+            upload_error = "incomplete sparse image\r\n";
+            unpack->incomplete = 1;
+        } else if ((unpack->format == CLI_FORMAT_HEX || unpack->format == CLI_FORMAT_SREC)
+                && hexrec_finish() != HAL_OK) {
+            if (!unpack->failed) {
+                upload_error = "incomplete hex file\r\n";
+            }
+            unpack->incomplete = 1;
+        }
+    }
+
+    // A frame header can be rejected before there was anything to open the ROM for
+    if (unpack->opened) {
+        unpack->rom->close(unpack->cb_data, unpack->incomplete ? YMODEM_ERROR : status);
+    }
+
+}
+
+static const CLI_ROM_Ops cli_spi_ops = {
+    &cli_open_file,
+    &cli_open_sparse,
+    &cli_seek,
+    &cli_write_data,
+    &cli_close_file,
+};
+
+static void cli_rom_upload(CLI_SetupTypeDef *config, uint8_t differential, uint8_t zmodem)
+{
+
+    static char *ready = "ROMble ready to receive file... ";
+    static char *okay = "OK!\r\n";
+    static char *fail = "transfer failed: ";
+    char buffer[96];
+
+    // A differential upload decides what to erase sector by sector as the data arrives, so it can't stream. ZMODEM
+    // has no streaming mode of its own.
+    const uint8_t streaming = cli_streaming && !differential && !zmodem;
+
+    CLI_ROM_Upload upload = {
+        &config->spi_rom, 0, 0, 0, 0, { 0 }, HAL_OK, streaming, differential, 0, 0, 0, 0, 0, NULL, 0, 0
+    };
+    CLI_Unpack unpack = {
+        (void *)&upload,
+        &cli_spi_ops,
+        { (void *)&unpack, &cli_unpack_header, &cli_unpack_output },
+        { (void *)&unpack, &cli_unpack_table, &cli_unpack_seek, &cli_unpack_write_rom },
+        { (void *)&unpack, &cli_unpack_seek, &cli_unpack_write_rom },
+        { 0 }, 0, 0, 0, 0, 0, streaming,
+    };
+    const YModem_ControlDef ctrl = {
+        config->huart,
+        (void *)&unpack,
+        &cli_unpack_open,
+        &cli_unpack_write,
+        &cli_unpack_close,
+        streaming,
+    };
+    const ZModem_ControlDef zctrl = {
+        config->huart,
+        (void *)&upload,
+        &cli_zmodem_open,
+        &cli_write_data,
+        &cli_close_file,
+    };
+    const ROM_Writer_ControlDef writer = {
+        (void *)&upload,
+        differential ? &cli_diff_data : &cli_program_data,
+        differential ? NULL : &cli_prepare_data,
+    };
+
+    HAL_UART_Transmit(config->huart, (uint8_t *)ready, strlen(ready), HAL_MAX_DELAY);
+
+    // Wait 5 seconds for user to select the file. A ZMODEM receiver keeps prompting until the sender starts.
+    if (!zmodem) {
+        osDelay(configTICK_RATE_HZ * 5);
+    }
+
+    upload_error = "unknown error\r\n";
+
+    rom_writer_start(&writer);
+
+    uint8_t result = zmodem ? zmodem_receive(&zctrl) : ymodem_receive(&ctrl);
+
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+
+    // Everything received before a failure has been programmed, unless programming was what failed
+    if (zmodem && result != YMODEM_OK && upload.status == HAL_OK && upload.address > 0) {
+        cli_resume.committed = upload.address;
+    }
+
+    // A failure programming the final packets, or a short compressed image, is only discovered once the transfer
+    // has completed
+    if (result == YMODEM_OK && (upload.status != HAL_OK || unpack.incomplete)) {
+        result = YMODEM_ERROR;
+    }
+
+    osDelay(configTICK_RATE_HZ * 1);
+
+    switch (result) {
+        case YMODEM_OK:
+            HAL_UART_Transmit(config->huart, (uint8_t *)okay, strlen(okay), HAL_MAX_DELAY);
+            if (differential) {
+                snprintf(buffer, sizeof(buffer),
+                    "Sectors unchanged: %" PRIu32 ", programmed: %" PRIu32 ", rewritten: %" PRIu32 "\r\n",
+                    upload.unchanged, upload.programmed, upload.rewritten);
+                HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            }
+            cli_verify_report(config, &cli_verify_read_spi, (void *)&config->spi_rom);
+            break;
+        default:
+            HAL_UART_Transmit(config->huart, (uint8_t *)fail, strlen(fail), HAL_MAX_DELAY);
+            HAL_UART_Transmit(config->huart, (uint8_t *)upload_error, strlen(upload_error), HAL_MAX_DELAY);
+            if (cli_resume.committed > 0) {
+                snprintf(buffer, sizeof(buffer), "Send %s again with 'w' to resume after %" PRIu32 " bytes\r\n",
+                    cli_resume.name, cli_resume.committed);
+                HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            }
+            break;
+    }
+
+}
+
+// Erase the SST ROM, setting the upload error on failure
+static int cli_sst_erase(uint32_t address, uint8_t type)
+{
+
+    switch (sst_rom_erase(address, type)) {
+        case HAL_OK:
+            return YMODEM_OK;
+        case HAL_TIMEOUT:
+            upload_error = "page erase timeout\r\n";
+            return YMODEM_ERROR;
+        default:
+            upload_error = "page erase error\r\n";
+            return YMODEM_ERROR;
+    }
+
+}
+
+// Plan and perform the erase for the whole image, before any data arrives
+static int cli_sst_open_file(void *arg, const char *filename, uint32_t size)
+{
+
+    CLI_SST_Upload *upload = (CLI_SST_Upload *)arg;
+    uint32_t end;
+
+    UNUSED(filename);
+
+    if (size > SST_ROM_SIZE) {
+        upload_error = "file too large for parallel ROM\r\n";
+        return YMODEM_ERROR;
+    }
+
+    upload->address = 0;
+    upload->erased = 0;
+    upload->blank = 0;
+    upload->sectors = 0;
+    upload->chip = 0;
+
+    cli_verify_start(SST_ROM_SIZE);
+
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
+
+    // The sender waits for the header's ACK, so the erase isn't stacked onto any data packet's ACK
+    end = (size + SST_ROM_SECTOR_SIZE - 1) & ~(SST_ROM_SECTOR_SIZE - 1);
+
+    if (end == SST_ROM_SIZE) {
+
+        // One chip erase takes about as long as four sector erases
+        if (cli_sst_erase(0, SST_ROM_ERASE_ALL) != YMODEM_OK) {
+            return YMODEM_ERROR;
+        }
+
+        upload->erased = SST_ROM_SIZE;
+        upload->chip = 1;
+
+    }
+
+    while (upload->erased < end) {
+
+        if (cli_sst_erase(upload->erased, SST_ROM_ERASE_SECTOR) != YMODEM_OK) {
+            return YMODEM_ERROR;
+        }
+
+        upload->erased += SST_ROM_SECTOR_SIZE;
+        upload->sectors++;
+
+    }
+
+    return YMODEM_OK;
+
+}
+
+static int cli_sst_write_data(void *arg, const uint8_t *data, uint16_t size)
+{
+
+    CLI_SST_Upload *upload = (CLI_SST_Upload *)arg;
+    HAL_StatusTypeDef result;
+
+    // A write past everything erased so far starts afresh at its own sector, leaving the hole before it alone
+    if (upload->address > upload->erased) {
+        upload->erased = upload->address & ~(SST_ROM_SECTOR_SIZE - 1);
+        upload->blank = upload->erased;
+    }
+
+    // no filesize given, or it wasn't right - erase sectors as the data reaches them
+    while (upload->erased < upload->address + size) {
+
+        if (upload->erased >= SST_ROM_SIZE) {
+            upload_error = "file too large for parallel ROM\r\n";
+            return YMODEM_ERROR;
+        }
+
+        if (cli_sst_erase(upload->erased, SST_ROM_ERASE_SECTOR) != YMODEM_OK) {
+            return YMODEM_ERROR;
+        }
+
+        upload->erased += SST_ROM_SECTOR_SIZE;
+        upload->sectors++;
+
+    }
+
+    // Bytes of padding in the untouched part of the erased region are already 0xFF
+    if (upload->address >= upload->blank) {
+        result = sst_rom_program_erased(upload->address, data, size);
+        upload->blank = upload->address + size;
+    } else {
+        result = sst_rom_program(upload->address, data, size);
+    }
+
+    if (result != HAL_OK) {
+        upload_error = result == HAL_TIMEOUT ? "page write timeout\r\n" : "page write error\r\n";
+        return YMODEM_ERROR;
+    }
+
+    cli_verify_feed(data, size, 0);
+
+    upload->address += size;
+
+    return YMODEM_OK;
+
+}
+
+
+// Move on to where the next data goes, leaving everything in between alone
+static HAL_StatusTypeDef cli_sst_seek(void *arg, uint32_t address)
+{
+
+    CLI_SST_Upload *upload = (CLI_SST_Upload *)arg;
+
+    if (address < upload->address) {
+        upload_error = "image out of order\r\n";
+        return HAL_ERROR;
+    }
+
+    cli_verify_seek(address);
+    upload->address = address;
+
+    return HAL_OK;
+
+}
+
+static void cli_sst_close_file(void *arg, uint8_t status)
+{
+
+    UNUSED(arg);
+    UNUSED(status);
+
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+
+}
+
+
+static const CLI_ROM_Ops cli_sst_ops = {
+    &cli_sst_open_file,
+    NULL,
+    &cli_sst_seek,
+    &cli_sst_write_data,
+    &cli_sst_close_file,
+};
+
+static void cli_sst_upload(CLI_SetupTypeDef *config)
+{
+
+    static char *ready = "ROMble ready to receive file... ";
+    static char *okay = "OK!\r\n";
+    static char *fail = "transfer failed: ";
+
+    char buffer[40];
+
+    CLI_SST_Upload upload = { 0, 0, 0, 0, 0 };
+    CLI_Unpack unpack = {
+        (void *)&upload,
+        &cli_sst_ops,
+        { (void *)&unpack, &cli_unpack_header, &cli_unpack_output },
+        { (void *)&unpack, &cli_unpack_table, &cli_unpack_seek, &cli_unpack_write_rom },
+        { (void *)&unpack, &cli_unpack_seek, &cli_unpack_write_rom },
+        { 0 }, 0, 0, 0, 0, 0, cli_streaming,
+    };
+    const YModem_ControlDef ctrl = {
+        config->huart,
+        (void *)&unpack,
+        &cli_unpack_open,
+        &cli_unpack_write,
+        &cli_unpack_close,
+        cli_streaming,
+    };
+
+    HAL_UART_Transmit(config->huart, (uint8_t *)ready, strlen(ready), HAL_MAX_DELAY);
+
+    upload_error = "unknown error\r\n";
+
+    // Wait 5 seconds for user to select the file
+    osDelay(configTICK_RATE_HZ * 5);
+
+    uint8_t result = ymodem_receive(&ctrl);
+
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+
+    if (result == YMODEM_OK && unpack.incomplete) {
+        result = YMODEM_ERROR;
+    }
+
+    osDelay(configTICK_RATE_HZ * 1);
+
+    switch (result) {
+        case YMODEM_OK:
+            HAL_UART_Transmit(config->huart, (uint8_t *)okay, strlen(okay), HAL_MAX_DELAY);
+            if (upload.chip) {
+                snprintf(buffer, sizeof(buffer), "Erased: chip\r\n");
+            } else {
+                snprintf(buffer, sizeof(buffer), "Erased: %" PRIu32 " sectors\r\n", upload.sectors);
+            }
+            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            cli_verify_report(config, &cli_verify_read_sst, NULL);
+            break;
+        default:
+            HAL_UART_Transmit(config->huart, (uint8_t *)fail, strlen(fail), HAL_MAX_DELAY);
+            HAL_UART_Transmit(config->huart, (uint8_t *)upload_error, strlen(upload_error), HAL_MAX_DELAY);
+            break;
+    }
+
+}
+
+#define P(c) (isprint(c) ? c : '.')
+
+static void cli_rom_peek(CLI_SetupTypeDef *config)
+{
+
+    static char *error = "Error reading from Flash ROM\r\n";
+    static char buffer[80];
+    static uint8_t page[256];
+    uint8_t i;
+
+    // read a page from the ROM
+    if (spi_rom_read_page(&config->spi_rom, 0, page) == HAL_OK) {
+
+        for (i = 0; i < 16; i++) {
+
+            snprintf(buffer, 80,
+                    "%02X %02X %02X %02X %02X %02X %02X %02X - %02X %02X %02X %02X %02X %02X %02X %02X",
+                    page[i*16+0], page[i*16+1], page[i*16+2], page[i*16+3],
+                    page[i*16+4], page[i*16+5], page[i*16+6], page[i*16+7],
+                    page[i*16+8], page[i*16+9], page[i*16+10], page[i*16+11],
+                    page[i*16+12], page[i*16+13], page[i*16+14], page[i*16+15]
+            );
+            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+            snprintf(buffer, 80, "    %c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c\r\n",
+                    P(page[i*16+0]), P(page[i*16+1]), P(page[i*16+2]), P(page[i*16+3]),
+                    P(page[i*16+4]), P(page[i*16+5]), P(page[i*16+6]), P(page[i*16+7]),
+                    P(page[i*16+8]), P(page[i*16+9]), P(page[i*16+10]), P(page[i*16+11]),
+                    P(page[i*16+12]), P(page[i*16+13]), P(page[i*16+14]), P(page[i*16+15])
+            );
+            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+        }
+
+    } else {
+
+        HAL_UART_Transmit(config->huart, (uint8_t *)error, strlen(error), HAL_MAX_DELAY);
+
+    }
+
+}
+
+static void cli_sst_peek(CLI_SetupTypeDef *config)
+{
+
+    static char buffer[80];
+    static uint8_t sector[512];
+    uint8_t i;
+
+    sst_peek_address &= SST_ROM_SIZE - 1;
+    sst_rom_read(sst_peek_address, sector, sizeof(sector));
+
+    // display 512 bytes of data
+    for (i = 0; i < 32; i++) {
+
+        snprintf(buffer, 80,
+            "%05" PRIX32 "   %02X %02X %02X %02X %02X %02X %02X %02X - %02X %02X %02X %02X %02X %02X %02X %02X",
+            sst_peek_address,
+            sector[i*16+0],  sector[i*16+1],  sector[i*16+2],  sector[i*16+3],
+            sector[i*16+4],  sector[i*16+5],  sector[i*16+6],  sector[i*16+7],
+            sector[i*16+8],  sector[i*16+9],  sector[i*16+10], sector[i*16+11],
+            sector[i*16+12], sector[i*16+13], sector[i*16+14], sector[i*16+15]
+        );
+        sst_peek_address += 32;
+        HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+        snprintf(buffer, 80, "    %c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c\r\n",
+                P(sector[i*16+0]), P(sector[i*16+1]), P(sector[i*16+2]), P(sector[i*16+3]),
+                P(sector[i*16+4]), P(sector[i*16+5]), P(sector[i*16+6]), P(sector[i*16+7]),
+                P(sector[i*16+8]), P(sector[i*16+9]), P(sector[i*16+10]), P(sector[i*16+11]),
+                P(sector[i*16+12]), P(sector[i*16+13]), P(sector[i*16+14]), P(sector[i*16+15])
+        );
+        HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+    }
+
+}
+
+// Rates the ST-Link's VCP bridge handles; each is within 0.5% at 50MHz APB1 with 16x oversampling
+static const uint32_t cli_baud_rates[] = { CLI_BAUD_DEFAULT, 460800, 921600, 2000000 };
+
+// Change the UART's baud rate. HAL_UART_Transmit() waits for the last byte out, so nothing is cut short.
+static void cli_set_baud(CLI_SetupTypeDef *config, uint32_t rate)
+{
+
+    config->huart->Init.BaudRate = rate;
+    HAL_UART_Init(config->huart);
+    uart_rx_start(config->huart);
+
+}
+
+/**
+ * Ask for a new baud rate and switch to it. Returns true if the rate changed, in which case the host has to send a
+ * command at the new rate within CLI_BAUD_CONFIRM_MS or the CLI drops back to the default.
+ */
+static uint8_t cli_baud(CLI_SetupTypeDef *config)
+{
+
+    static char *prompt = "Baud rate: 0 - 115200, 1 - 460800, 2 - 921600, 3 - 2000000\r\n";
+    static char *unchanged = "Baud rate unchanged\r\n";
+    char buffer[80];
+    char choice;
+    uint32_t rate;
+
+    HAL_UART_Transmit(config->huart, (uint8_t *)prompt, strlen(prompt), HAL_MAX_DELAY);
+
+    if (uart_rx_read((uint8_t *)&choice, 1, CLI_BAUD_CONFIRM_MS) != HAL_OK
+            || choice < '0' || choice >= '0' + sizeof(cli_baud_rates) / sizeof(cli_baud_rates[0])
+            || cli_baud_rates[choice - '0'] == config->huart->Init.BaudRate) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)unchanged, strlen(unchanged), HAL_MAX_DELAY);
+        return 0;
+    }
+
+    rate = cli_baud_rates[choice - '0'];
+
+    snprintf(buffer, sizeof(buffer), "Switching to %" PRIu32 " baud; send a command within %d seconds to keep it\r\n",
+        rate, CLI_BAUD_CONFIRM_MS / 1000);
+    HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+    cli_set_baud(config, rate);
+
+    return rate != CLI_BAUD_DEFAULT;
+
+}
+
+#define CLI_SST_SUM_BLOCK   2048
+
+/**
+ * Read the whole parallel ROM and print a byte sum of it. Each block is summed while the DMA reads the next one,
+ * so this mostly measures the read engine.
+ */
+static void cli_sst_sum(CLI_SetupTypeDef *config)
+{
+
+    static char *error = "Error reading from parallel ROM\r\n";
+    static char buffer[48];
+    uint8_t *blocks[2] = { diff_data, diff_rom };
+    uint32_t address, byte, sum = 0, ticks;
+    HAL_StatusTypeDef result;
+    uint8_t *block;
+
+    ticks = osKernelGetTickCount();
+
+    result = sst_rom_read_start(0, blocks[0], CLI_SST_SUM_BLOCK);
+
+    for (address = 0; result == HAL_OK && address < SST_ROM_SIZE; address += CLI_SST_SUM_BLOCK) {
+
+        if ((result = sst_rom_read_wait()) != HAL_OK) {
+            break;
+        }
+
+        block = blocks[(address / CLI_SST_SUM_BLOCK) & 1];
+
+        if (address + CLI_SST_SUM_BLOCK < SST_ROM_SIZE) {
+            result = sst_rom_read_start(address + CLI_SST_SUM_BLOCK, blocks[((address / CLI_SST_SUM_BLOCK) + 1) & 1],
+                                        CLI_SST_SUM_BLOCK);
+        }
+
+        for (byte = 0; byte < CLI_SST_SUM_BLOCK; byte++) {
+            sum += block[byte];
+        }
+
+    }
+
+    ticks = osKernelGetTickCount() - ticks;
+
+    if (result != HAL_OK) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)error, strlen(error), HAL_MAX_DELAY);
+        return;
+    }
+
+    snprintf(buffer, sizeof(buffer), "Checksum: %08" PRIx32 " (%" PRIu32 " ms)\r\n",
+        sum, ticks * 1000 / configTICK_RATE_HZ);
+    HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+
+}
+
+/**
+ * Read a hex number typed at the console, echoing it, up to a carriage return. An empty line leaves <value> alone.
+ * Returns HAL_OK, or HAL_ERROR if anything other than a hex digit or backspace turns up, or nothing does in time.
+ */
+static HAL_StatusTypeDef cli_read_hex(CLI_SetupTypeDef *config, const char *prompt, uint32_t *value)
+{
+
+    static char *crlf = "\r\n";
+    static char *rubout = "\b \b";
+    uint32_t typed = 0;
+    uint8_t digits = 0;
+    char c;
+
+    HAL_UART_Transmit(config->huart, (uint8_t *)prompt, strlen(prompt), HAL_MAX_DELAY);
+
+    while (uart_rx_read((uint8_t *)&c, 1, CLI_DUMP_PROMPT_MS) == HAL_OK) {
+
+        if (c == '\r') {
+            HAL_UART_Transmit(config->huart, (uint8_t *)crlf, strlen(crlf), HAL_MAX_DELAY);
+            if (digits > 0) {
+                *value = typed;
+            }
+            return HAL_OK;
+        }
+
+        if (c == '\b' || c == 0x7f) {
+            if (digits > 0) {
+                typed >>= 4;
+                digits--;
+                HAL_UART_Transmit(config->huart, (uint8_t *)rubout, strlen(rubout), HAL_MAX_DELAY);
+            }
+        } else if (!isxdigit((int)c)) {
+            break;
+        } else if (digits < 8) {
+            typed = (typed << 4) | (isdigit((int)c) ? c - '0' : tolower((int)c) - 'a' + 10);
+            digits++;
+            HAL_UART_Transmit(config->huart, (uint8_t *)&c, 1, HAL_MAX_DELAY);
+        }
+
+    }
+
+    HAL_UART_Transmit(config->huart, (uint8_t *)crlf, strlen(crlf), HAL_MAX_DELAY);
+    return HAL_ERROR;
+
+}
+
+// Packets go out as soon as they're read: a 1K bulk read takes well under the time the UART spends sending 1K
+static int cli_dump_read_spi(void *arg, uint32_t offset, uint8_t *data, uint16_t size)
+{
+
+    CLI_Dump *dump = (CLI_Dump *)arg;
+
+    return spi_rom_read(dump->spi_rom, dump->start + offset, data, size) == HAL_OK ? YMODEM_OK : YMODEM_ERROR;
+
+}
+
+static int cli_dump_read_sst(void *arg, uint32_t offset, uint8_t *data, uint16_t size)
+{
+
+    CLI_Dump *dump = (CLI_Dump *)arg;
+
+    return sst_rom_read(dump->start + offset, data, size) == HAL_OK ? YMODEM_OK : YMODEM_ERROR;
+
+}
+
+/**
+ * Ask for a range of the SPI or parallel ROM, then send it as a binary file by YMODEM, e.g. to `rb`. The file is
+ * named after the ROM and the range, so dumps of different parts of a chip don't overwrite each other.
+ */
+static void cli_rom_dump(CLI_SetupTypeDef *config, uint8_t parallel)
+{
+
+    static char *ready = "ROMble ready to send file... ";
+    static char *okay = "OK!\r\n";
+    static char *fail = "transfer failed\r\n";
+    static char *range = "Address out of range\r\n";
+    static char *cancelled = "Cancelled\r\n";
+    char filename[32];
+    uint32_t capacity, length;
+    uint8_t result;
+
+    CLI_Dump dump = { &config->spi_rom, 0 };
+    YModem_SendDef ctrl = {
+        config->huart,
+        (void *)&dump,
+        filename,
+        0,
+        parallel ? &cli_dump_read_sst : &cli_dump_read_spi,
+    };
+
+    if (parallel) {
+        capacity = SST_ROM_SIZE;
+    } else if (config->spi_rom.device->capacity > 0) {
+        capacity = config->spi_rom.device->capacity;
+    } else {
+        HAL_UART_Transmit(config->huart, (uint8_t *)fail, strlen(fail), HAL_MAX_DELAY);
+        return;
+    }
+
+    // Blank answers take the whole chip
+    length = 0;
+    if (cli_read_hex(config, "Start address (hex): ", &dump.start) != HAL_OK
+            || cli_read_hex(config, "Length (hex, blank for the rest): ", &length) != HAL_OK) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)cancelled, strlen(cancelled), HAL_MAX_DELAY);
+        return;
+    }
+
+    if (dump.start >= capacity || length > capacity - dump.start) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)range, strlen(range), HAL_MAX_DELAY);
+        return;
+    }
+
+    ctrl.size = length > 0 ? length : capacity - dump.start;
+    snprintf(filename, sizeof(filename), "%s-%06" PRIx32 "-%06" PRIx32 ".bin", parallel ? "sst" : "spi",
+        dump.start, dump.start + ctrl.size - 1);
 
-    uint8_t manufacturer;
-    uint8_t device_id;
+    HAL_UART_Transmit(config->huart, (uint8_t *)ready, strlen(ready), HAL_MAX_DELAY);
 
-    sst_rom_read_id(&manufacturer, &device_id);
+    // The receiver starts the transfer, so there's no need to wait for the user here
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
+    result = ymodem_send(&ctrl);
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
 
-    snprintf(buffer, sizeof(buffer), "Manufacturer: %02x\r\nDevice ID: %02x\r\n",
-        manufacturer, device_id);
-    HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+    osDelay(configTICK_RATE_HZ * 1);
 
-    sst_peek_address = 0;
+    if (result == YMODEM_OK) {
+        HAL_UART_Transmit(config->huart, (uint8_t *)okay, strlen(okay), HAL_MAX_DELAY);
+    } else {
+        HAL_UART_Transmit(config->huart, (uint8_t *)fail, strlen(fail), HAL_MAX_DELAY);
+    }
 
 }
 
-static char *upload_error = "unknown error\r\n";
-
-// Prepare SPI for file upload
-static int cli_open_file(void *arg, const char *filename, uint32_t size)
+static inline uint32_t cli_get32(const uint8_t *data)
 {
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
 
-    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
-    HAL_StatusTypeDef result;
-    uint8_t manufacturer;
-    uint16_t device_id;
+static inline uint8_t *cli_put16(uint8_t *data, uint16_t value)
+{
+    data[0] = value & 0xff;
+    data[1] = value >> 8;
+    return data + 2;
+}
 
-    result = spi_rom_read_jedec_id(upload->spi_rom, &manufacturer, &device_id);
+static inline uint8_t *cli_put32(uint8_t *data, uint32_t value)
+{
+    return cli_put16(cli_put16(data, value & 0xffff), value >> 16);
+}
 
-    // Is the SPI device present and correct?
-    if (result != HAL_OK || manufacturer != SPI_ROM_MANUFACTURER_WINBOND || device_id != SPI_ROM_WINBOND_W25Q32xV) {
-        upload_error = "bad SPI device\r\n";
-        return YMODEM_ERROR;
-    }
+// Program one request's data into erased ROM - runs on the writer thread
+static HAL_StatusTypeDef cli_rpc_program(void *arg, uint32_t address, const uint8_t *data, uint16_t size)
+{
 
-    upload->address = 0;
-    upload->erased = 0;
-    upload->filesize = size;
+    CLI_RPC *rpc = (CLI_RPC *)arg;
 
-    // Flag that ROM programming is in progress
-    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
+    if (rpc->writing == RPC_TARGET_SPI) {
+        return spi_rom_program_erased(&rpc->config->spi_rom, address, data, size);
+    }
 
-    return YMODEM_OK;
+    return sst_rom_program_erased(address, data, size);
 
 }
 
-// Write data to SPI ROM
-static int cli_write_data(void *arg, const uint8_t *data, uint16_t size)
+// Wait for the writer to program everything queued, and report whether it all went in
+static HAL_StatusTypeDef cli_rpc_sync(CLI_RPC *rpc)
 {
 
-    CLI_ROM_Upload *upload = (CLI_ROM_Upload *)arg;
-    uint32_t remaining;
+    HAL_StatusTypeDef result;
 
-    // upload->erased will hold the next address requiring erasing
-    if (upload->erased <= upload->address) {
+    if (rpc->writing == CLI_RPC_IDLE) {
+        return HAL_OK;
+    }
 
-        // check to see how much flash memory needs to be erased
-        if (upload->address >= upload->filesize) {
-            // no filesize given, or it wasn't right - remaining is set to the current write size
-            remaining = size;
-        } else {
-            remaining = upload->filesize - upload->address;
-        }
+    // The writer looks at the target for each slot, so it stays set until the last one is done
+    result = rom_writer_finish();
+    rpc->writing = CLI_RPC_IDLE;
+    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
 
-        if (remaining > 64 * 1024) {
+    return result;
 
-            // Erase a 64k block, which will leave upload->erased on a 64k boundary, safe for 64k/32k/4k erases
-            if (spi_rom_erase(upload->spi_rom, upload->address, SPI_ROM_ERASE_LARGE_BLOCK) != HAL_OK) {
+}
 
-                upload_error = "bad ROM erase 64k\r\n";
-                return YMODEM_ERROR;
+// Check a target is there, and find how big it is
+static uint8_t cli_rpc_capacity(CLI_RPC *rpc, uint8_t target, uint32_t *capacity)
+{
 
+    switch (target) {
+        case RPC_TARGET_SPI:
+            if (spi_rom_detect(&rpc->config->spi_rom) != HAL_OK) {
+                return RPC_NO_DEVICE;
             }
+            *capacity = rpc->config->spi_rom.device->capacity;
+            return RPC_OK;
+        case RPC_TARGET_SST:
+            *capacity = SST_ROM_SIZE;
+            return RPC_OK;
+        default:
+            return RPC_BAD_REQUEST;
+    }
 
-            upload->erased += 64 * 1024;
+}
 
-        } else if (remaining > 32 * 1024) {
+static uint8_t cli_rpc_identify(CLI_RPC *rpc, uint8_t *results, uint16_t *size)
+{
 
-            // Erase a 32k block, which will leave upload->erased on a 32k boundary, safe for 32k/4k erases
-            if (spi_rom_erase(upload->spi_rom, upload->address, SPI_ROM_ERASE_BLOCK) != HAL_OK) {
+    const SPI_ROM_DeviceDef *device = rpc->config->spi_rom.device;
+    uint8_t *out = results;
+    uint8_t present, manufacturer = 0, device_id = 0, i;
+
+    *out++ = RPC_VERSION;
+    out = cli_put16(out, RPC_MAX_DATA);
+    out = cli_put16(out, RPC_WINDOW);
+
+    present = spi_rom_detect(&rpc->config->spi_rom) == HAL_OK;
+    *out++ = present;
+    *out++ = present ? device->manufacturer : 0;
+    out = cli_put16(out, present ? device->device_id : 0);
+    out = cli_put32(out, present ? device->capacity : 0);
+    out = cli_put16(out, present ? device->page_size : 0);
+    for (i = 0; i < SPI_ROM_ERASE_TYPES; i++) {
+        out = cli_put32(out, present ? device->erase[i].size : 0);
+    }
+    out = cli_put32(out, present ? spi_rom_clock_hz(&rpc->config->spi_rom) : 0);
 
-                upload_error = "bad ROM erase 32k\r\n";
-                return YMODEM_ERROR;
+    sst_rom_read_id(&manufacturer, &device_id);
+    *out++ = manufacturer;
+    *out++ = device_id;
+    out = cli_put32(out, SST_ROM_SIZE);
 
-            }
+    *size = out - results;
 
-            upload->erased += 32 * 1024;
+    return RPC_OK;
 
-        } else {
+}
 
-            // Erase a 4k sector, only 4k erases will be safe from here to the end of the transfer
-            if (spi_rom_erase(upload->spi_rom, upload->address, SPI_ROM_ERASE_SECTOR) != HAL_OK) {
+static uint8_t cli_rpc_read(CLI_RPC *rpc, const uint8_t *args, uint16_t size, uint8_t *results, uint16_t *result_size)
+{
 
-                upload_error = "bad ROM erase 4k\r\n";
-                return YMODEM_ERROR;
+    uint32_t address, capacity, length;
+    HAL_StatusTypeDef result;
+    uint8_t status;
 
-            }
+    if (size != 7) {
+        return RPC_BAD_REQUEST;
+    }
 
-            upload->erased += 4 * 1024;
+    address = cli_get32(args + 1);
+    length = args[5] | (args[6] << 8);
 
-        }
+    if ((status = cli_rpc_capacity(rpc, args[0], &capacity)) != RPC_OK) {
+        return status;
+    }
 
+    if (length > RPC_MAX_DATA || address > capacity || length > capacity - address) {
+        return RPC_BAD_REQUEST;
     }
 
-    // This will write in at most 256-byte chunks
-    spi_rom_program(upload->spi_rom, upload->address, data, size);
+    if (args[0] == RPC_TARGET_SPI) {
+        result = spi_rom_read(&rpc->config->spi_rom, address, results, length);
+    } else {
+        result = sst_rom_read(address, results, length);
+    }
 
-    upload->address += size;
+    *result_size = length;
 
-    return YMODEM_OK;
+    return result == HAL_OK ? RPC_OK : RPC_FAILED;
 
 }
 
-// Finalise ROM write
-static void cli_close_file(void *arg, uint8_t status)
+// Erase exactly the range asked for, which must be made of whole smallest erases, in the quickest way
+static uint8_t cli_rpc_erase(CLI_RPC *rpc, const uint8_t *args, uint16_t size)
 {
 
-    UNUSED(arg);
-    UNUSED(status);
+    const SPI_ROM_ConfigDef *spi_rom = &rpc->config->spi_rom;
+    SPI_ROM_ErasePlanDef plan;
+    uint32_t address, capacity, length, align, erase;
+    uint8_t status;
 
-    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+    if (size != 9) {
+        return RPC_BAD_REQUEST;
+    }
 
-}
+    address = cli_get32(args + 1);
+    length = cli_get32(args + 5);
 
-static void cli_rom_upload(CLI_SetupTypeDef *config)
-{
+    if ((status = cli_rpc_capacity(rpc, args[0], &capacity)) != RPC_OK) {
+        return status;
+    }
 
-    static char *ready = "ROMble ready to receive file... ";
-    static char *okay = "OK!\r\n";
-    static char *fail = "transfer failed: ";
+    align = args[0] == RPC_TARGET_SPI ? spi_rom->device->erase[0].size : SST_ROM_SECTOR_SIZE;
 
-    CLI_ROM_Upload upload = { &config->spi_rom, 0, 0 };
-    const YModem_ControlDef ctrl = {
-        config->huart,
-        (void *)&upload,
-        &cli_open_file,
-        &cli_write_data,
-        &cli_close_file,
-    };
+    if (address > capacity || length > capacity - address || ((address | length) & (align - 1)) != 0) {
+        return RPC_BAD_REQUEST;
+    }
 
-    HAL_UART_Transmit(config->huart, (uint8_t *)ready, strlen(ready), HAL_MAX_DELAY);
+    if (args[0] == RPC_TARGET_SPI) {
 
-    // Wait 5 seconds for user to select the file
-    osDelay(configTICK_RATE_HZ * 5);
+        spi_rom_plan_erase(spi_rom, address, address + length, address == 0 && length == capacity, &plan);
 
-    upload_error = "unknown error\r\n";
+        for (; address < plan.end; address += erase) {
+            erase = spi_rom_plan_step(spi_rom, &plan, address);
+            if (spi_rom_erase(spi_rom, address, erase) != HAL_OK) {
+                return RPC_FAILED;
+            }
+        }
 
-    uint8_t result = ymodem_receive(&ctrl);
+    } else if (address == 0 && length == capacity) {
 
-    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+        return sst_rom_erase(0, SST_ROM_ERASE_ALL) == HAL_OK ? RPC_OK : RPC_FAILED;
 
-    osDelay(configTICK_RATE_HZ * 1);
+    } else {
+
+        for (; length > 0; address += SST_ROM_SECTOR_SIZE, length -= SST_ROM_SECTOR_SIZE) {
+            if (sst_rom_erase(address, SST_ROM_ERASE_SECTOR) != HAL_OK) {
+                return RPC_FAILED;
+            }
+        }
 
-    switch (result) {
-        case YMODEM_OK:
-            HAL_UART_Transmit(config->huart, (uint8_t *)okay, strlen(okay), HAL_MAX_DELAY);
-            break;
-        default:
-            HAL_UART_Transmit(config->huart, (uint8_t *)fail, strlen(fail), HAL_MAX_DELAY);
-            HAL_UART_Transmit(config->huart, (uint8_t *)upload_error, strlen(upload_error), HAL_MAX_DELAY);
-            break;
     }
 
-}
+    return RPC_OK;
 
-uint32_t sectors = 0;
-uint32_t seclist[256];
+}
 
-static int cli_sst_open_file(void *arg, const char *filename, uint32_t size)
+/**
+ * Queue data for programming and answer straight away, so the next request is received while this one programs.
+ * Every PROGRAM checks the writer first, and reusing a slot waits for the data it held, so a failed write is
+ * answered with RPC_PROGRAM_FAILED by the PROGRAM that follows it, at the latest the one after. A failure in the
+ * last PROGRAM of a run is reported by the next request of any other kind.
+ */
+static uint8_t cli_rpc_write(CLI_RPC *rpc, const uint8_t *args, uint16_t size)
 {
 
-    UNUSED(arg);
-    UNUSED(filename);
-    UNUSED(size);
+    uint32_t address, length;
+    uint8_t status;
 
-    sectors = 0;
+    if (size < 6 || size - 5 > ROM_WRITER_SLOT_SIZE) {
+        return RPC_BAD_REQUEST;
+    }
 
-    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
+    address = cli_get32(args + 1);
+    length = size - 5;
 
-    return YMODEM_OK;
+    if (rpc->writing != args[0]) {
 
-}
+        if (cli_rpc_sync(rpc) != HAL_OK) {
+            return RPC_PROGRAM_FAILED;
+        }
 
-static int cli_sst_write_data(void *arg, const uint8_t *data, uint16_t size)
-{
+        if ((status = cli_rpc_capacity(rpc, args[0], &rpc->capacity)) != RPC_OK) {
+            return status;
+        }
 
-    uint32_t *address = (uint32_t *)arg;
-    uint8_t result;
+        rpc->writing = args[0];
+        rom_writer_start(rpc->writer);
+        HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_SET);
 
-    if (((*address) & 0xfff) == 0 || (((*address) & 0x3f000) != (((*address) + size - 1) & 0x3f000))) {
-        seclist[sectors++] = *address;
-        result = sst_rom_erase(*address, SST_ROM_ERASE_SECTOR);
-        switch (result) {
-            case HAL_OK:
-                break;
-            case HAL_TIMEOUT:
-                upload_error = "page erase timeout\r\n";
-                return YMODEM_ERROR;
-            default:
-                upload_error = "page erase error\r\n";
-                return YMODEM_ERROR;
-        }
     }
 
-    if ((result = sst_rom_program(*address, data, size)) != HAL_OK) {
-        upload_error = result == HAL_TIMEOUT ? "page write timeout\r\n" : "page write error\r\n";
-        return YMODEM_ERROR;
+    if (address > rpc->capacity || length > rpc->capacity - address) {
+        return RPC_BAD_REQUEST;
     }
 
-    *address += size;
+    if (rom_writer_status() != HAL_OK || rom_writer_submit(address, args + 5, length) != HAL_OK) {
+        cli_rpc_sync(rpc);
+        return RPC_PROGRAM_FAILED;
+    }
 
-    return YMODEM_OK;
+    return RPC_OK;
 
 }
 
-
-static void cli_sst_close_file(void *arg, uint8_t status)
+static uint8_t cli_rpc_crc(CLI_RPC *rpc, const uint8_t *args, uint16_t size, uint8_t *results, uint16_t *result_size)
 {
 
-    UNUSED(arg);
-    UNUSED(status);
-
-    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+    uint32_t address, capacity, length, chunk;
+    HAL_StatusTypeDef result = HAL_OK;
+    uint8_t status;
 
-}
+    if (size != 9) {
+        return RPC_BAD_REQUEST;
+    }
 
+    address = cli_get32(args + 1);
+    length = cli_get32(args + 5);
 
-static void cli_sst_upload(CLI_SetupTypeDef *config)
-{
+    if ((status = cli_rpc_capacity(rpc, args[0], &capacity)) != RPC_OK) {
+        return status;
+    }
 
-    static char *ready = "ROMble ready to receive file... ";
-    static char *okay = "OK!\r\n";
-    static char *fail = "transfer failed: ";
+    if (address > capacity || length > capacity - address) {
+        return RPC_BAD_REQUEST;
+    }
 
-    uint32_t address = 0;
-    const YModem_ControlDef ctrl = {
-        config->huart,
-        (void *)&address,
-        &cli_sst_open_file,
-        &cli_sst_write_data,
-        &cli_sst_close_file,
-    };
+    crc32_start();
 
-    HAL_UART_Transmit(config->huart, (uint8_t *)ready, strlen(ready), HAL_MAX_DELAY);
+    for (; result == HAL_OK && length > 0; address += chunk, length -= chunk) {
+        chunk = length < CLI_VERIFY_CHUNK ? length : CLI_VERIFY_CHUNK;
+        if (args[0] == RPC_TARGET_SPI) {
+            result = spi_rom_read(&rpc->config->spi_rom, address, diff_rom, chunk);
+        } else {
+            result = sst_rom_read(address, diff_rom, chunk);
+        }
+        crc32_update(diff_rom, chunk);
+    }
 
-    upload_error = "unknown error\r\n";
+    cli_put32(results, crc32_value());
+    *result_size = 4;
 
-    // Wait 5 seconds for user to select the file
-    osDelay(configTICK_RATE_HZ * 5);
+    return result == HAL_OK ? RPC_OK : RPC_FAILED;
 
-    uint8_t result = ymodem_receive(&ctrl);
+}
 
-    HAL_GPIO_WritePin(LD2_GPIO_Port, LD2_Pin, GPIO_PIN_RESET);
+// Run the SPI ROM at the fastest clock no faster than asked for, or calibrate it if asked for zero
+static uint8_t cli_rpc_clock(CLI_RPC *rpc, const uint8_t *args, uint16_t size, uint8_t *results, uint16_t *result_size)
+{
 
-    osDelay(configTICK_RATE_HZ * 1);
+    const SPI_ROM_ConfigDef *spi_rom = &rpc->config->spi_rom;
+    uint32_t hz, capacity, prescaler;
+    uint8_t status;
 
-    switch (result) {
-        case YMODEM_OK:
-            HAL_UART_Transmit(config->huart, (uint8_t *)okay, strlen(okay), HAL_MAX_DELAY);
-            break;
-        default:
-            HAL_UART_Transmit(config->huart, (uint8_t *)fail, strlen(fail), HAL_MAX_DELAY);
-            HAL_UART_Transmit(config->huart, (uint8_t *)upload_error, strlen(upload_error), HAL_MAX_DELAY);
-            break;
+    if (size != 4) {
+        return RPC_BAD_REQUEST;
     }
 
-}
+    hz = cli_get32(args);
 
-#define P(c) (isprint(c) ? c : '.')
+    if ((status = cli_rpc_capacity(rpc, RPC_TARGET_SPI, &capacity)) != RPC_OK) {
+        return status;
+    }
 
-static void cli_rom_peek(CLI_SetupTypeDef *config)
-{
+    if (hz == 0) {
+        status = spi_rom_calibrate(spi_rom) == HAL_OK ? RPC_OK : RPC_FAILED;
+    } else {
+        for (prescaler = SPI_BAUDRATEPRESCALER_2; prescaler < SPI_BAUDRATEPRESCALER_256; prescaler += SPI_CR1_BR_0) {
+            spi_rom->device->prescaler = prescaler;
+            if (spi_rom_clock_hz(spi_rom) <= hz) {
+                break;
+            }
+        }
+        spi_rom->device->prescaler = prescaler;
+    }
 
-    static char *error = "Error reading from Flash ROM\r\n";
-    static char buffer[80];
-    static uint8_t page[256];
-    uint8_t i;
+    cli_put32(results, spi_rom_clock_hz(spi_rom));
+    *result_size = 4;
 
-    // read a page from the ROM
-    if (spi_rom_read_page(&config->spi_rom, 0, page) == HAL_OK) {
+    return status;
 
-        for (i = 0; i < 16; i++) {
+}
 
-            snprintf(buffer, 80,
-                    "%02X %02X %02X %02X %02X %02X %02X %02X - %02X %02X %02X %02X %02X %02X %02X %02X",
-                    page[i*16+0], page[i*16+1], page[i*16+2], page[i*16+3],
-                    page[i*16+4], page[i*16+5], page[i*16+6], page[i*16+7],
-                    page[i*16+8], page[i*16+9], page[i*16+10], page[i*16+11],
-                    page[i*16+12], page[i*16+13], page[i*16+14], page[i*16+15]
-            );
-            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
-            snprintf(buffer, 80, "    %c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c\r\n",
-                    P(page[i*16+0]), P(page[i*16+1]), P(page[i*16+2]), P(page[i*16+3]),
-                    P(page[i*16+4]), P(page[i*16+5]), P(page[i*16+6]), P(page[i*16+7]),
-                    P(page[i*16+8]), P(page[i*16+9]), P(page[i*16+10]), P(page[i*16+11]),
-                    P(page[i*16+12]), P(page[i*16+13]), P(page[i*16+14]), P(page[i*16+15])
-            );
-            HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+static uint8_t cli_rpc_request(void *arg, uint8_t op, const uint8_t *args, uint16_t size, uint8_t *results,
+    uint16_t *result_size)
+{
 
-        }
+    CLI_RPC *rpc = (CLI_RPC *)arg;
 
-    } else {
+    if (op == RPC_OP_PROGRAM) {
+        return cli_rpc_write(rpc, args, size);
+    }
 
-        HAL_UART_Transmit(config->huart, (uint8_t *)error, strlen(error), HAL_MAX_DELAY);
+    // Everything else sees the ROM with all the programming done
+    if (cli_rpc_sync(rpc) != HAL_OK) {
+        return RPC_PROGRAM_FAILED;
+    }
 
+    switch (op) {
+        case RPC_OP_IDENTIFY:
+            return size == 0 ? cli_rpc_identify(rpc, results, result_size) : RPC_BAD_REQUEST;
+        case RPC_OP_READ:
+            return cli_rpc_read(rpc, args, size, results, result_size);
+        case RPC_OP_ERASE:
+            return cli_rpc_erase(rpc, args, size);
+        case RPC_OP_CRC:
+            return cli_rpc_crc(rpc, args, size, results, result_size);
+        case RPC_OP_CLOCK:
+            return cli_rpc_clock(rpc, args, size, results, result_size);
+        default:
+            return RPC_UNKNOWN;
     }
 
 }
 
-static void cli_sst_peek(CLI_SetupTypeDef *config)
+// Serve binary requests from a host tool until it exits or goes quiet, then go back to the menu
+static void cli_rpc(CLI_SetupTypeDef *config)
 {
 
-    static char buffer[80];
-    static uint8_t sector[4096];
-    uint8_t i;
-
-    sst_rom_read_sector(sst_peek_address, sector);
+    CLI_RPC rpc = { config, NULL, CLI_RPC_IDLE, 0 };
+    const ROM_Writer_ControlDef writer = {
+        (void *)&rpc,
+        &cli_rpc_program,
+        NULL,
+    };
+    const RPC_ControlDef ctrl = {
+        config->huart,
+        (void *)&rpc,
+        &cli_rpc_request,
+    };
 
-    // display 512 bytes of data
-    for (i = 0; i < 32; i++) {
+    rpc.writer = &writer;
 
-        snprintf(buffer, 80,
-            "%05lX   %02X %02X %02X %02X %02X %02X %02X %02X - %02X %02X %02X %02X %02X %02X %02X %02X",
-            sst_peek_address,
-            sector[i*16+0],  sector[i*16+1],  sector[i*16+2],  sector[i*16+3],
-            sector[i*16+4],  sector[i*16+5],  sector[i*16+6],  sector[i*16+7],
-            sector[i*16+8],  sector[i*16+9],  sector[i*16+10], sector[i*16+11],
-            sector[i*16+12], sector[i*16+13], sector[i*16+14], sector[i*16+15]
-        );
-        sst_peek_address += 32;
-        HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
-        snprintf(buffer, 80, "    %c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c\r\n",
-                P(sector[i*16+0]), P(sector[i*16+1]), P(sector[i*16+2]), P(sector[i*16+3]),
-                P(sector[i*16+4]), P(sector[i*16+5]), P(sector[i*16+6]), P(sector[i*16+7]),
-                P(sector[i*16+8]), P(sector[i*16+9]), P(sector[i*16+10]), P(sector[i*16+11]),
-                P(sector[i*16+12]), P(sector[i*16+13]), P(sector[i*16+14]), P(sector[i*16+15])
-        );
-        HAL_UART_Transmit(config->huart, (uint8_t *)buffer, strlen(buffer), HAL_MAX_DELAY);
+    rpc_serve(&ctrl);
 
-    }
+    cli_rpc_sync(&rpc);
 
 }
 
@@ -426,7 +2199,6 @@ void binprint(char *buf, uint32_t val) {
         val >>= 1;
     }
 }
-extern uint32_t bpins;
 
 void sd_sendclocks(CLI_SetupTypeDef *config) {
     uint8_t byte = 0xff;
@@ -524,7 +2296,7 @@ void printr7(CLI_SetupTypeDef *config, uint32_t r7)
 {
     char r7buf[14];
 
-    snprintf(r7buf, 14, "R7=%08lx\r\n", r7);
+    snprintf(r7buf, 14, "R7=%08" PRIx32 "\r\n", r7);
     HAL_UART_Transmit(config->huart, (uint8_t *)r7buf, strlen(r7buf), HAL_MAX_DELAY);
 }
 
@@ -537,10 +2309,18 @@ void cli_loop(CLI_SetupTypeDef *config) {
                         "  h - hello & debug info\r\n"
                         "  i - SPI ROM information\r\n"
                         "  p - Peek SPI ROM data\r\n"
+                        "  c - Calibrate SPI ROM clock\r\n"
                         "  u - Upload SPI ROM data\r\n"
+                        "  d - Upload SPI ROM data, rewriting only changed sectors\r\n"
+                        "  w - Upload SPI ROM data by ZMODEM, resuming a failed upload\r\n"
                         "  x - Parallel ROM information\r\n"
                         "  o - Peek parallel ROM data\r\n"
                         "  r - Upload parallel ROM data\r\n"
+                        "  k - Checksum parallel ROM\r\n"
+                        "  b - Change baud rate\r\n"
+                        "  g - Toggle YMODEM-g streaming for plain binary uploads\r\n"
+                        "  e - Download SPI ROM data\r\n"
+                        "  y - Download parallel ROM data\r\n"
                         ;
     static char *sdhelp = "ROMble SD commands:\r\n"
                         " 0 - send 80 clock cycles\r\n"
@@ -555,21 +2335,45 @@ void cli_loop(CLI_SetupTypeDef *config) {
                         " 9 - set block length\r\n"
                         ;
 
+    static char *reverted = "No command at the new baud rate, reverted to 115200\r\n";
     static char ticker[100];
     int state = STATE_IDLE;
+    uint32_t baud_deadline = 0, timeout;
+    uint8_t baud_pending = 0, pending;
+    HAL_StatusTypeDef received;
 
     uint8_t r1;
     uint32_t sdword;
 
+    uart_rx_start(config->huart);
+    spi_rom_init(&config->spi_rom);
+    rom_writer_init();
+
     // Infinite loop
     while (1) {
 
         switch (state) {
             case STATE_IDLE:
-                if (HAL_UART_Receive(config->huart, (uint8_t *)&cmd, 1, HAL_MAX_DELAY) == HAL_OK) {
+                // A new baud rate only sticks once a command has made it through
+                timeout = HAL_MAX_DELAY;
+                if (baud_pending) {
+                    timeout = (int32_t)(baud_deadline - HAL_GetTick()) > 0 ? baud_deadline - HAL_GetTick() : 0;
+                }
+
+                received = uart_rx_read((uint8_t *)&cmd, 1, timeout);
+
+                if (received == HAL_TIMEOUT && baud_pending) {
+                    baud_pending = 0;
+                    cli_set_baud(config, CLI_BAUD_DEFAULT);
+                    HAL_UART_Transmit(config->huart, (uint8_t *)reverted, strlen(reverted), HAL_MAX_DELAY);
+                }
+
+                if (received == HAL_OK) {
+                    pending = baud_pending;
+                    baud_pending = 0;
                     switch (cmd) {
                         case CMD_HELLO:
-                            snprintf(ticker, 100, "ticks: %lu\r\n", xTaskGetTickCount() / configTICK_RATE_HZ);
+                            snprintf(ticker, 100, "ticks: %" PRIu32 "\r\n", xTaskGetTickCount() / configTICK_RATE_HZ);
                             ticker[99] = '\0';
                             HAL_UART_Transmit(config->huart, (uint8_t *)ticker, strlen(ticker), HAL_MAX_DELAY);
 
@@ -577,6 +2381,10 @@ void cli_loop(CLI_SetupTypeDef *config) {
                             ticker[99] = '\0';
                             HAL_UART_Transmit(config->huart, (uint8_t *)ticker, strlen(ticker), HAL_MAX_DELAY);
 
+                            snprintf(ticker, 100, "rx dropped: %" PRIu32 "\r\n", uart_rx_dropped());
+                            ticker[99] = '\0';
+                            HAL_UART_Transmit(config->huart, (uint8_t *)ticker, strlen(ticker), HAL_MAX_DELAY);
+
                             HAL_UART_Transmit(config->huart, (uint8_t *)welcome, strlen(welcome), HAL_MAX_DELAY);
                             break;
                         case CMD_HELP:
@@ -586,43 +2394,71 @@ void cli_loop(CLI_SetupTypeDef *config) {
                             cli_rom_info(config);
                             break;
                         case CMD_SPI_UPLOAD:
-                            cli_rom_upload(config);
+                            cli_rom_upload(config, 0, 0);
+                            break;
+                        case CMD_SPI_DIFF:
+                            cli_rom_upload(config, 1, 0);
+                            break;
+                        case CMD_SPI_ZMODEM:
+                            cli_rom_upload(config, 0, 1);
                             break;
                         case CMD_SPI_PEEK:
                             cli_rom_peek(config);
                             break;
+                        case CMD_SPI_CLOCK:
+                            cli_rom_calibrate(config);
+                            break;
                         case CMD_SST_INFO:
                             cli_prom_info(config);
                             break;
                         case CMD_SST_PANIC:
                             sst_peek_address = 0x12000;
+                            // fall through
                         case CMD_SST_PEEK:
                             cli_sst_peek(config);
                             break;
                         case CMD_SST_UPLOAD:
                             cli_sst_upload(config);
                             break;
-                        case 'q':
-                            snprintf(ticker, 100, "sectors erased: %lu\r\n", sectors);
-                            HAL_UART_Transmit(config->huart, (uint8_t *)ticker, strlen(ticker), HAL_MAX_DELAY);
-                            for (uint32_t s = 0; s < sectors; s++) {
-                                snprintf(ticker, 100, "  - %lu\r\n", seclist[s]);
-                                HAL_UART_Transmit(config->huart, (uint8_t *)ticker, strlen(ticker), HAL_MAX_DELAY);
-                            }
+                        case CMD_SST_SUM:
+                            cli_sst_sum(config);
+                            break;
+                        case CMD_SPI_DUMP:
+                            cli_rom_dump(config, 0);
+                            break;
+                        case CMD_SST_DUMP:
+                            cli_rom_dump(config, 1);
+                            break;
+                        case CMD_RPC:
+                            cli_rpc(config);
                             break;
                         case CMD_SD_MODE:
                             state = STATE_SDCARD;
-                            config->spi_rom.hspi->Instance->I2SPR = 128;
+                            // SD cards start up at 400kHz or less; the ROM driver switches back to its own clock
+                            spi_rom_set_prescaler(config->spi_rom.hspi, SPI_BAUDRATEPRESCALER_128);
                             HAL_UART_Transmit(config->huart, (uint8_t *)sdhelp, strlen(sdhelp), HAL_MAX_DELAY);
                             break;
+                        case CMD_STREAMING:
+                            cli_streaming = !cli_streaming;
+                            snprintf(ticker, 100, "YMODEM-g streaming uploads %s\r\n", cli_streaming ? "on" : "off");
+                            HAL_UART_Transmit(config->huart, (uint8_t *)ticker, strlen(ticker), HAL_MAX_DELAY);
+                            break;
+                        case CMD_BAUD:
+                            if (cli_baud(config)) {
+                                baud_pending = 1;
+                                baud_deadline = HAL_GetTick() + CLI_BAUD_CONFIRM_MS;
+                            }
+                            break;
                         default:
+                            // Garbage at the wrong baud rate doesn't confirm it
+                            baud_pending = pending;
                             HAL_UART_Transmit(config->huart, (uint8_t *)errmsg, strlen(errmsg), HAL_MAX_DELAY);
                             break;
                     }
                 }
                 break;
             case STATE_SDCARD:
-                if (HAL_UART_Receive(config->huart, (uint8_t *)&cmd, 1, HAL_MAX_DELAY) == HAL_OK) {
+                if (uart_rx_read((uint8_t *)&cmd, 1, HAL_MAX_DELAY) == HAL_OK) {
                     switch (cmd) {
                         case '0':
                             sd_sendclocks(config);
@@ -632,7 +2468,7 @@ void cli_loop(CLI_SetupTypeDef *config) {
                             printr1(config, r1);
                             break;
                         case '2':
-                            r1 = sd_command(config, CMD8, 0x1AA, R7, 4, &sdword);
+                            r1 = sd_command(config, CMD8, 0x1AA, R7, 4, (uint8_t *)&sdword);
                             printr1(config, r1);
                             if (r1 != 0xff) {
                                 printr7(config, sdword);
@@ -647,7 +2483,7 @@ void cli_loop(CLI_SetupTypeDef *config) {
                         case '4':
                             break;
                         case '5':
-                            r1 = sd_command(config, CMD58, 0, R3, 4, &sdword);
+                            r1 = sd_command(config, CMD58, 0, R3, 4, (uint8_t *)&sdword);
                             printr1(config, r1);
                             if (r1 != 0xff) {
                                 printr7(config, sdword);
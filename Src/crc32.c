@@ -0,0 +1,146 @@
+/**
+ * The STM32F4 CRC peripheral computes the Ethernet CRC-32 polynomial over whole 32-bit words, most significant bit
+ * first, from a fixed initial value of 0xFFFFFFFF. The CRC-32 everyone else uses (zlib, PKZIP, crc32 on the host)
+ * is the same polynomial run least significant bit first over bytes, then inverted.
+ *
+ * Bit-reversing each little-endian word on its way in makes the peripheral see the stream's bits in the standard
+ * order, and bit-reversing its register gives the standard algorithm's state. The last few bytes of a stream that
+ * don't make up a whole word are finished in software from that state, without disturbing the peripheral.
+ *
+ * The peripheral's initial value can't be set, so a stream can't be paused and resumed around another one. Short
+ * buffers that need a CRC of their own while a stream is running, like ZMODEM subpackets, use crc32_buffer().
+ */
+
+#include <string.h>
+
+#include "crc32.h"
+
+#define CRC32_POLYNOMIAL        0xEDB88320U     // 0x04C11DB7, bit-reversed
+
+static CRC_HandleTypeDef *crc32_hcrc = NULL;
+static uint8_t crc32_tail[4];                   // bytes not yet making up a whole word
+static uint8_t crc32_tail_size = 0;
+
+/**
+ * @brief   Take ownership of the CRC peripheral.
+ *
+ * @param   hcrc  the initialised CRC peripheral
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef crc32_init(CRC_HandleTypeDef *hcrc)
+{
+
+    crc32_hcrc = hcrc;
+
+    crc32_start();
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Begin a new stream.
+ */
+void crc32_start(void)
+{
+
+    __HAL_CRC_DR_RESET(crc32_hcrc);
+    crc32_tail_size = 0;
+
+}
+
+static inline void crc32_word(const uint8_t *bytes)
+{
+
+    uint32_t word;
+
+    // memcpy rather than a cast, as YMODEM packet data sits at odd addresses
+    memcpy(&word, bytes, sizeof(word));
+    crc32_hcrc->Instance->DR = __RBIT(word);
+
+}
+
+/**
+ * @brief   Add bytes to the stream.
+ *
+ * @param   data  the bytes to add
+ * @param   size  how many there are
+ */
+void crc32_update(const uint8_t *data, uint32_t size)
+{
+
+    // Complete a word left over from last time
+    while (crc32_tail_size > 0 && size > 0) {
+        crc32_tail[crc32_tail_size++] = *data++;
+        size--;
+        if (crc32_tail_size == sizeof(crc32_tail)) {
+            crc32_word(crc32_tail);
+            crc32_tail_size = 0;
+        }
+    }
+
+    while (size >= 4) {
+        crc32_word(data);
+        data += 4;
+        size -= 4;
+    }
+
+    while (size > 0) {
+        crc32_tail[crc32_tail_size++] = *data++;
+        size--;
+    }
+
+}
+
+/**
+ * @brief   Get the CRC-32 of the stream so far.
+ *
+ * @retval  the standard CRC-32
+ */
+uint32_t crc32_value(void)
+{
+
+    uint32_t crc = __RBIT(crc32_hcrc->Instance->DR);
+    uint8_t byte, bit;
+
+    for (byte = 0; byte < crc32_tail_size; byte++) {
+        crc ^= crc32_tail[byte];
+        for (bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+    }
+
+    return ~crc;
+
+}
+
+/**
+ * @brief   Compute a CRC-32 in software, independently of the stream.
+ *
+ * Feeding the previous result back in continues it, as zlib's crc32() does.
+ *
+ * @param   crc   zero, or the result for the preceding bytes
+ * @param   data  the bytes
+ * @param   size  how many there are
+ * @retval  the standard CRC-32
+ */
+uint32_t crc32_buffer(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+
+    // The reflected polynomial's remainders for each value of the low nibble
+    static const uint32_t table[16] = {
+        0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+        0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+    };
+
+    crc = ~crc;
+
+    while (size-- > 0) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+        crc = (crc >> 4) ^ table[crc & 0x0F];
+    }
+
+    return ~crc;
+
+}
@@ -5,12 +5,29 @@
  * The ROM is arranged as 16,384 pages, with each page being 256 bytes. Erasing operates on sectors (of 16 pages, 4Kb),
  * blocks (128 or 256 pages, 32Kb/64Kb), or the whole memory.
  * 
+ * Other 25-series parts (W25Q16/64/128, GD25Q, MX25L) differ in capacity, erase granularities, erase opcodes, and
+ * timings. spi_rom_detect() reads the JEDEC Serial Flash Discoverable Parameters (SFDP) table to learn these for
+ * the attached part. Parts without SFDP are assumed to look like a W25Q32 of whatever capacity their JEDEC ID
+ * claims.
+ * 
  * Each operation requires a Write Enable command beforehand.
+ * 
+ * Page data is pushed out by DMA (SPI3 TX on DMA1 stream 7) when the SPI handle has a TX DMA channel linked, and
+ * reads are clocked in by DMA (SPI3 RX on DMA1 stream 0). The calling thread blocks on a semaphore until the
+ * transfer completes, leaving the CPU free for other threads - in particular, for the CLI thread to keep receiving
+ * the next upload packet while a page is programming.
+ * 
+ * SPI3 starts out at the conservative clock set up by MX_SPI3_Init(). Each device description carries its own
+ * prescaler, applied at the start of every operation since the bus is shared with the SD card. The device is
+ * always identified at the boot-time clock; spi_rom_calibrate() finds the fastest clock the wiring supports.
  */
 
+#include <string.h>
+
 #include "cmsis_os.h"
 
 #include "flashrom.h"
+#include "timing.h"
 
 
 // SPI constants
@@ -22,11 +39,172 @@
 #define SPI_CMD_ERASE_SECTOR        0x20        // erase a 4k sector
 #define SPI_CMD_ERASE_BLOCK         0x52        // erase a 32k block
 #define SPI_CMD_ERASE_LARGE_BLOCK   0xD8        // erase a 64k block
+#define SPI_CMD_ERASE_CHIP          0xC7        // erase the whole chip
+#define SPI_CMD_READ_SFDP           0x5A        // read serial flash discoverable parameters
 
-#define SPI_STATUS_1_BUSY           (2 << 0)    // BUSY bit, set to 1 during program/erase operations
+#define SPI_STATUS_1_BUSY           (1 << 0)    // BUSY bit, set to 1 during program/erase operations
 
 #define SPI_TIMEOUT                 100         // nothing should even take this long, really
 
+#define SPI_POLL_MIN_US             5           // shortest gap between BUSY polls
+#define SPI_POLL_MAX_US             200         // longest gap between BUSY polls before the per-tick fallback
+#define SPI_MEASURE_MAX_MS          40000       // longest operation the cycle counter can time
+
+#define SPI_MAX_CAPACITY            (16 * 1024 * 1024)  // the most that three address bytes can reach
+
+#define SPI_CALIBRATE_SIZE          4096        // largest sector calibration can save and restore
+#define SPI_CALIBRATE_CHUNK         256         // calibration pattern block size
+#define SPI_CALIBRATE_READS         4           // read-backs of the pattern that must all match
+
+// SFDP constants
+#define SFDP_SIGNATURE              0x50444653  // "SFDP", little-endian
+#define SFDP_BFPT_DWORDS            16          // the most of the basic flash parameter table used here
+#define SFDP_BFPT_MIN_DWORDS        9           // JESD216 original: density and erase types
+#define SFDP_BFPT_TIMING_DWORDS     11          // JESD216A: erase and program timings
+
+// The W25Q32 profile, used until a device is detected, and as the basis for parts with no SFDP table
+static const SPI_ROM_DeviceDef spi_rom_default = {
+    SPI_ROM_MANUFACTURER_WINBOND,
+    SPI_ROM_WINBOND_W25Q32xV,
+    0,
+    4 * 1024 * 1024,
+    256,
+    SPI_BAUDRATEPRESCALER_128,
+    700, 3,
+    10000000, 50000,
+    {
+        { 4 * 1024, SPI_CMD_ERASE_SECTOR, 45000, 400 },
+        { 32 * 1024, SPI_CMD_ERASE_BLOCK, 120000, 1600 },
+        { 64 * 1024, SPI_CMD_ERASE_LARGE_BLOCK, 150000, 2000 },
+        { 0, 0, 0, 0 },
+    },
+};
+
+// Signalled from the SPI transfer complete and error callbacks
+static osSemaphoreId_t spi_rom_dma_done = NULL;
+
+// The clock set up at boot, which every device is identified at
+static uint32_t spi_rom_safe_prescaler = SPI_BAUDRATEPRESCALER_128;
+
+// Calibration saves the sector it tests on here
+static uint8_t spi_rom_saved[SPI_CALIBRATE_SIZE];
+static uint8_t spi_rom_pattern[SPI_CALIBRATE_CHUNK];
+static uint8_t spi_rom_readback[SPI_CALIBRATE_CHUNK];
+
+/**
+ * @brief   Change an SPI peripheral's clock prescaler.
+ * 
+ * The baud rate can only change while the peripheral is disabled. The HAL enables it again at the start of the
+ * next transfer.
+ * 
+ * @param   hspi       the SPI peripheral
+ * @param   prescaler  one of the SPI_BAUDRATEPRESCALER_x values
+ */
+void spi_rom_set_prescaler(SPI_HandleTypeDef *hspi, uint32_t prescaler)
+{
+
+    if ((hspi->Instance->CR1 & SPI_CR1_BR) == prescaler) {
+        return;
+    }
+
+    __HAL_SPI_DISABLE(hspi);
+    MODIFY_REG(hspi->Instance->CR1, SPI_CR1_BR, prescaler);
+    hspi->Init.BaudRatePrescaler = prescaler;
+
+}
+
+/**
+ * Switch the bus to the device's clock.
+ */
+static void spi_rom_clock(const SPI_ROM_ConfigDef *config)
+{
+
+    spi_rom_set_prescaler(config->hspi, config->device->prescaler);
+
+}
+
+/**
+ * Transmit a block of data using DMA, blocking the calling thread until it's done. Chip select must already be
+ * asserted. If there's no DMA channel to use, this falls back to a polled transfer.
+ */
+static HAL_StatusTypeDef spi_rom_transmit(const SPI_ROM_ConfigDef *config, const uint8_t *data, uint16_t size)
+{
+
+    HAL_StatusTypeDef result;
+
+    if (config->hspi->hdmatx == NULL || spi_rom_dma_done == NULL) {
+        return HAL_SPI_Transmit(config->hspi, (uint8_t *)data, size, SPI_TIMEOUT);
+    }
+
+    // Drop any stale completion left over from an aborted transfer
+    osSemaphoreAcquire(spi_rom_dma_done, 0);
+
+    if ((result = HAL_SPI_Transmit_DMA(config->hspi, (uint8_t *)data, size)) != HAL_OK) {
+        return result;
+    }
+
+    if (osSemaphoreAcquire(spi_rom_dma_done, SPI_TIMEOUT) != osOK) {
+        HAL_SPI_Abort(config->hspi);
+        return HAL_TIMEOUT;
+    }
+
+    return config->hspi->ErrorCode == HAL_SPI_ERROR_NONE ? HAL_OK : HAL_ERROR;
+
+}
+
+/**
+ * Receive a block of data using DMA, blocking the calling thread until it's done. Chip select must already be
+ * asserted. The buffer's contents are clocked out as dummy bytes while receiving.
+ */
+static HAL_StatusTypeDef spi_rom_receive(const SPI_ROM_ConfigDef *config, uint8_t *data, uint16_t size)
+{
+
+    HAL_StatusTypeDef result;
+
+    if (config->hspi->hdmarx == NULL || config->hspi->hdmatx == NULL || spi_rom_dma_done == NULL) {
+        return HAL_SPI_TransmitReceive(config->hspi, data, data, size, SPI_TIMEOUT + size / 32);
+    }
+
+    osSemaphoreAcquire(spi_rom_dma_done, 0);
+
+    if ((result = HAL_SPI_Receive_DMA(config->hspi, data, size)) != HAL_OK) {
+        return result;
+    }
+
+    // Long reads take a while at slow clocks; even the slowest clock manages more than 32 bytes per millisecond
+    if (osSemaphoreAcquire(spi_rom_dma_done, SPI_TIMEOUT + size / 32) != osOK) {
+        HAL_SPI_Abort(config->hspi);
+        return HAL_TIMEOUT;
+    }
+
+    return config->hspi->ErrorCode == HAL_SPI_ERROR_NONE ? HAL_OK : HAL_ERROR;
+
+}
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    UNUSED(hspi);
+    osSemaphoreRelease(spi_rom_dma_done);
+}
+
+void HAL_SPI_RxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    UNUSED(hspi);
+    osSemaphoreRelease(spi_rom_dma_done);
+}
+
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+    UNUSED(hspi);
+    osSemaphoreRelease(spi_rom_dma_done);
+}
+
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+    UNUSED(hspi);
+    osSemaphoreRelease(spi_rom_dma_done);
+}
+
 static HAL_StatusTypeDef spi_rom_write_enable(const SPI_ROM_ConfigDef *config)
 {
 
@@ -41,16 +219,30 @@ static HAL_StatusTypeDef spi_rom_write_enable(const SPI_ROM_ConfigDef *config)
 
 }
 
-static HAL_StatusTypeDef spi_rom_busy_wait(const SPI_ROM_ConfigDef *config)
+/**
+ * Wait for a program or erase operation to complete.
+ * 
+ * The ROM reports completion through the BUSY flag in status register 1. Polling it once per RTOS tick would turn
+ * a 0.7ms page program into 2ms or more, so instead the wait is shaped around how long the operation is expected
+ * to take. The first part of the wait is slept through in one go, then the status is polled with an exponentially
+ * growing back-off. Each completed operation's measured duration feeds back into the expected time, so the wait
+ * tracks the actual part rather than the datasheet.
+ * 
+ * Long operations that overrun their expected time fall back to polling once per tick, yielding to other threads.
+ */
+static HAL_StatusTypeDef spi_rom_busy_wait(const SPI_ROM_ConfigDef *config, uint32_t *typical_us, uint32_t max_ms)
 {
 
     HAL_StatusTypeDef result;
-    uint32_t timeout, delay;
+    uint32_t start, timeout, elapsed, expected, backoff;
     uint8_t cmd;
 
-    // An erase or program needs at least 50ns before SS goes active again, so give it a full tick
-    osDelay(1);
+    start = timing_cycles();
+    timeout = osKernelGetTickCount();
+    expected = *typical_us;
+    backoff = SPI_POLL_MIN_US;
 
+    // The ROM needs 50ns of deselect time before SS goes active again, which the call overhead more than covers.
     cmd = SPI_CMD_READ_STATUS_1;
     HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_RESET);
     if ((result = HAL_SPI_Transmit(config->hspi, &cmd, 1, SPI_TIMEOUT)) != HAL_OK) {
@@ -58,12 +250,29 @@ static HAL_StatusTypeDef spi_rom_busy_wait(const SPI_ROM_ConfigDef *config)
         return result;
     }
 
-    timeout = osKernelGetTickCount();
-
     do {
 
-        // Show some mercy to the Flash ROM
-        osDelay(1);
+        elapsed = timing_elapsed_us(start);
+
+        if (elapsed < expected - expected / 4) {
+
+            // Nowhere near done yet: sleep through to three quarters of the expected time
+            timing_sleep_us(expected - expected / 4 - elapsed);
+
+        } else if (elapsed < 2 * expected) {
+
+            // Close to done, poll with a growing back-off
+            timing_sleep_us(backoff);
+            if (backoff < SPI_POLL_MAX_US) {
+                backoff *= 2;
+            }
+
+        } else {
+
+            // Well past the expected time, so the estimate is off: stop burning time and poll once per tick
+            osDelay(1);
+
+        }
 
         // continually read the status register waiting for the BUSY flag to clear
         if ((result = HAL_SPI_TransmitReceive(config->hspi, &cmd, &cmd, 1, SPI_TIMEOUT)) != HAL_OK) {
@@ -71,13 +280,286 @@ static HAL_StatusTypeDef spi_rom_busy_wait(const SPI_ROM_ConfigDef *config)
             return result;
         }
 
-        delay = (osKernelGetTickCount() - timeout);
+    } while ((cmd & SPI_STATUS_1_BUSY) != 0 && osKernelGetTickCount() - timeout <= max_ms);
+
+    HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
+
+    if ((cmd & SPI_STATUS_1_BUSY) != 0) {
+        return HAL_TIMEOUT;
+    }
+
+    // The cycle counter wraps after 42 seconds, so very long operations can't be measured
+    if (osKernelGetTickCount() - timeout > SPI_MEASURE_MAX_MS) {
+        return HAL_OK;
+    }
+
+    // Fold this operation's duration into the expected time for the next one
+    elapsed = timing_elapsed_us(start);
+    *typical_us = *typical_us - *typical_us / 8 + elapsed / 8;
+    if (*typical_us < SPI_POLL_MIN_US) {
+        *typical_us = SPI_POLL_MIN_US;
+    }
+
+    return HAL_OK;
 
-    } while ((cmd & SPI_STATUS_1_BUSY) != 0 && delay < 3 * osKernelGetTickFreq());
+}
 
+/**
+ * Read from the SFDP address space. Like Fast Read, this takes a three byte address and a dummy byte.
+ */
+static HAL_StatusTypeDef spi_rom_read_sfdp(const SPI_ROM_ConfigDef *config, uint32_t address, uint8_t *data,
+    uint16_t size)
+{
+
+    HAL_StatusTypeDef result;
+    uint8_t cmd[5];
+
+    spi_rom_clock(config);
+
+    cmd[0] = SPI_CMD_READ_SFDP;
+    cmd[1] = (address >> 16) & 0xff;
+    cmd[2] = (address >> 8) & 0xff;
+    cmd[3] = address & 0xff;
+    cmd[4] = 0xbe;  // dummy byte
+
+    HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_RESET);
+    if ((result = HAL_SPI_Transmit(config->hspi, cmd, 5, SPI_TIMEOUT)) == HAL_OK) {
+        result = HAL_SPI_TransmitReceive(config->hspi, data, data, size, SPI_TIMEOUT);
+    }
     HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
 
-    return (cmd & SPI_STATUS_1_BUSY) == 0 ? HAL_OK : HAL_TIMEOUT;
+    return result;
+
+}
+
+// SFDP erase time units, in milliseconds
+static const uint32_t sfdp_erase_units[4] = { 1, 16, 128, 1000 };
+
+// SFDP chip erase time units, in milliseconds
+static const uint32_t sfdp_chip_erase_units[4] = { 16, 256, 4000, 64000 };
+
+/**
+ * Fill in a device description from a JESD216 basic flash parameter table. Fields the table is too old to
+ * describe keep whatever they held before.
+ */
+static void spi_rom_parse_bfpt(SPI_ROM_DeviceDef *device, const uint32_t *bfpt, uint8_t dwords)
+{
+
+    SPI_ROM_EraseTypeDef erase;
+    uint32_t typical, multiplier;
+    uint8_t i, j, count;
+
+    // DWORD 2: density, either in bits minus one, or as a power of two number of bits
+    if (bfpt[1] & 0x80000000) {
+        count = bfpt[1] & 0x7fffffff;
+        device->capacity = count >= 27 ? SPI_MAX_CAPACITY : (1UL << count) / 8;
+    } else {
+        device->capacity = bfpt[1] / 8 + 1;
+    }
+
+    if (device->capacity > SPI_MAX_CAPACITY) {
+        device->capacity = SPI_MAX_CAPACITY;
+    }
+
+    // DWORDs 8 and 9: up to four erase types, as a power of two size and an opcode
+    count = 0;
+    for (i = 0; i < SPI_ROM_ERASE_TYPES; i++) {
+
+        uint8_t exponent = (bfpt[7 + i / 2] >> ((i & 1) * 16)) & 0xff;
+
+        if (exponent == 0 || exponent > 24) {
+            continue;
+        }
+
+        erase.size = 1UL << exponent;
+        erase.opcode = (bfpt[7 + i / 2] >> ((i & 1) * 16 + 8)) & 0xff;
+
+        // Timings come from the JESD216A DWORD 10, or from the default profile
+        if (dwords >= SFDP_BFPT_TIMING_DWORDS) {
+            multiplier = 2 * ((bfpt[9] & 0xf) + 1);
+            typical = (((bfpt[9] >> (4 + i * 7)) & 0x1f) + 1) * sfdp_erase_units[(bfpt[9] >> (9 + i * 7)) & 0x3];
+            erase.typical_us = typical * 1000;
+            erase.max_ms = typical * multiplier;
+        } else {
+            erase.typical_us = spi_rom_default.erase[2].typical_us;
+            erase.max_ms = spi_rom_default.erase[2].max_ms;
+            for (j = 0; j < SPI_ROM_ERASE_TYPES; j++) {
+                if (spi_rom_default.erase[j].size == erase.size) {
+                    erase.typical_us = spi_rom_default.erase[j].typical_us;
+                    erase.max_ms = spi_rom_default.erase[j].max_ms;
+                }
+            }
+        }
+
+        // Insert in size order
+        for (j = count; j > 0 && device->erase[j - 1].size > erase.size; j--) {
+            device->erase[j] = device->erase[j - 1];
+        }
+        device->erase[j] = erase;
+        count++;
+
+    }
+
+    // Unused slots are zeroed
+    for (i = count; i < SPI_ROM_ERASE_TYPES; i++) {
+        device->erase[i].size = 0;
+        device->erase[i].opcode = 0;
+        device->erase[i].typical_us = 0;
+        device->erase[i].max_ms = 0;
+    }
+
+    if (dwords < SFDP_BFPT_TIMING_DWORDS) {
+        return;
+    }
+
+    // DWORD 11: page size, page program time, and chip erase time, with a shared max time multiplier
+    multiplier = 2 * ((bfpt[10] & 0xf) + 1);
+    device->page_size = 1 << ((bfpt[10] >> 4) & 0xf);
+    device->program_typical_us = (((bfpt[10] >> 8) & 0x1f) + 1) * ((bfpt[10] & (1 << 13)) ? 64 : 8);
+    device->program_max_ms = (device->program_typical_us * multiplier + 999) / 1000;
+
+    typical = (((bfpt[10] >> 24) & 0x1f) + 1) * sfdp_chip_erase_units[(bfpt[10] >> 29) & 0x3];
+    device->chip_erase_typical_us = typical * 1000;
+    device->chip_erase_max_ms = typical * multiplier;
+
+}
+
+/**
+ * @brief   Prepare the Flash ROM driver for use.
+ * 
+ * This must be called from a thread, before any other Flash ROM function, to set up the DMA completion signal. The
+ * device description is reset to the default W25Q32 profile until spi_rom_detect() is called.
+ * 
+ * @param   config   pointer to the flash configuration data
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef spi_rom_init(const SPI_ROM_ConfigDef *config)
+{
+
+    spi_rom_safe_prescaler = config->hspi->Init.BaudRatePrescaler;
+
+    *config->device = spi_rom_default;
+    config->device->prescaler = spi_rom_safe_prescaler;
+
+    if (spi_rom_dma_done == NULL) {
+        spi_rom_dma_done = osSemaphoreNew(1, 0, NULL);
+    }
+
+    return spi_rom_dma_done != NULL ? HAL_OK : HAL_ERROR;
+
+}
+
+/**
+ * Carry the typical times measured on a device over to a fresh description of the same device, for each operation
+ * that is still described the same way. A description from a different source, such as the default profile before
+ * the first detection, has nothing measured to carry over.
+ */
+static void spi_rom_keep_timings(SPI_ROM_DeviceDef *device, const SPI_ROM_DeviceDef *previous)
+{
+
+    uint8_t i;
+
+    if (device->sfdp != previous->sfdp) {
+        return;
+    }
+
+    if (device->page_size == previous->page_size) {
+        device->program_typical_us = previous->program_typical_us;
+    }
+
+    if (device->capacity == previous->capacity) {
+        device->chip_erase_typical_us = previous->chip_erase_typical_us;
+    }
+
+    for (i = 0; i < SPI_ROM_ERASE_TYPES; i++) {
+        if (device->erase[i].size == previous->erase[i].size && device->erase[i].opcode == previous->erase[i].opcode) {
+            device->erase[i].typical_us = previous->erase[i].typical_us;
+        }
+    }
+
+}
+
+/**
+ * @brief   Identify the attached Flash ROM and describe its geometry and timings.
+ * 
+ * The JEDEC ID is always read. If the device has an SFDP table, the description comes from its basic flash
+ * parameter table. Otherwise it's the default W25Q32 profile, resized to the capacity code in the JEDEC ID. If it's
+ * the same device as last time, the calibrated clock and the measured operation times are kept.
+ * 
+ * @param   config   pointer to the flash configuration data; config->device is filled in
+ * @retval  HAL status: HAL_ERROR if no plausible device responded
+ */
+HAL_StatusTypeDef spi_rom_detect(const SPI_ROM_ConfigDef *config)
+{
+
+    SPI_ROM_DeviceDef *device = config->device;
+    SPI_ROM_DeviceDef previous;
+    HAL_StatusTypeDef result;
+    uint32_t header[4];
+    uint32_t bfpt[SFDP_BFPT_DWORDS];
+    uint32_t pointer;
+    uint8_t dwords, same;
+
+    // Remember the clock calibrated and the times measured for the last device seen
+    previous = *device;
+
+    *device = spi_rom_default;
+    device->prescaler = spi_rom_safe_prescaler;
+
+    if ((result = spi_rom_read_jedec_id(config, &device->manufacturer, &device->device_id)) != HAL_OK) {
+        return result;
+    }
+
+    // A floating or shorted MISO reads as all ones or all zeroes
+    if (device->manufacturer == 0x00 || device->manufacturer == 0xff) {
+        return HAL_ERROR;
+    }
+
+    same = device->manufacturer == previous.manufacturer && device->device_id == previous.device_id;
+    if (same) {
+        device->prescaler = previous.prescaler;
+    }
+
+    // The SFDP header is followed immediately by the first parameter header, which is always the basic table
+    if ((result = spi_rom_read_sfdp(config, 0, (uint8_t *)header, sizeof(header))) != HAL_OK) {
+        return result;
+    }
+
+    dwords = (header[2] >> 24) & 0xff;
+    pointer = header[3] & 0xffffff;
+
+    if (header[0] != SFDP_SIGNATURE || (header[2] & 0xff) != 0x00 || ((header[2] >> 16) & 0xff) != 0x01
+            || dwords < SFDP_BFPT_MIN_DWORDS) {
+
+        // No usable SFDP - the low byte of the device ID is the capacity as a power of two on 25-series parts
+        if ((device->device_id & 0xff) >= 16 && (device->device_id & 0xff) <= 24) {
+            device->capacity = 1UL << (device->device_id & 0xff);
+        }
+
+        if (same) {
+            spi_rom_keep_timings(device, &previous);
+        }
+
+        return HAL_OK;
+
+    }
+
+    if (dwords > SFDP_BFPT_DWORDS) {
+        dwords = SFDP_BFPT_DWORDS;
+    }
+
+    if ((result = spi_rom_read_sfdp(config, pointer, (uint8_t *)bfpt, dwords * 4)) != HAL_OK) {
+        return result;
+    }
+
+    spi_rom_parse_bfpt(device, bfpt, dwords);
+    device->sfdp = 1;
+
+    if (same) {
+        spi_rom_keep_timings(device, &previous);
+    }
+
+    return device->erase[0].size != 0 ? HAL_OK : HAL_ERROR;
 
 }
 
@@ -95,6 +577,8 @@ HAL_StatusTypeDef spi_rom_read_jedec_id(const SPI_ROM_ConfigDef *config, uint8_t
     HAL_StatusTypeDef result;
     uint8_t data[4];
 
+    spi_rom_clock(config);
+
     // request JEDEC ID
     data[0] = SPI_CMD_JEDEC_ID;
 
@@ -118,37 +602,55 @@ HAL_StatusTypeDef spi_rom_read_jedec_id(const SPI_ROM_ConfigDef *config, uint8_t
  * @brief   Erase a portion of the Flash ROM.
  * 
  * @param   config   pointer to the flash configuration data
- * @param   address  the address to erase - must be appropriately aligned
- * @param   type     the type of erase to do, one of SPI_ROM_ERASE_xxx
+ * @param   address  the address to erase - must be aligned to the erase size
+ * @param   size     the size of the erase, which must be one of the device's erase types, or the device's whole
+ *                   capacity (at address zero) for a chip erase
  * @retval  HAL status
  */
 
-HAL_StatusTypeDef spi_rom_erase(const SPI_ROM_ConfigDef *config, uint32_t address, uint8_t type)
+HAL_StatusTypeDef spi_rom_erase(const SPI_ROM_ConfigDef *config, uint32_t address, uint32_t size)
 {
 
+    SPI_ROM_EraseTypeDef *erase = NULL;
     HAL_StatusTypeDef result;
     uint8_t cmd[4];
+    uint8_t i;
 
-    // Load in the type - done before any SPI operations, in case of argument error
-    switch (type) {
+    spi_rom_clock(config);
 
-        case SPI_ROM_ERASE_SECTOR:
-            cmd[0] = SPI_CMD_ERASE_SECTOR;
-            break;
+    // Erasing the whole capacity is a chip erase, which takes no address
+    if (address == 0 && size == config->device->capacity) {
 
-        case SPI_ROM_ERASE_BLOCK:
-            cmd[0] = SPI_CMD_ERASE_BLOCK;
-            break;
+        if ((result = spi_rom_write_enable(config)) != HAL_OK) {
+            return result;
+        }
 
-        case SPI_ROM_ERASE_LARGE_BLOCK:
-            cmd[0] = SPI_CMD_ERASE_LARGE_BLOCK;
-            break;
+        cmd[0] = SPI_CMD_ERASE_CHIP;
 
-        default:
-            return HAL_ERROR;
+        HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_RESET);
+        result = HAL_SPI_Transmit(config->hspi, cmd, 1, SPI_TIMEOUT);
+        HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
+
+        if (result != HAL_OK) {
+            return result;
+        }
+
+        return spi_rom_busy_wait(config, &config->device->chip_erase_typical_us, config->device->chip_erase_max_ms);
 
     }
 
+    // Find the erase type - done before any SPI operations, in case of argument error
+    for (i = 0; i < SPI_ROM_ERASE_TYPES; i++) {
+        if (config->device->erase[i].size == size && size != 0) {
+            erase = &config->device->erase[i];
+        }
+    }
+
+    if (erase == NULL || (address & (size - 1)) != 0) {
+        return HAL_ERROR;
+    }
+
+    cmd[0] = erase->opcode;
 
     if ((result = spi_rom_write_enable(config)) != HAL_OK) {
         return result;
@@ -168,7 +670,139 @@ HAL_StatusTypeDef spi_rom_erase(const SPI_ROM_ConfigDef *config, uint32_t addres
         return result;
     }
 
-    return spi_rom_busy_wait(config);
+    return spi_rom_busy_wait(config, &erase->typical_us, erase->max_ms);
+
+}
+
+/**
+ * Find the highest erase type that is aligned at an address and fits before an end address, or -1 if none do.
+ */
+static int8_t spi_rom_plan_level(const SPI_ROM_DeviceDef *device, uint32_t address, uint32_t end)
+{
+
+    int8_t level;
+
+    for (level = SPI_ROM_ERASE_TYPES - 1; level >= 0; level--) {
+
+        uint32_t size = device->erase[level].size;
+
+        if (size != 0 && (address & (size - 1)) == 0 && address + size <= end) {
+            break;
+        }
+
+    }
+
+    return level;
+
+}
+
+/**
+ * @brief   Plan the quickest way to erase a region of the Flash ROM.
+ * 
+ * Erase types are nested powers of two, so any aligned block of one type is made of a whole number of aligned
+ * blocks of each smaller type. The quickest way to erase a block of one type is therefore either a single erase of
+ * that type, or the quickest way to erase each of its parts - and that decision is the same for every block of the
+ * type, so it's made once per type.
+ * 
+ * The region itself breaks down into the largest aligned blocks that fit, typically a ramp of smaller blocks up to
+ * an alignment boundary, a run of the largest blocks, and a ramp back down. Each block is erased the quickest way
+ * for its type. If a single chip erase beats the total, and is allowed, the plan is a chip erase instead.
+ * 
+ * @param   config      pointer to the flash configuration data
+ * @param   start       the first address in the region to erase
+ * @param   end         the address after the last in the region to erase
+ * @param   allow_chip  true if erasing beyond the region is acceptable
+ * @param   plan        where to store the plan
+ */
+void spi_rom_plan_erase(const SPI_ROM_ConfigDef *config, uint32_t start, uint32_t end, uint8_t allow_chip,
+    SPI_ROM_ErasePlanDef *plan)
+{
+
+    const SPI_ROM_DeviceDef *device = config->device;
+    uint32_t best_us[SPI_ROM_ERASE_TYPES];
+    uint32_t parts_us, total_us, address;
+    uint8_t level;
+    int8_t fit;
+
+    plan->start = start & ~(device->erase[0].size - 1);
+    plan->end = (end + device->erase[0].size - 1) & ~(device->erase[0].size - 1);
+    plan->chip = 0;
+
+    if (plan->end > device->capacity) {
+        plan->end = device->capacity;
+    }
+
+    // The quickest way to erase one block of each type
+    best_us[0] = device->erase[0].typical_us;
+    plan->direct[0] = 1;
+    for (level = 1; level < SPI_ROM_ERASE_TYPES; level++) {
+
+        if (device->erase[level].size == 0) {
+            plan->direct[level] = 0;
+            continue;
+        }
+
+        parts_us = device->erase[level].size / device->erase[level - 1].size * best_us[level - 1];
+        plan->direct[level] = device->erase[level].typical_us <= parts_us;
+        best_us[level] = plan->direct[level] ? device->erase[level].typical_us : parts_us;
+
+    }
+
+    // Add up the blocks making up the region
+    total_us = 0;
+    for (address = plan->start; address < plan->end; address += device->erase[fit].size) {
+        fit = spi_rom_plan_level(device, address, plan->end);
+        if (fit < 0) {
+            fit = 0;
+        }
+        total_us += best_us[fit];
+    }
+
+    if (allow_chip && plan->start < plan->end && device->chip_erase_typical_us < total_us) {
+        plan->chip = 1;
+        plan->start = 0;
+        plan->end = device->capacity;
+        total_us = device->chip_erase_typical_us;
+    }
+
+    plan->typical_ms = total_us / 1000;
+
+}
+
+/**
+ * @brief   Find the next erase to perform in a plan.
+ * 
+ * @param   config   pointer to the flash configuration data
+ * @param   plan     the erase plan
+ * @param   address  the next address to erase, which must be the plan's start or an address returned by a
+ *                   previous step added to its size
+ * @retval  the size to pass to spi_rom_erase() at the address, or zero if the plan is complete
+ */
+uint32_t spi_rom_plan_step(const SPI_ROM_ConfigDef *config, const SPI_ROM_ErasePlanDef *plan, uint32_t address)
+{
+
+    const SPI_ROM_DeviceDef *device = config->device;
+    int8_t level;
+
+    if (address >= plan->end) {
+        return 0;
+    }
+
+    if (plan->chip) {
+        return device->capacity;
+    }
+
+    // Take the largest block that fits, and break it down to the size it's quickest to erase in
+    level = spi_rom_plan_level(device, address, plan->end);
+    if (level < 0) {
+        return device->erase[0].size;
+    }
+
+    while (level > 0 && !plan->direct[level]) {
+        level--;
+    }
+
+    return device->erase[level].size;
 
 }
 
@@ -195,14 +829,16 @@ HAL_StatusTypeDef spi_rom_program(
     static uint8_t cmd[4];
     uint16_t chunk;
 
+    spi_rom_clock(config);
+
     while (size > 0) {
 
         if ((result = spi_rom_write_enable(config)) != HAL_OK) {
             return result;
         }
         
-        // A page is 256-byte aligned, see how much of the page is left
-        chunk = 256 - (address & 0xff);
+        // A page is aligned to its size, see how much of the page is left
+        chunk = config->device->page_size - (address & (config->device->page_size - 1));
         if (chunk > size) chunk = size;
 
         // Load in the command and address, MSB first
@@ -217,12 +853,18 @@ HAL_StatusTypeDef spi_rom_program(
             HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
             return result;
         }
-        result = HAL_SPI_Transmit(config->hspi, (uint8_t *)data, chunk, SPI_TIMEOUT);
+        result = spi_rom_transmit(config, data, chunk);
         HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
         if (result != HAL_OK) {
             return result;
         }
 
+        // The next write enable would be ignored while the page is still programming
+        if ((result = spi_rom_busy_wait(config, &config->device->program_typical_us,
+                config->device->program_max_ms)) != HAL_OK) {
+            return result;
+        }
+
         // Shuffle variables along
         size -= chunk;
         address += chunk;
@@ -234,26 +876,78 @@ HAL_StatusTypeDef spi_rom_program(
 
 }
 
+/**
+ * @brief   Program bytes into an erased region of the Flash ROM.
+ *
+ * Erased Flash already reads as all ones, so any page-sized chunk of the data that is all 0xFF is skipped, saving
+ * its page program time. The caller must know the region is erased; otherwise use spi_rom_program().
+ *
+ * @param   config   pointer to the flash configuration data
+ * @param   address  the address to begin writing from
+ * @param   data     the data to write
+ * @param   size     the total size of data to write
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef spi_rom_program_erased(
+    const SPI_ROM_ConfigDef *config,
+    uint32_t address,
+    const uint8_t *data,
+    uint16_t size)
+{
+
+    HAL_StatusTypeDef result;
+    uint16_t offset, start = 0, chunk, i;
+
+    for (offset = 0; offset < size; offset += chunk) {
+
+        chunk = config->device->page_size - ((address + offset) & (config->device->page_size - 1));
+        if (chunk > size - offset) chunk = size - offset;
+
+        for (i = 0; i < chunk && data[offset + i] == 0xff; i++) {}
+
+        if (i < chunk) {
+            continue;
+        }
+
+        // Program the run of pages before this blank one
+        if (offset > start) {
+            if ((result = spi_rom_program(config, address + start, &data[start], offset - start)) != HAL_OK) {
+                return result;
+            }
+        }
+
+        start = offset + chunk;
+
+    }
+
+    if (size > start) {
+        return spi_rom_program(config, address + start, &data[start], size - start);
+    }
+
+    return HAL_OK;
+
+}
+
 /**
  * @brief   Read bytes from the Flash ROM.
  * 
- * spi_rom_read_page() reads one page of data from the ROM. The address passed must be page-aligned.
+ * spi_rom_read() reads any number of bytes from any address using a single Fast Read command. The ROM streams
+ * data for as long as chip select is held, wrapping at the end of the array, so the whole read is one transaction.
  * 
  * @param   config   pointer to the flash configuration data
  * @param   address  the address to begin reading from
  * @param   data     where to store the data
+ * @param   size     the number of bytes to read
  * @retval  HAL status
  */
-HAL_StatusTypeDef spi_rom_read_page(const SPI_ROM_ConfigDef *config, uint32_t address, uint8_t *data)
+HAL_StatusTypeDef spi_rom_read(const SPI_ROM_ConfigDef *config, uint32_t address, uint8_t *data, uint32_t size)
 {
 
     HAL_StatusTypeDef result;
     uint8_t cmd[5];
+    uint16_t chunk;
 
-    // Must be page aligned
-    if ((address & 0xff) != 0) {
-        return HAL_ERROR;
-    }
+    spi_rom_clock(config);
 
     // Load in the command and address, MSB first
     cmd[0] = SPI_CMD_READ_FAST;
@@ -263,16 +957,224 @@ HAL_StatusTypeDef spi_rom_read_page(const SPI_ROM_ConfigDef *config, uint32_t ad
     cmd[4] = 0xbe;  // dummy byte inserted for fast-read
 
     HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_RESET);
-    osDelay(1);
     if ((result = HAL_SPI_Transmit(config->hspi, cmd, 5, SPI_TIMEOUT)) != HAL_OK) {
         HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
         return result;
     }
 
-    result = HAL_SPI_TransmitReceive(config->hspi, data, data, 256, SPI_TIMEOUT);
-    osDelay(1);
+    // A DMA transfer is limited to 65535 bytes, so long reads are split up - the ROM doesn't notice the gaps
+    while (size > 0) {
+
+        chunk = size > 0x8000 ? 0x8000 : size;
+
+        if ((result = spi_rom_receive(config, data, chunk)) != HAL_OK) {
+            break;
+        }
+
+        size -= chunk;
+        data += chunk;
+
+    }
+
     HAL_GPIO_WritePin(config->ss_port, config->ss_pin, GPIO_PIN_SET);
 
     return result;
 
-}
\ No newline at end of file
+}
+
+/**
+ * @brief   Read one page from the Flash ROM.
+ * 
+ * spi_rom_read_page() reads one page of data from the ROM. The address passed must be page-aligned.
+ * 
+ * @param   config   pointer to the flash configuration data
+ * @param   address  the address to begin reading from
+ * @param   data     where to store the data
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef spi_rom_read_page(const SPI_ROM_ConfigDef *config, uint32_t address, uint8_t *data)
+{
+
+    // Must be page aligned
+    if ((address & 0xff) != 0) {
+        return HAL_ERROR;
+    }
+
+    return spi_rom_read(config, address, data, 256);
+
+}
+
+/**
+ * Fill the pattern buffer with a pseudo-random block that differs with every seed, so a stale read-back of an
+ * earlier pass can't be mistaken for a good one.
+ */
+static void spi_rom_fill_pattern(uint32_t seed)
+{
+
+    uint16_t i;
+
+    seed |= 1;
+    for (i = 0; i < SPI_CALIBRATE_CHUNK; i++) {
+
+        // xorshift32
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+
+        spi_rom_pattern[i] = seed & 0xff;
+
+    }
+
+}
+
+/**
+ * Test one clock: read back known data without touching the ROM, then erase, program and repeatedly read back a
+ * fresh pattern. The read-only check comes first so a clock too fast to read correctly is caught before it gets
+ * the chance to send a garbled erase. The known data is the pattern the previous pass left behind, or the saved
+ * sector if previous is the boot-time prescaler, which no pass runs at.
+ */
+static HAL_StatusTypeDef spi_rom_calibrate_pass(const SPI_ROM_ConfigDef *config, uint32_t address, uint32_t size,
+    uint32_t previous)
+{
+
+    HAL_StatusTypeDef result;
+    uint32_t offset;
+    uint8_t pass;
+
+    for (offset = 0; offset < size; offset += SPI_CALIBRATE_CHUNK) {
+
+        if ((result = spi_rom_read(config, address + offset, spi_rom_readback, SPI_CALIBRATE_CHUNK)) != HAL_OK) {
+            return result;
+        }
+
+        if (previous == spi_rom_safe_prescaler) {
+            memcpy(spi_rom_pattern, &spi_rom_saved[offset], SPI_CALIBRATE_CHUNK);
+        } else {
+            spi_rom_fill_pattern(previous ^ offset);
+        }
+
+        if (memcmp(spi_rom_readback, spi_rom_pattern, SPI_CALIBRATE_CHUNK) != 0) {
+            return HAL_ERROR;
+        }
+
+    }
+
+    if ((result = spi_rom_erase(config, address, size)) != HAL_OK) {
+        return result;
+    }
+
+    for (offset = 0; offset < size; offset += SPI_CALIBRATE_CHUNK) {
+
+        spi_rom_fill_pattern(config->device->prescaler ^ offset);
+
+        if ((result = spi_rom_program(config, address + offset, spi_rom_pattern, SPI_CALIBRATE_CHUNK)) != HAL_OK) {
+            return result;
+        }
+
+    }
+
+    for (pass = 0; pass < SPI_CALIBRATE_READS; pass++) {
+
+        for (offset = 0; offset < size; offset += SPI_CALIBRATE_CHUNK) {
+
+            spi_rom_fill_pattern(config->device->prescaler ^ offset);
+
+            result = spi_rom_read(config, address + offset, spi_rom_readback, SPI_CALIBRATE_CHUNK);
+            if (result != HAL_OK) {
+                return result;
+            }
+
+            if (memcmp(spi_rom_readback, spi_rom_pattern, SPI_CALIBRATE_CHUNK) != 0) {
+                return HAL_ERROR;
+            }
+
+        }
+
+    }
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Find the fastest SPI clock the device and wiring support.
+ * 
+ * The last sector of the ROM is saved, then used to test each prescaler from the boot-time clock upwards until
+ * one fails. The fastest clock that passed is kept only if the next faster one passed too, otherwise the clock
+ * backs off one step from it, so the setting never sits right at the edge of what works. If every clock the
+ * peripheral offers passes, the fastest is kept. The sector is restored at the boot-time clock afterwards.
+ * 
+ * @param   config   pointer to the flash configuration data
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef spi_rom_calibrate(const SPI_ROM_ConfigDef *config)
+{
+
+    SPI_ROM_DeviceDef *device = config->device;
+    HAL_StatusTypeDef result, restored;
+    uint32_t address, size, prescaler, fastest;
+
+    size = device->erase[0].size;
+    if (size == 0 || size > SPI_CALIBRATE_SIZE) {
+        return HAL_ERROR;
+    }
+
+    address = device->capacity - size;
+
+    device->prescaler = spi_rom_safe_prescaler;
+    if ((result = spi_rom_read(config, address, spi_rom_saved, size)) != HAL_OK) {
+        return result;
+    }
+
+    // Prescaler values go down by one step of the BR field for each doubling of the clock
+    fastest = spi_rom_safe_prescaler;
+    for (prescaler = spi_rom_safe_prescaler; prescaler > SPI_BAUDRATEPRESCALER_2; prescaler -= SPI_CR1_BR_0) {
+
+        device->prescaler = prescaler - SPI_CR1_BR_0;
+
+        if (spi_rom_calibrate_pass(config, address, size, prescaler) != HAL_OK) {
+            break;
+        }
+
+        fastest = device->prescaler;
+
+    }
+
+    // Stopped by a failure, so keep a step of margin
+    if (fastest != SPI_BAUDRATEPRESCALER_2 && fastest != spi_rom_safe_prescaler) {
+        fastest += SPI_CR1_BR_0;
+    }
+
+    // Put the sector back the way it was
+    device->prescaler = spi_rom_safe_prescaler;
+    if ((restored = spi_rom_erase(config, address, size)) == HAL_OK) {
+        restored = spi_rom_program(config, address, spi_rom_saved, size);
+    }
+
+    device->prescaler = fastest;
+
+    return restored;
+
+}
+
+/**
+ * @brief   The SPI clock frequency the device is currently set to run at.
+ * 
+ * @param   config   pointer to the flash configuration data
+ * @retval  clock in Hz
+ */
+uint32_t spi_rom_clock_hz(const SPI_ROM_ConfigDef *config)
+{
+
+    uint32_t pclk;
+
+    // SPI2 and SPI3 hang off APB1, the rest off APB2
+    if (config->hspi->Instance == SPI2 || config->hspi->Instance == SPI3) {
+        pclk = HAL_RCC_GetPCLK1Freq();
+    } else {
+        pclk = HAL_RCC_GetPCLK2Freq();
+    }
+
+    return pclk >> ((config->device->prescaler / SPI_CR1_BR_0) + 1);
+
+}
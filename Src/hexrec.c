@@ -0,0 +1,341 @@
+/**
+ * A streaming parser for the two text formats toolchains write ROM images in:
+ *
+ *      Intel HEX       :LLAAAATTDD...CC    data (00), end (01), extended segment (02) and linear (04) addresses
+ *      S-records       SnLLAA..DD...CC     data (S1/S2/S3, 16/24/32-bit addresses), end (S7/S8/S9)
+ *
+ * Records arrive in whatever pieces the transfer protocol delivers, so the parser decodes one character at a time
+ * into a record buffer, and checks the record's checksum when its line ends. Start address records, S0 headers and
+ * S5/S6 counts are checked and otherwise ignored.
+ *
+ * Data is gathered into a HEXREC_CHUNK buffer while records follow on from one another. The buffer is written out
+ * when it reaches a multiple of HEXREC_CHUNK, or when the data jumps, so the ROM sees large page-aligned writes no
+ * matter how short the records are, and only the addressed bytes are ever written.
+ *
+ * The records are not sorted. A jump is passed on as a seek, and the ROMs erase and program strictly forwards, so
+ * they refuse a seek backwards: data records must come in ascending address order, as toolchains write them.
+ */
+
+#include <string.h>
+
+#include "hexrec.h"
+
+#define HEXREC_MAX_RECORD       (1 + 4 + 255 + 1)   // longest decoded record, an Intel HEX one with 255 data bytes
+
+// Parser states
+#define HEXREC_STATE_IDLE       0           // between records
+#define HEXREC_STATE_TYPE       1           // expecting an S-record's type digit
+#define HEXREC_STATE_RECORD     2           // collecting a record's hex digits
+#define HEXREC_STATE_DONE       3           // the end record has been seen
+#define HEXREC_STATE_FAILED     4           // something went wrong; stay here
+
+typedef struct __HexRec_Parser {
+    uint8_t state;
+    uint8_t format;                 // HEXREC_INTEL or HEXREC_SREC
+    uint8_t type;                   // S-record type digit
+    uint8_t record[HEXREC_MAX_RECORD];
+    uint16_t length;                // bytes decoded into record
+    uint8_t nibble;                 // the high half of a byte, when odd is set
+    uint8_t odd;
+    uint32_t base;                  // Intel HEX: the extended address added to each record's
+    uint32_t start;                 // address of the first byte in data
+    uint16_t size;                  // bytes gathered in data
+    uint32_t next;                  // address the ROM will write to next
+    uint8_t placed;                 // true once the ROM has been told an address
+} HexRec_Parser;
+
+static const HexRec_ControlDef *session = NULL;
+static HexRec_Parser hexrec;
+static uint8_t data[HEXREC_CHUNK];
+
+// Write out the gathered data, telling the ROM where it goes if that isn't where it carries on from
+static HAL_StatusTypeDef hexrec_flush(void)
+{
+
+    if (hexrec.size == 0) {
+        return HAL_OK;
+    }
+
+    if (!hexrec.placed || hexrec.start != hexrec.next) {
+        if (session->seek(session->cb_data, hexrec.start) != HAL_OK) {
+            return HAL_ERROR;
+        }
+        hexrec.placed = 1;
+    }
+
+    if (session->write(session->cb_data, data, hexrec.size) != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    hexrec.next = hexrec.start + hexrec.size;
+    hexrec.size = 0;
+
+    return HAL_OK;
+
+}
+
+// Gather a record's data, writing out each aligned chunk as it fills
+static HAL_StatusTypeDef hexrec_emit(uint32_t address, const uint8_t *bytes, uint16_t size)
+{
+
+    uint32_t take;
+
+    while (size > 0) {
+
+        if (hexrec.size > 0 && address != hexrec.start + hexrec.size && hexrec_flush() != HAL_OK) {
+            return HAL_ERROR;
+        }
+
+        if (hexrec.size == 0) {
+            hexrec.start = address;
+        }
+
+        take = HEXREC_CHUNK - (address & (HEXREC_CHUNK - 1));
+        take = take < size ? take : size;
+
+        memcpy(data + hexrec.size, bytes, take);
+        hexrec.size += take;
+        address += take;
+        bytes += take;
+        size -= take;
+
+        if ((address & (HEXREC_CHUNK - 1)) == 0 && hexrec_flush() != HAL_OK) {
+            return HAL_ERROR;
+        }
+
+    }
+
+    return HAL_OK;
+
+}
+
+static HAL_StatusTypeDef hexrec_intel(void)
+{
+
+    const uint8_t *record = hexrec.record;
+    uint8_t sum = 0, count = record[0];
+    uint16_t i;
+
+    for (i = 0; i < hexrec.length; i++) {
+        sum += record[i];
+    }
+
+    if (hexrec.length < 5 || hexrec.length != count + 5 || sum != 0) {
+        return HAL_ERROR;
+    }
+
+    switch (record[3]) {
+
+        case 0x00:
+            return hexrec_emit(hexrec.base + ((record[1] << 8) | record[2]), record + 4, count);
+
+        case 0x01:
+            hexrec.state = HEXREC_STATE_DONE;
+            return hexrec_flush();
+
+        case 0x02:
+            if (count != 2) {
+                return HAL_ERROR;
+            }
+            hexrec.base = (uint32_t)((record[4] << 8) | record[5]) << 4;
+            return HAL_OK;
+
+        case 0x04:
+            if (count != 2) {
+                return HAL_ERROR;
+            }
+            hexrec.base = (uint32_t)((record[4] << 8) | record[5]) << 16;
+            return HAL_OK;
+
+        case 0x03:
+        case 0x05:
+            return HAL_OK;
+
+        default:
+            return HAL_ERROR;
+
+    }
+
+}
+
+static HAL_StatusTypeDef hexrec_srec(void)
+{
+
+    // Address bytes for each record type; S4 doesn't exist
+    static const uint8_t address_size[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+
+    const uint8_t *record = hexrec.record;
+    uint8_t sum = 0, count = record[0], size = address_size[hexrec.type];
+    uint32_t address = 0;
+    uint16_t i;
+
+    for (i = 0; i < hexrec.length; i++) {
+        sum += record[i];
+    }
+
+    if (size == 0 || hexrec.length < 2 || hexrec.length != count + 1 || count < size + 1 || sum != 0xff) {
+        return HAL_ERROR;
+    }
+
+    for (i = 0; i < size; i++) {
+        address = (address << 8) | record[1 + i];
+    }
+
+    switch (hexrec.type) {
+
+        case 1:
+        case 2:
+        case 3:
+            return hexrec_emit(address, record + 1 + size, count - size - 1);
+
+        case 7:
+        case 8:
+        case 9:
+            hexrec.state = HEXREC_STATE_DONE;
+            return hexrec_flush();
+
+        default:
+            return HAL_OK;
+
+    }
+
+}
+
+// A record's line has ended
+static HAL_StatusTypeDef hexrec_record(void)
+{
+
+    if (hexrec.odd) {
+        return HAL_ERROR;
+    }
+
+    hexrec.state = HEXREC_STATE_IDLE;
+
+    return hexrec.format == HEXREC_INTEL ? hexrec_intel() : hexrec_srec();
+
+}
+
+static inline int8_t hexrec_digit(uint8_t c)
+{
+
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+
+    return -1;
+
+}
+
+/**
+ * @brief   Begin parsing a new file.
+ *
+ * @param   ctrl    the callbacks to hand the file's data to
+ * @param   format  HEXREC_INTEL or HEXREC_SREC
+ */
+void hexrec_start(const HexRec_ControlDef *ctrl, uint8_t format)
+{
+
+    session = ctrl;
+
+    memset(&hexrec, 0, sizeof(hexrec));
+    hexrec.format = format;
+    hexrec.state = HEXREC_STATE_IDLE;
+
+}
+
+/**
+ * @brief   Parse the next part of the file, passing its data to the callbacks.
+ *
+ * @param   text  characters of the file, following on from the last call
+ * @param   size  number of characters
+ * @retval  HAL_OK, or HAL_ERROR if a record is malformed or fails its checksum, or a callback failed
+ */
+HAL_StatusTypeDef hexrec_feed(const uint8_t *text, uint32_t size)
+{
+
+    const uint8_t *end = text + size;
+    int8_t digit;
+    uint8_t c;
+
+    for (; text < end && hexrec.state != HEXREC_STATE_DONE && hexrec.state != HEXREC_STATE_FAILED; text++) {
+
+        c = *text;
+
+        switch (hexrec.state) {
+
+            case HEXREC_STATE_IDLE:
+                if (c == '\r' || c == '\n' || c == ' ' || c == '\t') {
+                    break;
+                }
+                hexrec.length = 0;
+                hexrec.odd = 0;
+                if (hexrec.format == HEXREC_INTEL && c == ':') {
+                    hexrec.state = HEXREC_STATE_RECORD;
+                } else if (hexrec.format == HEXREC_SREC && c == 'S') {
+                    hexrec.state = HEXREC_STATE_TYPE;
+                } else {
+                    hexrec.state = HEXREC_STATE_FAILED;
+                }
+                break;
+
+            case HEXREC_STATE_TYPE:
+                if (c < '0' || c > '9') {
+                    hexrec.state = HEXREC_STATE_FAILED;
+                    break;
+                }
+                hexrec.type = c - '0';
+                hexrec.state = HEXREC_STATE_RECORD;
+                break;
+
+            case HEXREC_STATE_RECORD:
+                if (c == '\r' || c == '\n') {
+                    if (hexrec_record() != HAL_OK) {
+                        hexrec.state = HEXREC_STATE_FAILED;
+                    }
+                    break;
+                }
+                if ((digit = hexrec_digit(c)) < 0 || (!hexrec.odd && hexrec.length == HEXREC_MAX_RECORD)) {
+                    hexrec.state = HEXREC_STATE_FAILED;
+                    break;
+                }
+                if (!hexrec.odd) {
+                    hexrec.nibble = digit;
+                } else {
+                    hexrec.record[hexrec.length++] = (hexrec.nibble << 4) | digit;
+                }
+                hexrec.odd = !hexrec.odd;
+                break;
+
+            default:
+                hexrec.state = HEXREC_STATE_FAILED;
+                break;
+
+        }
+
+    }
+
+    return hexrec.state == HEXREC_STATE_FAILED ? HAL_ERROR : HAL_OK;
+
+}
+
+/**
+ * @brief   Finish the file, writing out any data still gathered.
+ *
+ * @retval  HAL_OK if the end record was seen and everything written, HAL_ERROR otherwise
+ */
+HAL_StatusTypeDef hexrec_finish(void)
+{
+
+    // The end record's line needn't be terminated
+    if (hexrec.state == HEXREC_STATE_RECORD && hexrec_record() != HAL_OK) {
+        hexrec.state = HEXREC_STATE_FAILED;
+    }
+
+    return hexrec.state == HEXREC_STATE_DONE ? HAL_OK : HAL_ERROR;
+
+}
@@ -0,0 +1,614 @@
+/**
+ * A streaming decoder for the LZ4 frame format, as written by the lz4 command line tool:
+ *
+ *      https://github.com/lz4/lz4/blob/dev/doc/lz4_Frame_format.md
+ *      https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md
+ *
+ * Compressed data arrives in whatever pieces the transfer protocol delivers, so the decoder is a state machine that
+ * can stop and pick up again at any byte. Blocks are never buffered whole. Decompressed bytes go straight into a
+ * 64K ring, which is all the history any LZ4 match can reach back into, whether or not the frame's blocks are
+ * independent. Every LZ4_FRAME_CHUNK bytes the ring hands its newest chunk to the write callback.
+ *
+ * The header checksum and the optional content checksum (xxHash32 of the decompressed data) are checked. Block
+ * checksums, which cover the compressed data the transfer protocol already checks, are skipped over. Dictionaries
+ * are not supported. Skippable frames before the LZ4 frame are passed over.
+ */
+
+#include <string.h>
+
+#include "lz4frame.h"
+
+#define LZ4_MAGIC               0x184D2204U
+#define LZ4_SKIP_MAGIC          0x184D2A50U     // skippable frames have magic numbers 0x184D2A50 to 0x184D2A5F
+#define LZ4_SKIP_MASK           0xFFFFFFF0U
+
+#define LZ4_FLG_VERSION         0xC0            // must read as version 01
+#define LZ4_FLG_BLOCK_SUM       0x10
+#define LZ4_FLG_SIZE            0x08
+#define LZ4_FLG_CONTENT_SUM     0x04
+#define LZ4_FLG_RESERVED        0x02
+#define LZ4_FLG_DICT            0x01
+#define LZ4_BD_RESERVED         0x8F
+
+#define LZ4_BLOCK_RAW           0x80000000U     // block size flag: the block is stored uncompressed
+#define LZ4_MIN_MATCH           4
+#define LZ4_WINDOW_MASK         (LZ4_FRAME_WINDOW - 1)
+
+// Decoder states
+#define LZ4_STATE_MAGIC         0               // collecting a frame's magic number
+#define LZ4_STATE_SKIP_SIZE     1               // collecting a skippable frame's size
+#define LZ4_STATE_SKIP          2               // passing over a skippable frame
+#define LZ4_STATE_DESCRIPTOR    3               // collecting the frame descriptor, up to its checksum
+#define LZ4_STATE_BLOCK_SIZE    4               // collecting a block size, or the end mark
+#define LZ4_STATE_RAW           5               // copying an uncompressed block
+#define LZ4_STATE_TOKEN         6               // expecting a sequence's token
+#define LZ4_STATE_LITERAL_LEN   7               // adding up literal length bytes
+#define LZ4_STATE_LITERALS      8               // copying literals
+#define LZ4_STATE_OFFSET        9               // collecting a match offset
+#define LZ4_STATE_MATCH_LEN     10              // adding up match length bytes
+#define LZ4_STATE_BLOCK_SUM     11              // skipping a block checksum
+#define LZ4_STATE_CONTENT_SUM   12              // collecting the content checksum
+#define LZ4_STATE_DONE          13              // the frame is complete
+#define LZ4_STATE_FAILED        14              // something went wrong; stay here
+
+#define XXH_PRIME1              2654435761U
+#define XXH_PRIME2              2246822519U
+#define XXH_PRIME3              3266489917U
+#define XXH_PRIME4              668265263U
+#define XXH_PRIME5              374761393U
+
+// A running xxHash32, seed zero
+typedef struct __LZ4_XXH32 {
+    uint32_t v[4];                  // accumulators, one per lane of a 16-byte stripe
+    uint32_t length;                // bytes hashed so far
+    uint8_t tail[16];               // bytes not yet making up a whole stripe
+    uint8_t tail_size;
+} LZ4_XXH32;
+
+typedef struct __LZ4_Frame {
+    uint8_t state;
+    uint8_t field[16];              // a fixed-size field being collected
+    uint8_t want;                   // its size
+    uint8_t have;                   // bytes collected so far
+    uint8_t flags;                  // the frame's FLG byte
+    uint8_t token;                  // the current sequence's token
+    uint32_t block_max;             // largest block the frame allows
+    uint32_t block_left;            // bytes of the current block still to come
+    uint32_t literals;              // literals still to copy
+    uint32_t match;                 // length of the current match
+    uint16_t offset;                // how far back the current match starts
+    uint32_t skip;                  // bytes of a skippable frame still to pass over
+    uint32_t content_size;          // decompressed size from the header, if the frame gives one
+    uint32_t pos;                   // decompressed bytes so far
+    uint32_t flushed;               // decompressed bytes handed to the write callback
+    LZ4_XXH32 hash;                 // of the decompressed bytes handed on
+} LZ4_Frame;
+
+static const LZ4_Frame_ControlDef *session = NULL;
+static LZ4_Frame lz4;
+static uint8_t window[LZ4_FRAME_WINDOW];
+
+static inline uint32_t lz4_get32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static inline uint32_t xxh_rotl(uint32_t value, uint8_t bits)
+{
+    return (value << bits) | (value >> (32 - bits));
+}
+
+static inline uint32_t xxh_round(uint32_t acc, uint32_t input)
+{
+    return xxh_rotl(acc + input * XXH_PRIME2, 13) * XXH_PRIME1;
+}
+
+static void xxh32_start(LZ4_XXH32 *hash)
+{
+
+    hash->v[0] = XXH_PRIME1 + XXH_PRIME2;
+    hash->v[1] = XXH_PRIME2;
+    hash->v[2] = 0;
+    hash->v[3] = 0 - XXH_PRIME1;
+    hash->length = 0;
+    hash->tail_size = 0;
+
+}
+
+static void xxh32_stripe(LZ4_XXH32 *hash, const uint8_t *data)
+{
+
+    hash->v[0] = xxh_round(hash->v[0], lz4_get32(data));
+    hash->v[1] = xxh_round(hash->v[1], lz4_get32(data + 4));
+    hash->v[2] = xxh_round(hash->v[2], lz4_get32(data + 8));
+    hash->v[3] = xxh_round(hash->v[3], lz4_get32(data + 12));
+
+}
+
+static void xxh32_update(LZ4_XXH32 *hash, const uint8_t *data, uint32_t size)
+{
+
+    uint32_t fill;
+
+    hash->length += size;
+
+    if (hash->tail_size > 0) {
+
+        fill = 16U - hash->tail_size < size ? 16U - hash->tail_size : size;
+        memcpy(hash->tail + hash->tail_size, data, fill);
+        hash->tail_size += fill;
+        data += fill;
+        size -= fill;
+
+        if (hash->tail_size < 16) {
+            return;
+        }
+
+        xxh32_stripe(hash, hash->tail);
+        hash->tail_size = 0;
+
+    }
+
+    for (; size >= 16; data += 16, size -= 16) {
+        xxh32_stripe(hash, data);
+    }
+
+    memcpy(hash->tail, data, size);
+    hash->tail_size = size;
+
+}
+
+static uint32_t xxh32_value(const LZ4_XXH32 *hash)
+{
+
+    const uint8_t *data = hash->tail, *end = hash->tail + hash->tail_size;
+    uint32_t h;
+
+    if (hash->length >= 16) {
+        h = xxh_rotl(hash->v[0], 1) + xxh_rotl(hash->v[1], 7) + xxh_rotl(hash->v[2], 12) + xxh_rotl(hash->v[3], 18);
+    } else {
+        h = XXH_PRIME5;
+    }
+
+    h += hash->length;
+
+    for (; data + 4 <= end; data += 4) {
+        h = xxh_rotl(h + lz4_get32(data) * XXH_PRIME3, 17) * XXH_PRIME4;
+    }
+
+    for (; data < end; data++) {
+        h = xxh_rotl(h + *data * XXH_PRIME5, 11) * XXH_PRIME1;
+    }
+
+    h ^= h >> 15;
+    h *= XXH_PRIME2;
+    h ^= h >> 13;
+    h *= XXH_PRIME3;
+    h ^= h >> 16;
+
+    return h;
+
+}
+
+// Start collecting a fixed-size field
+static void lz4_expect(uint8_t state, uint8_t size)
+{
+
+    lz4.state = state;
+    lz4.want = size;
+    lz4.have = 0;
+
+}
+
+// Take bytes towards the field being collected. Returns true once it is complete.
+static uint8_t lz4_collect(const uint8_t **data, const uint8_t *end)
+{
+
+    uint32_t take = (uint32_t)(end - *data);
+
+    take = take < (uint32_t)(lz4.want - lz4.have) ? take : (uint32_t)(lz4.want - lz4.have);
+    memcpy(lz4.field + lz4.have, *data, take);
+    lz4.have += take;
+    *data += take;
+
+    return lz4.have == lz4.want;
+
+}
+
+// Hand the chunk the ring has been filling to the write callback
+static HAL_StatusTypeDef lz4_flush(void)
+{
+
+    const uint8_t *chunk = window + (lz4.flushed & LZ4_WINDOW_MASK);
+    uint32_t size = lz4.pos - lz4.flushed;
+
+    if (size == 0) {
+        return HAL_OK;
+    }
+
+    xxh32_update(&lz4.hash, chunk, size);
+    lz4.flushed = lz4.pos;
+
+    return session->write(session->cb_data, chunk, size);
+
+}
+
+// Room left in the chunk being filled. Chunks divide the window, so a chunk never wraps around it.
+static inline uint32_t lz4_room(uint32_t size)
+{
+    uint32_t room = LZ4_FRAME_CHUNK - (lz4.pos - lz4.flushed);
+    return size < room ? size : room;
+}
+
+static HAL_StatusTypeDef lz4_literal(const uint8_t *data, uint32_t size)
+{
+
+    uint32_t chunk;
+
+    for (; size > 0; data += chunk, size -= chunk) {
+
+        chunk = lz4_room(size);
+        memcpy(window + (lz4.pos & LZ4_WINDOW_MASK), data, chunk);
+        lz4.pos += chunk;
+
+        if (lz4.pos - lz4.flushed == LZ4_FRAME_CHUNK && lz4_flush() != HAL_OK) {
+            return HAL_ERROR;
+        }
+
+    }
+
+    return HAL_OK;
+
+}
+
+// Copy a match out of the history. It may overlap its own output, which repeats the last <offset> bytes.
+static HAL_StatusTypeDef lz4_copy(uint32_t offset, uint32_t size)
+{
+
+    uint32_t chunk, from, i;
+    uint8_t *to;
+
+    for (; size > 0; size -= chunk) {
+
+        chunk = lz4_room(size);
+        to = window + (lz4.pos & LZ4_WINDOW_MASK);
+        from = (lz4.pos - offset) & LZ4_WINDOW_MASK;
+
+        if (offset >= chunk && from + chunk <= LZ4_FRAME_WINDOW) {
+            memcpy(to, window + from, chunk);
+        } else {
+            for (i = 0; i < chunk; i++) {
+                to[i] = window[from];
+                from = (from + 1) & LZ4_WINDOW_MASK;
+            }
+        }
+
+        lz4.pos += chunk;
+
+        if (lz4.pos - lz4.flushed == LZ4_FRAME_CHUNK && lz4_flush() != HAL_OK) {
+            return HAL_ERROR;
+        }
+
+    }
+
+    return HAL_OK;
+
+}
+
+// The frame descriptor is complete: check it and tell the callback what's coming
+static HAL_StatusTypeDef lz4_descriptor(void)
+{
+
+    uint8_t bd = lz4.field[1];
+    LZ4_XXH32 hash;
+
+    xxh32_start(&hash);
+    xxh32_update(&hash, lz4.field, lz4.want - 1);
+    if (((xxh32_value(&hash) >> 8) & 0xff) != lz4.field[lz4.want - 1]) {
+        return HAL_ERROR;
+    }
+
+    lz4.block_max = 1UL << (8 + 2 * ((bd >> 4) & 7));
+    lz4.content_size = 0;
+
+    if (lz4.flags & LZ4_FLG_SIZE) {
+
+        // A ROM image over 4G isn't happening
+        if (lz4_get32(lz4.field + 6) != 0) {
+            return HAL_ERROR;
+        }
+
+        lz4.content_size = lz4_get32(lz4.field + 2);
+
+    }
+
+    if (session->header != NULL) {
+        return session->header(session->cb_data, lz4.content_size);
+    }
+
+    return HAL_OK;
+
+}
+
+// The last of a sequence's literals is out; a match follows, unless that was the end of the block
+static void lz4_literals_done(void)
+{
+
+    if (lz4.block_left == 0) {
+        lz4_expect(lz4.flags & LZ4_FLG_BLOCK_SUM ? LZ4_STATE_BLOCK_SUM : LZ4_STATE_BLOCK_SIZE, 4);
+    } else if (lz4.block_left < 2) {
+        lz4.state = LZ4_STATE_FAILED;
+    } else {
+        lz4_expect(LZ4_STATE_OFFSET, 2);
+    }
+
+}
+
+// Decompressed data is complete: flush it and check it against the header and checksum
+static HAL_StatusTypeDef lz4_frame_done(void)
+{
+
+    if (lz4_flush() != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    if ((lz4.flags & LZ4_FLG_SIZE) && lz4.pos != lz4.content_size) {
+        return HAL_ERROR;
+    }
+
+    if ((lz4.flags & LZ4_FLG_CONTENT_SUM) && xxh32_value(&lz4.hash) != lz4_get32(lz4.field)) {
+        return HAL_ERROR;
+    }
+
+    lz4.state = LZ4_STATE_DONE;
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Begin decoding a new frame.
+ *
+ * @param   ctrl  the callbacks to hand the frame's size and contents to
+ */
+void lz4_frame_start(const LZ4_Frame_ControlDef *ctrl)
+{
+
+    session = ctrl;
+
+    memset(&lz4, 0, sizeof(lz4));
+    lz4_expect(LZ4_STATE_MAGIC, 4);
+    xxh32_start(&lz4.hash);
+
+}
+
+/**
+ * @brief   Decode the next part of the frame, passing decompressed data to the write callback a chunk at a time.
+ *
+ * @param   data  compressed bytes, following on from the last call
+ * @param   size  number of bytes
+ * @retval  HAL_OK, or HAL_ERROR if the frame is malformed, unsupported, or a callback failed
+ */
+HAL_StatusTypeDef lz4_frame_feed(const uint8_t *data, uint32_t size)
+{
+
+    const uint8_t *end = data + size, *start;
+    uint32_t take, block, magic;
+    uint8_t byte, complete;
+
+    while (data < end && lz4.state != LZ4_STATE_FAILED) {
+
+        switch (lz4.state) {
+
+            case LZ4_STATE_MAGIC:
+                if (!lz4_collect(&data, end)) {
+                    break;
+                }
+                magic = lz4_get32(lz4.field);
+                if (magic == LZ4_MAGIC) {
+                    lz4_expect(LZ4_STATE_DESCRIPTOR, 2);
+                } else if ((magic & LZ4_SKIP_MASK) == LZ4_SKIP_MAGIC) {
+                    lz4_expect(LZ4_STATE_SKIP_SIZE, 4);
+                } else {
+                    lz4.state = LZ4_STATE_FAILED;
+                }
+                break;
+
+            case LZ4_STATE_SKIP_SIZE:
+                if (lz4_collect(&data, end)) {
+                    lz4.skip = lz4_get32(lz4.field);
+                    lz4.state = LZ4_STATE_SKIP;
+                }
+                break;
+
+            case LZ4_STATE_SKIP:
+                take = (uint32_t)(end - data) < lz4.skip ? (uint32_t)(end - data) : lz4.skip;
+                data += take;
+                lz4.skip -= take;
+                if (lz4.skip == 0) {
+                    lz4_expect(LZ4_STATE_MAGIC, 4);
+                }
+                break;
+
+            case LZ4_STATE_DESCRIPTOR:
+                if (!lz4_collect(&data, end)) {
+                    break;
+                }
+                if (lz4.want == 2) {
+                    // FLG and BD say how long the rest of the descriptor is
+                    lz4.flags = lz4.field[0];
+                    if ((lz4.flags & (LZ4_FLG_VERSION | LZ4_FLG_RESERVED | LZ4_FLG_DICT)) != 0x40
+                            || (lz4.field[1] & LZ4_BD_RESERVED) || ((lz4.field[1] >> 4) & 7) < 4) {
+                        lz4.state = LZ4_STATE_FAILED;
+                        break;
+                    }
+                    lz4.want = 2 + (lz4.flags & LZ4_FLG_SIZE ? 8 : 0) + 1;
+                    break;
+                }
+                if (lz4_descriptor() != HAL_OK) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                lz4_expect(LZ4_STATE_BLOCK_SIZE, 4);
+                break;
+
+            case LZ4_STATE_BLOCK_SIZE:
+                if (!lz4_collect(&data, end)) {
+                    break;
+                }
+                block = lz4_get32(lz4.field);
+                lz4.block_left = block & ~LZ4_BLOCK_RAW;
+                if (block == 0) {
+                    // The end mark
+                    if (lz4.flags & LZ4_FLG_CONTENT_SUM) {
+                        lz4_expect(LZ4_STATE_CONTENT_SUM, 4);
+                    } else if (lz4_frame_done() != HAL_OK) {
+                        lz4.state = LZ4_STATE_FAILED;
+                    }
+                } else if (lz4.block_left == 0 || lz4.block_left > lz4.block_max) {
+                    lz4.state = LZ4_STATE_FAILED;
+                } else {
+                    lz4.state = block & LZ4_BLOCK_RAW ? LZ4_STATE_RAW : LZ4_STATE_TOKEN;
+                }
+                break;
+
+            case LZ4_STATE_RAW:
+                take = (uint32_t)(end - data) < lz4.block_left ? (uint32_t)(end - data) : lz4.block_left;
+                if (lz4_literal(data, take) != HAL_OK) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                data += take;
+                lz4.block_left -= take;
+                if (lz4.block_left == 0) {
+                    lz4_expect(lz4.flags & LZ4_FLG_BLOCK_SUM ? LZ4_STATE_BLOCK_SUM : LZ4_STATE_BLOCK_SIZE, 4);
+                }
+                break;
+
+            case LZ4_STATE_TOKEN:
+                lz4.token = *data++;
+                lz4.block_left--;
+                lz4.literals = lz4.token >> 4;
+                lz4.match = lz4.token & 0x0f;
+                if (lz4.literals == 15) {
+                    lz4.state = LZ4_STATE_LITERAL_LEN;
+                } else if (lz4.literals > lz4.block_left) {
+                    lz4.state = LZ4_STATE_FAILED;
+                } else if (lz4.literals > 0) {
+                    lz4.state = LZ4_STATE_LITERALS;
+                } else {
+                    lz4_literals_done();
+                }
+                break;
+
+            case LZ4_STATE_LITERAL_LEN:
+                if (lz4.block_left == 0) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                byte = *data++;
+                lz4.block_left--;
+                lz4.literals += byte;
+                if (byte != 255) {
+                    lz4.state = lz4.literals > lz4.block_left ? LZ4_STATE_FAILED : LZ4_STATE_LITERALS;
+                }
+                break;
+
+            case LZ4_STATE_LITERALS:
+                take = (uint32_t)(end - data) < lz4.literals ? (uint32_t)(end - data) : lz4.literals;
+                if (lz4_literal(data, take) != HAL_OK) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                data += take;
+                lz4.literals -= take;
+                lz4.block_left -= take;
+                if (lz4.literals == 0) {
+                    lz4_literals_done();
+                }
+                break;
+
+            case LZ4_STATE_OFFSET:
+                start = data;
+                complete = lz4_collect(&data, end);
+                lz4.block_left -= (uint32_t)(data - start);
+                if (!complete) {
+                    break;
+                }
+                // An offset can't reach back before the start of the data
+                lz4.offset = (uint16_t)(lz4.field[0] | (lz4.field[1] << 8));
+                if (lz4.offset == 0 || lz4.offset > lz4.pos) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                lz4.match += LZ4_MIN_MATCH;
+                if ((lz4.token & 0x0f) == 15) {
+                    lz4.state = LZ4_STATE_MATCH_LEN;
+                    break;
+                }
+                // A block always ends with literals, so there's more to come after the match
+                if (lz4_copy(lz4.offset, lz4.match) != HAL_OK || lz4.block_left == 0) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                lz4.state = LZ4_STATE_TOKEN;
+                break;
+
+            case LZ4_STATE_MATCH_LEN:
+                if (lz4.block_left == 0) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                byte = *data++;
+                lz4.block_left--;
+                lz4.match += byte;
+                if (byte == 255) {
+                    break;
+                }
+                if (lz4_copy(lz4.offset, lz4.match) != HAL_OK || lz4.block_left == 0) {
+                    lz4.state = LZ4_STATE_FAILED;
+                    break;
+                }
+                lz4.state = LZ4_STATE_TOKEN;
+                break;
+
+            case LZ4_STATE_BLOCK_SUM:
+                if (lz4_collect(&data, end)) {
+                    lz4_expect(LZ4_STATE_BLOCK_SIZE, 4);
+                }
+                break;
+
+            case LZ4_STATE_CONTENT_SUM:
+                if (lz4_collect(&data, end) && lz4_frame_done() != HAL_OK) {
+                    lz4.state = LZ4_STATE_FAILED;
+                }
+                break;
+
+            case LZ4_STATE_DONE:
+                // Trailing bytes, like the padding of a last YMODEM packet
+                data = end;
+                break;
+
+            default:
+                lz4.state = LZ4_STATE_FAILED;
+                break;
+
+        }
+
+    }
+
+    return lz4.state == LZ4_STATE_FAILED ? HAL_ERROR : HAL_OK;
+
+}
+
+/**
+ * @brief   Check that the whole frame arrived.
+ *
+ * @retval  HAL_OK if the frame was decoded to its end and passed its checksums, HAL_ERROR otherwise
+ */
+HAL_StatusTypeDef lz4_frame_finish(void)
+{
+
+    return lz4.state == LZ4_STATE_DONE ? HAL_OK : HAL_ERROR;
+
+}
@@ -0,0 +1,250 @@
+/**
+ * The ROM writer decouples receiving an image from programming it.
+ *
+ * Uploads arrive one YMODEM packet at a time, and every packet must be ACKed before the sender will transmit the
+ * next. Programming the packet before ACKing it means the UART sits idle while the ROM is busy, and the ROM sits
+ * idle while the UART is busy. Instead, each packet is copied into one of two 1K slots and handed to a writer
+ * thread, and the packet is ACKed straight away. While the writer thread erases and programs one slot, the next
+ * packet is received into the other. The total upload time becomes the slower of the two stages rather than the
+ * sum of both.
+ *
+ * The writer thread runs at a higher priority than the CLI thread. It spends nearly all of its time blocked on
+ * DMA completions and busy-waits, so the CLI thread gets the CPU whenever the ROM is working.
+ *
+ * Work that doesn't depend on the data, like erasing, can run ahead of it: after rom_writer_prepare() the writer
+ * calls the session's prepare callback one step at a time whenever no slot is waiting, until the callback reports
+ * it has nothing left to do. Slots always take priority, so preparation only fills time the writer would otherwise
+ * spend waiting on the UART.
+ *
+ * A programming failure is sticky: the writer discards everything queued after it, and every later submission,
+ * rom_writer_status() and the final rom_writer_finish() report the failure. A submission that reuses a slot waits
+ * for that slot's data to be programmed, so it always sees how the slot before it went.
+ */
+
+#include <string.h>
+
+#include "cmsis_os.h"
+
+#include "romwriter.h"
+
+typedef struct __ROM_Writer_Slot {
+    uint32_t address;
+    uint16_t size;
+    uint8_t data[ROM_WRITER_SLOT_SIZE];
+} ROM_Writer_Slot;
+
+#define ROM_WRITER_PREPARE      0xfe        // pending token: start calling the prepare callback
+#define ROM_WRITER_STOP         0xff        // pending token: stop calling it, and acknowledge
+
+static ROM_Writer_Slot slots[ROM_WRITER_SLOTS];
+
+static osMessageQueueId_t pending = NULL;          // slot numbers waiting to be programmed, or a token
+static osMessageQueueId_t vacant = NULL;           // slot numbers free to be filled
+static osSemaphoreId_t stopped = NULL;            // released when the writer takes a stop token
+static osThreadId_t writer = NULL;
+
+static const ROM_Writer_ControlDef *session = NULL;
+static volatile HAL_StatusTypeDef status = HAL_OK;
+
+static void rom_writer_thread(void *argument)
+{
+
+    HAL_StatusTypeDef result;
+    uint8_t slot, preparing = 0;
+
+    UNUSED(argument);
+
+    while (1) {
+
+        if (osMessageQueueGet(pending, &slot, NULL, preparing ? 0 : osWaitForever) != osOK) {
+
+            // Nothing to program, so get ahead
+            result = HAL_OK;
+            if (status == HAL_OK && session != NULL && session->prepare != NULL) {
+                result = session->prepare(session->cb_data);
+            }
+
+            if (result != HAL_BUSY) {
+                preparing = 0;
+                if (result != HAL_OK) {
+                    status = result;
+                }
+            }
+
+            continue;
+
+        }
+
+        if (slot == ROM_WRITER_PREPARE) {
+            preparing = 1;
+            continue;
+        }
+
+        if (slot == ROM_WRITER_STOP) {
+            preparing = 0;
+            osSemaphoreRelease(stopped);
+            continue;
+        }
+
+        // Once anything has failed, the rest of the session is drained without touching the ROM
+        if (status == HAL_OK && session != NULL) {
+            status = session->program(session->cb_data, slots[slot].address, slots[slot].data, slots[slot].size);
+        }
+
+        osMessageQueuePut(vacant, &slot, 0, 0);
+
+    }
+
+}
+
+/**
+ * @brief   Create the writer thread and its slot queues.
+ *
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef rom_writer_init(void)
+{
+
+    const osThreadAttr_t writer_attributes = {
+        .name = "writer",
+        .priority = (osPriority_t) osPriorityHigh1,
+        .stack_size = 1536
+    };
+    uint8_t slot;
+
+    if (writer != NULL) {
+        return HAL_OK;
+    }
+
+    // Room for every slot plus one token
+    pending = osMessageQueueNew(ROM_WRITER_SLOTS + 1, sizeof(uint8_t), NULL);
+    vacant = osMessageQueueNew(ROM_WRITER_SLOTS, sizeof(uint8_t), NULL);
+    stopped = osSemaphoreNew(1, 0, NULL);
+
+    if (pending == NULL || vacant == NULL || stopped == NULL) {
+        return HAL_ERROR;
+    }
+
+    for (slot = 0; slot < ROM_WRITER_SLOTS; slot++) {
+        osMessageQueuePut(vacant, &slot, 0, 0);
+    }
+
+    writer = osThreadNew(rom_writer_thread, NULL, &writer_attributes);
+
+    return writer != NULL ? HAL_OK : HAL_ERROR;
+
+}
+
+/**
+ * @brief   Begin a programming session.
+ *
+ * @param   ctrl  the callbacks to run for each submitted slot and ahead of them; must remain valid until finished
+ */
+void rom_writer_start(const ROM_Writer_ControlDef *ctrl)
+{
+
+    session = ctrl;
+    status = HAL_OK;
+
+}
+
+/**
+ * @brief   Start running the session's prepare callback while the writer is idle.
+ *
+ * Call this once the callback has something to do, such as when an erase plan is ready.
+ */
+void rom_writer_prepare(void)
+{
+
+    uint8_t token = ROM_WRITER_PREPARE;
+
+    osMessageQueuePut(pending, &token, 0, osWaitForever);
+
+}
+
+/**
+ * @brief   Queue data for programming.
+ *
+ * The data is copied, so the caller's buffer may be reused as soon as this returns.
+ *
+ * @param   address  the ROM address the data belongs at
+ * @param   data     the data to program
+ * @param   size     the size of the data, at most ROM_WRITER_SLOT_SIZE bytes
+ * @retval  HAL status: HAL_OK if queued, otherwise the error that stopped the session
+ */
+HAL_StatusTypeDef rom_writer_submit(uint32_t address, const uint8_t *data, uint16_t size)
+{
+
+    uint8_t slot;
+
+    if (size > ROM_WRITER_SLOT_SIZE) {
+        return HAL_ERROR;
+    }
+
+    // Wait for a free slot. The writer only holds a slot for as long as the program callback runs, and every
+    // callback is bounded by ROM timeouts, so this cannot wait forever.
+    if (osMessageQueueGet(vacant, &slot, NULL, osWaitForever) != osOK) {
+        return HAL_ERROR;
+    }
+
+    if (status != HAL_OK) {
+        osMessageQueuePut(vacant, &slot, 0, 0);
+        return status;
+    }
+
+    slots[slot].address = address;
+    slots[slot].size = size;
+    if (size > 0) {
+        memcpy(slots[slot].data, data, size);
+    }
+
+    osMessageQueuePut(pending, &slot, 0, osWaitForever);
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Check the session without waiting for the writer.
+ *
+ * Data still queued hasn't been programmed yet, so HAL_OK only covers what the writer has finished so far.
+ *
+ * @retval  HAL status of the session so far
+ */
+HAL_StatusTypeDef rom_writer_status(void)
+{
+
+    return status;
+
+}
+
+/**
+ * @brief   Wait for the writer to drain.
+ *
+ * Preparation stops too, so the ROM is left idle. The session stays open, so a YMODEM batch can finish each file
+ * in turn and keep submitting.
+ *
+ * @retval  HAL status of the whole session
+ */
+HAL_StatusTypeDef rom_writer_finish(void)
+{
+
+    uint8_t held[ROM_WRITER_SLOTS];
+    uint8_t count, token = ROM_WRITER_STOP;
+
+    // All slots vacant means nothing is queued and nothing is being programmed
+    for (count = 0; count < ROM_WRITER_SLOTS; count++) {
+        osMessageQueueGet(vacant, &held[count], NULL, osWaitForever);
+    }
+
+    // The writer only takes the token between prepare steps, so once it's acknowledged the ROM is idle
+    osMessageQueuePut(pending, &token, 0, osWaitForever);
+    osSemaphoreAcquire(stopped, osWaitForever);
+
+    for (count = 0; count < ROM_WRITER_SLOTS; count++) {
+        osMessageQueuePut(vacant, &held[count], 0, 0);
+    }
+
+    return status;
+
+}
@@ -0,0 +1,191 @@
+/**
+ * A binary request/response protocol, so a host script can drive the programmer without screen-scraping the menu.
+ *
+ * Each message is COBS encoded and ends with a zero byte; hosts also send one before each request, which switches
+ * the menu into this mode and flushes out any partial frame. Decoded, all values little-endian:
+ *
+ *      request     id (2)  op (1)  arguments...            CRC-16 (2)
+ *      response    id (2)  op (1)  status (1)  results...  CRC-16 (2)
+ *
+ * The CRC is the XMODEM CRC-16 of the bytes before it. The id is the host's own, echoed back so it can match
+ * responses to requests. Responses come back in the order the requests were sent, so a host may send more before
+ * the first is answered, up to RPC_WINDOW encoded bytes unanswered - whatever waits in the receive buffer is there
+ * the moment the device is ready for it. A damaged frame is dropped without a response; the host sees the next
+ * response skip its id.
+ */
+
+#include "rpc.h"
+#include "crc16.h"
+
+#define RPC_REQUEST_HEADER      3
+#define RPC_RESPONSE_HEADER     4
+#define RPC_CRC_SIZE            2
+#define RPC_MAX_ARGS            (RPC_MAX_DATA + 8)  // room for a target and address besides the data
+
+#define RPC_FRAME_SIZE          (RPC_RESPONSE_HEADER + RPC_MAX_ARGS + RPC_CRC_SIZE)
+#define RPC_ENCODED_SIZE        (1 + RPC_FRAME_SIZE + RPC_FRAME_SIZE / 254 + 1 + 1)
+
+// Receiving COBS: each code byte gives the distance to the next, with a zero in between unless the code was 0xFF
+typedef struct __RPC_Decoder {
+    uint16_t length;                // bytes decoded so far
+    uint8_t code;                   // code byte of the current block
+    uint8_t left;                   // bytes of the current block still to come
+    uint8_t overflow;               // true if the frame is too big, and is being skipped
+} RPC_Decoder;
+
+static const RPC_ControlDef *session = NULL;
+static RPC_Decoder decoder;
+static uint8_t request[RPC_FRAME_SIZE];
+static uint8_t response[RPC_FRAME_SIZE];
+static uint8_t encoded[RPC_ENCODED_SIZE];
+
+static void rpc_reset(void)
+{
+
+    decoder.length = 0;
+    decoder.code = 0xff;            // no zero before the first block
+    decoder.left = 0;
+    decoder.overflow = 0;
+
+}
+
+static void rpc_append(uint8_t byte)
+{
+
+    if (decoder.length == sizeof(request)) {
+        decoder.overflow = 1;
+        return;
+    }
+
+    request[decoder.length++] = byte;
+
+}
+
+// COBS encode a frame between zero delimiters, returning the encoded size
+static uint16_t rpc_encode(const uint8_t *data, uint16_t size, uint8_t *out)
+{
+
+    uint16_t code_at = 1, length = 2, i;
+    uint8_t code = 1;
+
+    out[0] = 0;
+
+    for (i = 0; i < size; i++) {
+
+        if (data[i] != 0) {
+            out[length++] = data[i];
+            code++;
+        }
+
+        if (data[i] == 0 || code == 0xff) {
+            out[code_at] = code;
+            code_at = length++;
+            code = 1;
+        }
+
+    }
+
+    out[code_at] = code;
+    out[length++] = 0;
+
+    return length;
+
+}
+
+// Answer a complete frame. Returns true if it asked to exit.
+static uint8_t rpc_frame(void)
+{
+
+    uint16_t length = decoder.length, size = 0, crc;
+    uint8_t status;
+
+    if (length < RPC_REQUEST_HEADER + RPC_CRC_SIZE) {
+        return 0;
+    }
+
+    crc = crc16_xmodem(0, request, length - RPC_CRC_SIZE);
+    if ((request[length - 2] | (request[length - 1] << 8)) != crc) {
+        return 0;
+    }
+
+    length -= RPC_REQUEST_HEADER + RPC_CRC_SIZE;
+
+    if (request[2] == RPC_OP_EXIT) {
+        status = length == 0 ? RPC_OK : RPC_BAD_REQUEST;
+    } else {
+        status = session->request(session->cb_data, request[2], &request[RPC_REQUEST_HEADER], length,
+                                  &response[RPC_RESPONSE_HEADER], &size);
+    }
+
+    if (status != RPC_OK) {
+        size = 0;
+    }
+
+    response[0] = request[0];
+    response[1] = request[1];
+    response[2] = request[2];
+    response[3] = status;
+    size += RPC_RESPONSE_HEADER;
+
+    crc = crc16_xmodem(0, response, size);
+    response[size++] = crc & 0xff;
+    response[size++] = crc >> 8;
+
+    HAL_UART_Transmit(session->huart, encoded, rpc_encode(response, size, encoded), HAL_MAX_DELAY);
+
+    return request[2] == RPC_OP_EXIT && status == RPC_OK;
+
+}
+
+/**
+ * @brief   Answer requests until the host exits, or nothing arrives for RPC_IDLE_MS.
+ *
+ * The menu drops back into this as soon as it sees a zero byte, so a host that starts every request with one
+ * needn't track which mode the device is in.
+ *
+ * @param   ctrl  the UART and the callback to carry out requests
+ * @retval  RPC_EXIT or RPC_IDLE
+ */
+uint8_t rpc_serve(const RPC_ControlDef *ctrl)
+{
+
+    static uint8_t data[64];
+    uint16_t count, i;
+    uint8_t byte;
+
+    session = ctrl;
+    rpc_reset();
+
+    while ((count = uart_rx_read_some(data, sizeof(data), RPC_IDLE_MS)) > 0) {
+
+        for (i = 0; i < count; i++) {
+
+            byte = data[i];
+
+            if (byte == 0) {
+                if (!decoder.overflow && decoder.left == 0 && rpc_frame()) {
+                    return RPC_EXIT;
+                }
+                rpc_reset();
+                continue;
+            }
+
+            if (decoder.left == 0) {
+                if (decoder.code != 0xff) {
+                    rpc_append(0);
+                }
+                decoder.code = byte;
+                decoder.left = byte - 1;
+                continue;
+            }
+
+            rpc_append(byte);
+            decoder.left--;
+
+        }
+
+    }
+
+    return RPC_IDLE;
+
+}
@@ -0,0 +1,238 @@
+/**
+ * A sparse image describes just the parts of a ROM worth writing, so the holes between them cost no transfer,
+ * erase, or programming time. All values are little-endian:
+ *
+ *      magic       4 bytes     "ROMS"
+ *      version     2 bytes     1
+ *      count       2 bytes     number of chunks, at most SPARSE_MAX_CHUNKS
+ *      chunks      count x 12  address, length, type: in ascending address order, not overlapping
+ *      data        ...         the bytes of each SPARSE_DATA chunk, in table order
+ *
+ * The table comes first so the whole erase can be planned before the data arrives. Fill chunks reach the write
+ * callback as 0xFF, which the ROM code recognises as already erased and doesn't program. Don't-care chunks are
+ * only there to document the image; they and any holes between chunks are passed over.
+ *
+ * tools/mksparse.py builds an image from a binary.
+ */
+
+#include <string.h>
+
+#include "sparse.h"
+
+#define SPARSE_HEADER_SIZE      8
+#define SPARSE_ENTRY_SIZE       12
+#define SPARSE_FILL_CHUNK       1024
+
+// Parser states
+#define SPARSE_STATE_HEADER     0           // collecting the header
+#define SPARSE_STATE_TABLE      1           // collecting chunk table entries
+#define SPARSE_STATE_DATA       2           // passing on a data chunk's bytes
+#define SPARSE_STATE_DONE       3           // every chunk has been passed on
+#define SPARSE_STATE_FAILED     4           // something went wrong; stay here
+
+typedef struct __Sparse_Image {
+    uint8_t state;
+    uint8_t field[SPARSE_ENTRY_SIZE];       // a header or table entry being collected
+    uint8_t have;                           // bytes of it collected so far
+    uint16_t count;                         // chunks in the table
+    uint16_t chunk;                         // the chunk being collected or passed on
+    uint32_t left;                          // bytes of the current data chunk still to come
+} Sparse_Image;
+
+static const Sparse_ControlDef *session = NULL;
+static Sparse_Image sparse;
+static Sparse_ChunkDef chunks[SPARSE_MAX_CHUNKS];
+
+static const uint8_t blank[SPARSE_FILL_CHUNK] = { [0 ... SPARSE_FILL_CHUNK - 1] = 0xff };
+
+static inline uint32_t sparse_get32(const uint8_t *data)
+{
+    return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+// Take bytes towards the header or table entry being collected. Returns true once it is complete.
+static uint8_t sparse_collect(const uint8_t **data, const uint8_t *end, uint8_t want)
+{
+
+    uint32_t take = (uint32_t)(end - *data);
+
+    take = take < (uint32_t)(want - sparse.have) ? take : (uint32_t)(want - sparse.have);
+    memcpy(sparse.field + sparse.have, *data, take);
+    sparse.have += take;
+    *data += take;
+
+    return sparse.have == want;
+
+}
+
+// Move on through the table to the next data chunk, passing fill chunks on as they go by
+static HAL_StatusTypeDef sparse_next(void)
+{
+
+    const Sparse_ChunkDef *chunk;
+    uint32_t left, size;
+
+    for (; sparse.chunk < sparse.count; sparse.chunk++) {
+
+        chunk = &chunks[sparse.chunk];
+
+        if (chunk->type == SPARSE_DONT_CARE) {
+            continue;
+        }
+
+        if (session->seek(session->cb_data, chunk->address) != HAL_OK) {
+            return HAL_ERROR;
+        }
+
+        if (chunk->type == SPARSE_DATA) {
+            sparse.left = chunk->length;
+            sparse.state = SPARSE_STATE_DATA;
+            return HAL_OK;
+        }
+
+        for (left = chunk->length; left > 0; left -= size) {
+            size = left < SPARSE_FILL_CHUNK ? left : SPARSE_FILL_CHUNK;
+            if (session->write(session->cb_data, blank, size) != HAL_OK) {
+                return HAL_ERROR;
+            }
+        }
+
+    }
+
+    sparse.state = SPARSE_STATE_DONE;
+
+    return HAL_OK;
+
+}
+
+// A table entry is complete: check it follows on from the last
+static HAL_StatusTypeDef sparse_entry(void)
+{
+
+    Sparse_ChunkDef *chunk = &chunks[sparse.chunk];
+
+    chunk->address = sparse_get32(sparse.field);
+    chunk->length = sparse_get32(sparse.field + 4);
+    chunk->type = sparse_get32(sparse.field + 8);
+
+    if (chunk->type > SPARSE_DONT_CARE || chunk->length == 0 || chunk->address + chunk->length < chunk->address) {
+        return HAL_ERROR;
+    }
+
+    if (sparse.chunk > 0 && chunk->address < chunks[sparse.chunk - 1].address + chunks[sparse.chunk - 1].length) {
+        return HAL_ERROR;
+    }
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Begin parsing a new image.
+ *
+ * @param   ctrl  the callbacks to hand the image's table and contents to
+ */
+void sparse_start(const Sparse_ControlDef *ctrl)
+{
+
+    session = ctrl;
+
+    memset(&sparse, 0, sizeof(sparse));
+    sparse.state = SPARSE_STATE_HEADER;
+
+}
+
+/**
+ * @brief   Parse the next part of the image, passing its data to the write callback.
+ *
+ * @param   data  image bytes, following on from the last call
+ * @param   size  number of bytes
+ * @retval  HAL_OK, or HAL_ERROR if the image is malformed or a callback failed
+ */
+HAL_StatusTypeDef sparse_feed(const uint8_t *data, uint32_t size)
+{
+
+    const uint8_t *end = data + size;
+    uint32_t take;
+
+    while (data < end && sparse.state != SPARSE_STATE_FAILED) {
+
+        switch (sparse.state) {
+
+            case SPARSE_STATE_HEADER:
+                if (!sparse_collect(&data, end, SPARSE_HEADER_SIZE)) {
+                    break;
+                }
+                sparse.count = sparse.field[6] | (sparse.field[7] << 8);
+                if (sparse_get32(sparse.field) != SPARSE_MAGIC
+                        || (sparse.field[4] | (sparse.field[5] << 8)) != SPARSE_VERSION
+                        || sparse.count == 0 || sparse.count > SPARSE_MAX_CHUNKS) {
+                    sparse.state = SPARSE_STATE_FAILED;
+                    break;
+                }
+                sparse.have = 0;
+                sparse.state = SPARSE_STATE_TABLE;
+                break;
+
+            case SPARSE_STATE_TABLE:
+                if (!sparse_collect(&data, end, SPARSE_ENTRY_SIZE)) {
+                    break;
+                }
+                if (sparse_entry() != HAL_OK) {
+                    sparse.state = SPARSE_STATE_FAILED;
+                    break;
+                }
+                sparse.have = 0;
+                if (++sparse.chunk < sparse.count) {
+                    break;
+                }
+                sparse.chunk = 0;
+                if (session->table(session->cb_data, chunks, sparse.count) != HAL_OK || sparse_next() != HAL_OK) {
+                    sparse.state = SPARSE_STATE_FAILED;
+                }
+                break;
+
+            case SPARSE_STATE_DATA:
+                take = (uint32_t)(end - data) < sparse.left ? (uint32_t)(end - data) : sparse.left;
+                if (session->write(session->cb_data, data, take) != HAL_OK) {
+                    sparse.state = SPARSE_STATE_FAILED;
+                    break;
+                }
+                data += take;
+                sparse.left -= take;
+                if (sparse.left == 0) {
+                    sparse.chunk++;
+                    if (sparse_next() != HAL_OK) {
+                        sparse.state = SPARSE_STATE_FAILED;
+                    }
+                }
+                break;
+
+            case SPARSE_STATE_DONE:
+                // Trailing bytes, like the padding of a last YMODEM packet
+                data = end;
+                break;
+
+            default:
+                sparse.state = SPARSE_STATE_FAILED;
+                break;
+
+        }
+
+    }
+
+    return sparse.state == SPARSE_STATE_FAILED ? HAL_ERROR : HAL_OK;
+
+}
+
+/**
+ * @brief   Check that the whole image arrived.
+ *
+ * @retval  HAL_OK if every chunk was passed on, HAL_ERROR otherwise
+ */
+HAL_StatusTypeDef sparse_finish(void)
+{
+
+    return sparse.state == SPARSE_STATE_DONE ? HAL_OK : HAL_ERROR;
+
+}
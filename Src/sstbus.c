@@ -0,0 +1,45 @@
+/**
+ * The SST39LF020 bus is bit-banged on three GPIO ports. Going through HAL_GPIO_Init() and HAL_GPIO_WritePin() for
+ * every bus cycle costs microseconds per byte, more than the chip's own 20us byte program time. The cycles in
+ * sstbus.h instead drive the control lines with constant BSRR words, and flip the data bus direction with a single
+ * store to GPIOC->MODER.
+ *
+ * The rest of port C (the /CE line, the user button, SPI3) keeps whatever mode it was given at boot. The two MODER
+ * words are captured from the live register at the start of each ROM operation, so only the data bus bits change.
+ */
+
+#include "sstbus.h"
+
+uint32_t sst_bus_moder_input = 0;
+uint32_t sst_bus_moder_output = SST_BUS_DATA_MODER_OUTPUT;
+
+/**
+ * @brief   Prepare the bus for a run of cycles.
+ *
+ * The ROM is deselected first, so it has released the data bus well before the bus is ever driven.
+ */
+void sst_bus_begin(void)
+{
+
+    GPIOC->BSRR = SST_BUS_CE_HIGH;
+    GPIOA->BSRR = SST_BUS_OE_HIGH | SST_BUS_WE_HIGH;
+
+    sst_bus_moder_input = GPIOC->MODER & ~SST_BUS_DATA_MODER_MASK;
+    sst_bus_moder_output = sst_bus_moder_input | SST_BUS_DATA_MODER_OUTPUT;
+
+    sst_bus_input();
+
+}
+
+/**
+ * @brief   Return the bus to its idle state: ROM deselected, data bus input.
+ */
+void sst_bus_end(void)
+{
+
+    GPIOC->BSRR = SST_BUS_CE_HIGH;
+    GPIOA->BSRR = SST_BUS_OE_HIGH | SST_BUS_WE_HIGH;
+
+    sst_bus_input();
+
+}
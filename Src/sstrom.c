@@ -1,117 +1,79 @@
+/**
+ * The SST39LF020 is a 256KiB parallel Flash ROM with 4KiB sectors. Its address, data and control lines are wired
+ * straight to GPIO pins (see pins.md); the bus cycles themselves live in sstbus.h.
+ *
+ * Commands are written as a software data protection sequence: 0xAA to 0x5555, 0x55 to 0x2AAA, then the command
+ * byte to 0x5555. An operation is complete when DQ6 stops toggling and DQ7 shows true data. Time limits come from
+ * the datasheet maxima with a 2x margin, measured on the DWT cycle counter.
+ *
+ * A chip that never starts an operation - missing, unpowered, or write protected - is caught straight away: an
+ * erase must show DQ6 toggling on the first poll, and every programmed byte is read back.
+ *
+ * Bulk reads don't need the CPU at all. With /CE and /OE held low the ROM is just a combinational lookup, so a
+ * timer paces two DMA streams: on each update event one stream stores the next low-address BSRR word (straight
+ * from the generated table in flash) to port B, and on each compare event, part way through the period, the other
+ * samples the data bus from GPIOC->IDR into memory. The low half of the address covers 512 bytes; at the end of
+ * each block the completion interrupt sets the high half and starts the next. Only DMA2 can reach the GPIO ports.
+ */
+
 #include "cmsis_os.h"
 
 #include "main.h"
 #include "sstrom.h"
+#include "sstbus.h"
+#include "timing.h"
 
-#define SST_COMMAND_WRITE   0xA0        // write one byte
-#define SST_COMMAND_ERASE   0x80        // sector/chip erase
-#define SST_COMMAND_IDMODE  0x90        // access software ID
-#define SST_COMMAND_EXIT    0xF0        // exit software ID mode
+#define SST_PROGRAM_MAX_US          40          // 2x T(BP)
+#define SST_SECTOR_ERASE_MAX_US     50000       // 2x T(SE)
+#define SST_CHIP_ERASE_MAX_US       200000      // 2x T(SCE)
 
-// data is written directly to PORTC bits 0..7
-static inline void sst_set_data(uint8_t data) {
-    *((volatile uint8_t *)&GPIOC->ODR) = data;
-}
+#define SST_READ_CYCLE_NS           400         // DMA read period; generous, as DMA request latency varies
+#define SST_READ_SAMPLE_NS          300         // when in the period the data bus is sampled
+#define SST_READ_BLOCK              (1 << SST_ADDRESS_SPLIT)
 
-static inline uint8_t sst_get_data() {
-    return *((volatile uint8_t *)&GPIOC->IDR);
-}
+#ifndef SST_ADDRESS_LO_GPIO
+#error "DMA reads need the low address lines on a single port - see tools/sstaddr.py"
+#endif
 
-uint32_t bpins = 0;
+static TIM_HandleTypeDef *sst_read_tim = NULL;
+static osSemaphoreId_t sst_read_done = NULL;
 
-// address lines are all over the joint
-static inline void sst_set_address(uint32_t address)
-{
-
-    uint32_t bsrr;
-
-    // port A: A9=pa7, A10=pa10, A11=pa9, A17=pa1
-    bsrr = ((address & (1<<9)) >> 2)
-         | (address & (1<<10))
-         | ((address & (1<<11)) >> 2)
-         | ((address & (1<<17)) >> 16);
-    bsrr |= (~bsrr & 0b0000011010000010) << 16;
-    GPIOA->BSRR = bsrr;
-
-    // port B: A0=0, A1=1, A2=2, A3=4, A4=5, A5=6, A6=7, A7=8, A8=13, A12=9, A13=14, A14=15, A15=10, A16=12
-    bsrr = (address & 0b111)                        // A0, A1, A2
-         | ((address & 0b110000011111000) << 1)     // A3-A7, A13, A14
-         | ((address & (1<<8)) << 5)                // A8
-         | ((address & (1<<12)) >> 3)               // A12
-         | ((address & (1<<15)) >> 5)               // A15
-         | ((address & (1<<16)) >> 4);              // A16
-    bsrr |= (~bsrr & 0b1111011111110111) << 16;
-    GPIOB->BSRR = bsrr;
-    bpins = bsrr;
-
-}
+// The transfer in progress, advanced block by block from the completion interrupt
+static volatile uint32_t sst_read_address;
+static uint8_t * volatile sst_read_data;
+static volatile uint32_t sst_read_remaining;
+static volatile HAL_StatusTypeDef sst_read_status;
+static uint32_t sst_read_size;
+static uint8_t sst_read_active = 0;
 
 /**
- * Perform a write cycle.
- * 
- * The SST39LF020's timing constraints are:
- *  T(AS) - address setup time          0ns
- *  T(AH) - address hold time           30ns
- *  T(CS) - /WE, /CS setup time         0ns
- *  T(CH) - /WE, /CS hold time          0ns
- *  T(CP) - /CE pulse width             40ns
- *  T(WP) - /WE pulse width             40ns
- *  T(CPH) - /CE pulse width high       30ns
- *  T(WPH) - /WE pulse width high       30ns
- * 
- * Write, erase, and software ID modes require a command sequence to be written to the memory.
- * 
- * After address lines are set, no time is required before /WE and /CE are brought low. It doesn't matter which of
- * those two is changed first, there's no required delay between them and the memory understands both /CE and /WE
- * controlled write cycles. Data lines must be set 40ns before /WE or /CE rises, and the control lines must be low
- * for 40ns. Between each write, the control lines must stay high for 30ns.
- * 
- * Set address, set data, lower /CE, lower /WE, wait 40ns or longer, raise /WE, raise /CE, wait 30ns or longer.
+ * Wait for a program or erase to complete. Programs take microseconds, so they spin; erases take milliseconds, so
+ * they yield for a tick between polls.
  */
-static inline void sst_write(uint32_t address, uint8_t data)
+static HAL_StatusTypeDef sst_rom_wait(uint32_t address, uint8_t data, uint32_t max_us, uint8_t yield)
 {
 
-    sst_set_address(address);
-    sst_set_data(data);
-
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_WE_Pin, GPIO_PIN_RESET);
+    uint32_t start = timing_cycles();
+    uint8_t expired;
 
-    // 40ns is not very long. The STM32F411 runs at 100MHz, so each clock cycle is 10ns. Four NOPs guarantees a minimum
-    // of 40ns delay, even if HAL_GPIO_WritePin optimises away to just a register write.
-    __NOP();
-    __NOP();
-    __NOP();
-    __NOP();
+    while (1) {
 
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_WE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_SET);
+        // Checked before polling, so being preempted past the limit still gets one last look at the chip
+        expired = timing_elapsed_us(start) > max_us;
 
-}
-
-static inline uint8_t sst_read(uint32_t address)
-{
-
-    uint8_t data;
-
-    sst_set_address(address);
-
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_RESET);
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_OE_Pin, GPIO_PIN_RESET);
-
-    __NOP();
-    __NOP();
-    __NOP();
-    __NOP();
-    __NOP();
-    __NOP();
+        if (sst_bus_poll(address, data) == 0) {
+            return HAL_OK;
+        }
 
-    data = sst_get_data();
+        if (expired) {
+            return HAL_TIMEOUT;
+        }
 
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_OE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_SET);
+        if (yield) {
+            osDelay(1);
+        }
 
-    return data;
+    }
 
 }
 
@@ -126,73 +88,38 @@ static inline uint8_t sst_read(uint32_t address)
 HAL_StatusTypeDef sst_rom_read_id(uint8_t *manufacturer, uint8_t *device_id)
 {
 
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-
-    // Deselect ROM
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_OE_GPIO_Port, SST_OE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_WE_Pin, GPIO_PIN_SET);
-
-    // Ensure data lines are High-Z before enabling outputs
-    osDelay(1);
-
-    // Configure data lines for push-pull
-    GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                        |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    sst_bus_begin();
 
     // Avoid interrupts mucking with timing too much
     portENTER_CRITICAL();
 
     // Enter Software ID mode: write 0xAA to 0x5555, write 0x55 to 0x2AAA, write 0x90 to 0x5555
-    sst_write(0x5555, 0xaa);
-    sst_write(0x2aaa, 0x55);
-    sst_write(0x5555, SST_COMMAND_IDMODE);
-
-    // At least 150ns, almost certainly more
-    for (int i = 0; i < 15; i++) __NOP();
-
-    // Reconfigure data lines for input
-    GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                        |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
-
-    *manufacturer = sst_read(0);
-    *device_id = sst_read(1);
+    sst_bus_output();
+    sst_bus_write(0x5555, 0xaa);
+    sst_bus_write(0x2aaa, 0x55);
+    sst_bus_write(0x5555, SST_COMMAND_IDMODE);
+    sst_bus_input();
 
     // At least 150ns, almost certainly more
     for (int i = 0; i < 15; i++) __NOP();
 
-    // Configure data lines for push-pull
-    GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                        |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    *manufacturer = sst_bus_read(0);
+    *device_id = sst_bus_read(1);
 
     // exit ID mode
-    sst_write(0x5555, 0xaa);
-    sst_write(0x2aaa, 0x55);
-    sst_write(0x5555, SST_COMMAND_EXIT);
+    sst_bus_output();
+    sst_bus_write(0x5555, 0xaa);
+    sst_bus_write(0x2aaa, 0x55);
+    sst_bus_write(0x5555, SST_COMMAND_EXIT);
+    sst_bus_input();
 
     // At least 150ns, almost certainly more
     for (int i = 0; i < 15; i++) __NOP();
 
-    // Reconfigure data lines for input
-    GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                        |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
-
     portEXIT_CRITICAL();
 
+    sst_bus_end();
+
     return HAL_OK;
 
 }
@@ -210,23 +137,22 @@ HAL_StatusTypeDef sst_rom_read_id(uint8_t *manufacturer, uint8_t *device_id)
 HAL_StatusTypeDef sst_rom_erase(uint32_t address, uint8_t type)
 {
 
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-    uint32_t byte;
-    int max_tries;
-    int timeout;
+    HAL_StatusTypeDef result;
+    uint32_t max_us;
+    uint8_t byte, status;
 
     switch (type) {
 
         case SST_ROM_ERASE_SECTOR:
             address &= 0x3f000;
             byte = 0x30;
-            max_tries = 25000000 / 40;
+            max_us = SST_SECTOR_ERASE_MAX_US;
             break;
 
         case SST_ROM_ERASE_ALL:
             address = 0x5555;
             byte = 0x10;
-            max_tries = 100000000 / 40;
+            max_us = SST_CHIP_ERASE_MAX_US;
             break;
 
         default:
@@ -234,51 +160,72 @@ HAL_StatusTypeDef sst_rom_erase(uint32_t address, uint8_t type)
 
     }
 
-    // Deselect ROM
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_OE_GPIO_Port, SST_OE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_WE_Pin, GPIO_PIN_SET);
-
-    // Ensure data lines are High-Z before enabling outputs
-    osDelay(1);
-
-    // Configure data lines for push-pull
-    GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                        |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    sst_bus_begin();
 
     portENTER_CRITICAL();
 
-    sst_write(0x5555, 0xaa);
-    sst_write(0x2aaa, 0x55);
-    sst_write(0x5555, SST_COMMAND_ERASE);
-    sst_write(0x5555, 0xaa);
-    sst_write(0x2aaa, 0x55);
-    sst_write(address, byte);
+    sst_bus_output();
+    sst_bus_write(0x5555, 0xaa);
+    sst_bus_write(0x2aaa, 0x55);
+    sst_bus_write(0x5555, SST_COMMAND_ERASE);
+    sst_bus_write(0x5555, 0xaa);
+    sst_bus_write(0x2aaa, 0x55);
+    sst_bus_write(address, byte);
+    sst_bus_input();
+
+    // An erase can't be finished already, so DQ6 must be toggling
+    status = sst_bus_poll(address, 0xff);
 
     portEXIT_CRITICAL();
 
-    // Reconfigure data lines for input
-    GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                        |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-    GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    if ((status & SST_BUS_DQ6) == 0) {
+        sst_bus_end();
+        return HAL_ERROR;
+    }
 
-    for (timeout = 0; timeout < max_tries; timeout++) {
-        // data bit 7 will be inverted until programming is complete
-        if ((sst_read(address) & 0x80) == 0x80) {
-            break;
+    result = sst_rom_wait(address, 0xff, max_us, 1);
+
+    sst_bus_end();
+
+    return result;
+
+}
+
+// Program bytes one by one, optionally skipping any that would leave an erased byte unchanged
+static HAL_StatusTypeDef sst_rom_program_bytes(uint32_t address, const uint8_t *data, uint32_t size, uint8_t erased)
+{
+
+    HAL_StatusTypeDef result;
+    uint32_t byte;
+
+    sst_bus_begin();
+
+    for (byte = 0; byte < size; byte++) {
+
+        if (erased && data[byte] == 0xff) {
+            continue;
+        }
+
+        // Avoid interrupts mucking with timing too much
+        portENTER_CRITICAL();
+        sst_bus_program_byte(byte + address, data[byte]);
+        portEXIT_CRITICAL();
+
+        if ((result = sst_rom_wait(byte + address, data[byte], SST_PROGRAM_MAX_US, 0)) != HAL_OK) {
+            sst_bus_end();
+            return result;
+        }
+
+        // Nothing driving the bus reads as all ones, which passes the DQ7 check for half of all bytes
+        if (sst_bus_read(byte + address) != data[byte]) {
+            sst_bus_end();
+            return HAL_ERROR;
         }
-    }
 
-    if ((sst_read(address) & 0x80) == 0x00) {
-        return HAL_TIMEOUT;
     }
 
+    sst_bus_end();
+
     return HAL_OK;
 
 }
@@ -296,91 +243,264 @@ HAL_StatusTypeDef sst_rom_erase(uint32_t address, uint8_t type)
 HAL_StatusTypeDef sst_rom_program(uint32_t address, const uint8_t *data, uint32_t size)
 {
 
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-    uint32_t byte;
-    int timeout;
+    return sst_rom_program_bytes(address, data, size, 0);
 
-    // Deselect ROM
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_OE_GPIO_Port, SST_OE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_WE_Pin, GPIO_PIN_SET);
+}
 
-    // Ensure data lines are High-Z before enabling outputs
-    osDelay(1);
+/**
+ * @brief   Program bytes into an erased region of the ROM.
+ *
+ * Erased bytes already read as 0xFF, so those are skipped along with their command sequence and polling. The
+ * caller must know the region is erased; otherwise use sst_rom_program().
+ *
+ * @param   address  the address to begin writing from
+ * @param   data     the data to write
+ * @param   size     the total size of data to write
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef sst_rom_program_erased(uint32_t address, const uint8_t *data, uint32_t size)
+{
 
-    for (byte = 0; byte < size; byte++) {
+    return sst_rom_program_bytes(address, data, size, 1);
 
-        // Configure data lines for push-pull
-        GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                            |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-        GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
-        GPIO_InitStruct.Pull = GPIO_PULLUP;
-        GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
-        HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+}
 
-        // Avoid interrupts mucking with timing too much
-        portENTER_CRITICAL();
+/**
+ * Start the DMA streams on the next block: from the current address up to the end of its low-half block, or the
+ * end of the transfer. Sample k is taken in timer period k, and address k is stored at the update event that
+ * starts period k - so the first address is set by hand.
+ */
+static HAL_StatusTypeDef sst_rom_read_block(void)
+{
 
-        // Program the byte
-        sst_write(0x5555, 0xaa);
-        sst_write(0x2aaa, 0x55);
-        sst_write(0x5555, SST_COMMAND_WRITE);
-        sst_write(byte + address, data[byte]);
+    TIM_HandleTypeDef *htim = sst_read_tim;
+    uint32_t lo = sst_read_address & (SST_READ_BLOCK - 1);
+    uint32_t count = SST_READ_BLOCK - lo;
 
-        // At least 100ns, almost certainly more
-        for (int i = 0; i < 10; i++) __NOP();
+    if (count > sst_read_remaining) {
+        count = sst_read_remaining;
+    }
 
-        portEXIT_CRITICAL();
+    sst_bus_address(sst_read_address);
 
-        // Reconfigure data lines for input
-        GPIO_InitStruct.Pin = SST_D0_Pin|SST_D1_Pin|SST_D2_Pin|SST_D3_Pin 
-                            |SST_D4_Pin|SST_D5_Pin|SST_D6_Pin|SST_D7_Pin;
-        GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
-        GPIO_InitStruct.Pull = GPIO_PULLUP;
-        HAL_GPIO_Init(GPIOC, &GPIO_InitStruct);
+    // The address stream runs without interrupts, so it's still marked busy from the previous block
+    HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_UPDATE]);
 
-        // each read is at least 40ns, 2000x40ns = 8µs
-        for (timeout = 0; timeout < 2000; timeout++) {
+    if (count > 1 && HAL_DMA_Start(htim->hdma[TIM_DMA_ID_UPDATE], (uint32_t)&SST_ADDRESS_LO_TABLE[lo + 1],
+                                   (uint32_t)&SST_ADDRESS_LO_GPIO->BSRR, count - 1) != HAL_OK) {
+        return HAL_ERROR;
+    }
 
-            // data bit 7 will be inverted until programming is complete
-            if ((sst_read(byte + address) & 0x80) == (data[byte] & 0x80)) {
-                break;
-            }
+    if (HAL_DMA_Start_IT(htim->hdma[TIM_DMA_ID_CC1], (uint32_t)&GPIOC->IDR, (uint32_t)sst_read_data,
+                         count) != HAL_OK) {
+        return HAL_ERROR;
+    }
 
-        }
+    sst_read_address += count;
+    sst_read_data += count;
+    sst_read_remaining -= count;
 
-        if ((sst_read(byte + address) & 0x80) != (data[byte] & 0x80)) {
-            return HAL_TIMEOUT;
-        }
+    __HAL_TIM_CLEAR_FLAG(htim, TIM_FLAG_UPDATE | TIM_FLAG_CC1);
+    __HAL_TIM_SET_COUNTER(htim, 0);
+    __HAL_TIM_ENABLE_DMA(htim, (count > 1 ? TIM_DMA_UPDATE : 0) | TIM_DMA_CC1);
+    __HAL_TIM_ENABLE(htim);
 
-        // At least 50ns, almost certainly more
-        for (int i = 0; i < 5; i++) __NOP();
+    return HAL_OK;
+
+}
+
+static void sst_rom_read_stop(void)
+{
+
+    TIM_HandleTypeDef *htim = sst_read_tim;
+
+    __HAL_TIM_DISABLE(htim);
+    __HAL_TIM_DISABLE_DMA(htim, TIM_DMA_UPDATE | TIM_DMA_CC1);
+
+}
+
+static void sst_rom_read_complete(DMA_HandleTypeDef *hdma)
+{
+
+    UNUSED(hdma);
+
+    sst_rom_read_stop();
+
+    if (sst_read_remaining > 0 && sst_rom_read_block() == HAL_OK) {
+        return;
+    }
+
+    sst_read_status = sst_read_remaining > 0 ? HAL_ERROR : HAL_OK;
+    osSemaphoreRelease(sst_read_done);
+
+}
+
+static void sst_rom_read_error(DMA_HandleTypeDef *hdma)
+{
+
+    UNUSED(hdma);
+
+    sst_rom_read_stop();
 
+    sst_read_status = HAL_ERROR;
+    osSemaphoreRelease(sst_read_done);
+
+}
+
+/**
+ * @brief   Take ownership of the timer and DMA streams used for bulk reads.
+ *
+ * Without this, reads fall back to the CPU.
+ *
+ * @param   htim  a timer with DMA streams linked for its update and channel 1 compare requests
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef sst_rom_init(TIM_HandleTypeDef *htim)
+{
+
+    RCC_ClkInitTypeDef clocks;
+    uint32_t latency, clock, period;
+
+    if (sst_read_done == NULL) {
+        sst_read_done = osSemaphoreNew(1, 0, NULL);
+    }
+
+    if (sst_read_done == NULL || htim->hdma[TIM_DMA_ID_UPDATE] == NULL || htim->hdma[TIM_DMA_ID_CC1] == NULL) {
+        return HAL_ERROR;
     }
 
+    // APB2 timers run at twice the bus clock unless the bus is undivided
+    HAL_RCC_GetClockConfig(&clocks, &latency);
+    clock = HAL_RCC_GetPCLK2Freq();
+    if (clocks.APB2CLKDivider != RCC_HCLK_DIV1) {
+        clock *= 2;
+    }
+    clock /= 1000000;
+
+    period = SST_READ_CYCLE_NS * clock / 1000;
+
+    __HAL_TIM_DISABLE(htim);
+    __HAL_TIM_SET_PRESCALER(htim, 0);
+    __HAL_TIM_SET_AUTORELOAD(htim, period - 1);
+    __HAL_TIM_SET_COMPARE(htim, TIM_CHANNEL_1, SST_READ_SAMPLE_NS * clock / 1000);
+
+    htim->hdma[TIM_DMA_ID_CC1]->XferCpltCallback = sst_rom_read_complete;
+    htim->hdma[TIM_DMA_ID_CC1]->XferErrorCallback = sst_rom_read_error;
+
+    sst_read_tim = htim;
+
     return HAL_OK;
+
 }
 
 /**
- * sector = 4k block to read, data points to 4k memory region
+ * @brief   Start reading from the ROM in the background.
+ *
+ * The bus belongs to the transfer until sst_rom_read_wait() returns; nothing else may touch the ROM meanwhile.
+ *
+ * @param   address  the address to read from
+ * @param   data     where to store the data; must be in SRAM
+ * @param   size     how many bytes to read
+ * @retval  HAL status
  */
-HAL_StatusTypeDef sst_rom_read_sector(uint32_t sector, uint8_t *data)
+HAL_StatusTypeDef sst_rom_read_start(uint32_t address, uint8_t *data, uint32_t size)
 {
 
-    uint32_t address;
+    uint32_t byte;
 
-    HAL_GPIO_WritePin(SST_CE_GPIO_Port, SST_CE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_OE_GPIO_Port, SST_OE_Pin, GPIO_PIN_SET);
-    HAL_GPIO_WritePin(SST_WE_GPIO_Port, SST_WE_Pin, GPIO_PIN_SET);
+    if (address + size > SST_ROM_SIZE) {
+        return HAL_ERROR;
+    }
 
-    osDelay(1);
+    sst_read_status = HAL_OK;
+    sst_read_size = size;
+    sst_read_active = 0;
 
-    for (address = 0; address < (1<<12); address++) {
-        portENTER_CRITICAL();
-        data[address] = sst_read(address + sector);
-        portEXIT_CRITICAL();
+    sst_bus_begin();
+
+    // Without the timer, the read is done by the time this returns
+    if (sst_read_tim == NULL || size == 0) {
+        for (byte = 0; byte < size; byte++) {
+            data[byte] = sst_bus_read(byte + address);
+        }
+        return HAL_OK;
     }
 
+    // Drop a completion left over from a read that timed out
+    osSemaphoreAcquire(sst_read_done, 0);
+
+    sst_read_address = address;
+    sst_read_data = data;
+    sst_read_remaining = size;
+
+    // The ROM stays selected and driving the bus for the whole transfer
+    GPIOC->BSRR = SST_BUS_CE_LOW;
+    GPIOA->BSRR = SST_BUS_OE_LOW;
+
+    if (sst_rom_read_block() != HAL_OK) {
+        sst_rom_read_stop();
+        sst_bus_end();
+        return HAL_ERROR;
+    }
+
+    sst_read_active = 1;
+
     return HAL_OK;
 
 }
+
+/**
+ * @brief   Wait for a read started by sst_rom_read_start() to finish, and release the bus.
+ *
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef sst_rom_read_wait(void)
+{
+
+    TIM_HandleTypeDef *htim = sst_read_tim;
+
+    // A whole chip takes about a tenth of a second
+    if (sst_read_active && osSemaphoreAcquire(sst_read_done, 100 + sst_read_size / 1000) != osOK) {
+        sst_rom_read_stop();
+        HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_CC1]);
+        HAL_DMA_Abort(htim->hdma[TIM_DMA_ID_UPDATE]);
+        sst_read_status = HAL_TIMEOUT;
+    }
+
+    sst_read_active = 0;
+    sst_bus_end();
+
+    return sst_read_status;
+
+}
+
+/**
+ * @brief   Read from the ROM.
+ *
+ * @param   address  the address to read from
+ * @param   data     where to store the data; must be in SRAM
+ * @param   size     how many bytes to read
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef sst_rom_read(uint32_t address, uint8_t *data, uint32_t size)
+{
+
+    HAL_StatusTypeDef result;
+
+    if ((result = sst_rom_read_start(address, data, size)) != HAL_OK) {
+        return result;
+    }
+
+    return sst_rom_read_wait();
+
+}
+
+/**
+ * sector = 4k block to read, data points to 4k memory region
+ */
+HAL_StatusTypeDef sst_rom_read_sector(uint32_t sector, uint8_t *data)
+{
+
+    return sst_rom_read(sector, data, SST_ROM_SECTOR_SIZE);
+
+}
@@ -0,0 +1,108 @@
+/**
+ * FreeRTOS ticks at 1kHz, so osDelay(1) sleeps for anywhere up to a whole millisecond. That's far too coarse for
+ * waiting on things that complete in a few hundred microseconds, like a Flash ROM page program.
+ *
+ * Short waits here are done with a one-pulse timer counting at 1MHz. The waiting thread blocks on a semaphore that
+ * the timer's update interrupt releases, so other threads keep running while it sleeps. Very short waits spin on
+ * the DWT cycle counter instead, and waits of several milliseconds go to the scheduler.
+ *
+ * Only one thread at a time may sleep on the timer.
+ */
+
+#include "cmsis_os.h"
+
+#include "timing.h"
+
+#define TIMING_MEASURE_MAX_US   40000000    // longest sleep the cycle counter can time
+
+static TIM_HandleTypeDef *timing_tim = NULL;
+static osSemaphoreId_t timing_done = NULL;
+
+/**
+ * @brief   Enable the cycle counter and prepare the sleep timer.
+ *
+ * @param   htim  a timer initialised in one-pulse mode with a 1MHz counter clock
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef timing_init(TIM_HandleTypeDef *htim)
+{
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    if (timing_done == NULL) {
+        timing_done = osSemaphoreNew(1, 0, NULL);
+    }
+
+    if (timing_done == NULL) {
+        return HAL_ERROR;
+    }
+
+    timing_tim = htim;
+
+    __HAL_TIM_CLEAR_FLAG(timing_tim, TIM_FLAG_UPDATE);
+    __HAL_TIM_ENABLE_IT(timing_tim, TIM_IT_UPDATE);
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Sleep for at least the given time.
+ *
+ * @param   us  microseconds to sleep
+ */
+void timing_sleep_us(uint32_t us)
+{
+
+    uint32_t start, elapsed;
+
+    // Whole ticks are better handled by the scheduler. osDelay(n) may fall short by up to one tick, so ask for one
+    // fewer than fit, and time what's left over from the cycle counter. That wraps after 42 seconds, so sleeps too
+    // long to measure just take an extra tick instead.
+    if (us >= TIMING_MEASURE_MAX_US) {
+        osDelay((us + 999) / 1000 + 1);
+        return;
+    }
+
+    if (us >= 2000) {
+        start = timing_cycles();
+        osDelay(us / 1000 - 1);
+        elapsed = timing_elapsed_us(start);
+        if (elapsed >= us) {
+            return;
+        }
+        us -= elapsed;
+    }
+
+    if (us < TIMING_SPIN_US || timing_tim == NULL) {
+        timing_spin_us(us);
+        return;
+    }
+
+    // Drop a completion left over from a sleep that timed out
+    osSemaphoreAcquire(timing_done, 0);
+
+    __HAL_TIM_SET_AUTORELOAD(timing_tim, us - 1);
+    __HAL_TIM_SET_COUNTER(timing_tim, 0);
+    __HAL_TIM_ENABLE(timing_tim);
+
+    // The timer can't take more than 65ms; if the interrupt goes missing, don't hang
+    osSemaphoreAcquire(timing_done, 100);
+
+}
+
+/**
+ * @brief   Wake the sleeping thread.
+ *
+ * @param   htim  the timer that elapsed
+ */
+void timing_timer_elapsed(TIM_HandleTypeDef *htim)
+{
+
+    if (htim == timing_tim) {
+        osSemaphoreRelease(timing_done);
+    }
+
+}
@@ -0,0 +1,236 @@
+/**
+ * Polled HAL_UART_Receive() only takes bytes while a thread is sitting in it. Anything that arrives while the CLI
+ * thread is busy elsewhere, or preempted by the ROM writer, overruns the UART's single byte of buffering and is
+ * lost - at 115200 baud that needs a gap of under 100us, at 2 Mbaud just 5us.
+ *
+ * Instead, a DMA stream receives into a circular buffer continuously. Whenever it reaches the half or end of the
+ * buffer, or the line goes idle after a burst, an interrupt moves the new bytes into a FreeRTOS stream buffer, and
+ * the reading thread blocks on that. The idle interrupt means a short burst, like a single command byte, is passed
+ * on straight away rather than sitting in the DMA buffer until more arrives.
+ *
+ * The stream buffer has a single reader: everything that reads from the UART runs on the CLI thread.
+ */
+
+#include "cmsis_os.h"
+#include "stream_buffer.h"
+
+#include "uartrx.h"
+
+static UART_HandleTypeDef *uart_rx_huart = NULL;
+static uint8_t uart_rx_dma[UART_RX_DMA_SIZE];
+static uint16_t uart_rx_tail = 0;                   // DMA buffer index of the next byte to pass on
+static volatile uint32_t uart_rx_lost = 0;
+
+static StreamBufferHandle_t uart_rx_stream = NULL;
+static StaticStreamBuffer_t uart_rx_stream_control;
+static uint8_t uart_rx_stream_storage[UART_RX_STREAM_SIZE + 1];
+
+// Pass on everything the DMA has written since last time - runs in interrupt context
+static void uart_rx_drain(void)
+{
+
+    BaseType_t woken = pdFALSE;
+    uint16_t head = UART_RX_DMA_SIZE - __HAL_DMA_GET_COUNTER(uart_rx_huart->hdmarx);
+    uint16_t sent = 0, wanted = 0;
+
+    if (head >= UART_RX_DMA_SIZE) {
+        head = 0;
+    }
+
+    if (head < uart_rx_tail) {
+        wanted += UART_RX_DMA_SIZE - uart_rx_tail;
+        sent += xStreamBufferSendFromISR(uart_rx_stream, &uart_rx_dma[uart_rx_tail], UART_RX_DMA_SIZE - uart_rx_tail,
+                                         &woken);
+        uart_rx_tail = 0;
+    }
+
+    if (head > uart_rx_tail) {
+        wanted += head - uart_rx_tail;
+        sent += xStreamBufferSendFromISR(uart_rx_stream, &uart_rx_dma[uart_rx_tail], head - uart_rx_tail, &woken);
+        uart_rx_tail = head;
+    }
+
+    uart_rx_lost += wanted - sent;
+
+    portYIELD_FROM_ISR(woken);
+
+}
+
+static void uart_rx_dma_event(DMA_HandleTypeDef *hdma)
+{
+
+    UNUSED(hdma);
+
+    uart_rx_drain();
+
+}
+
+// Point the DMA stream back at the start of the buffer and let the UART make requests
+static HAL_StatusTypeDef uart_rx_arm(void)
+{
+
+    UART_HandleTypeDef *huart = uart_rx_huart;
+
+    uart_rx_tail = 0;
+
+    huart->hdmarx->XferCpltCallback = uart_rx_dma_event;
+    huart->hdmarx->XferHalfCpltCallback = uart_rx_dma_event;
+    huart->hdmarx->XferErrorCallback = NULL;
+
+    if (HAL_DMA_Start_IT(huart->hdmarx, (uint32_t)&huart->Instance->DR, (uint32_t)uart_rx_dma,
+                         UART_RX_DMA_SIZE) != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    __HAL_UART_CLEAR_OREFLAG(huart);
+    __HAL_UART_ENABLE_IT(huart, UART_IT_IDLE);
+    SET_BIT(huart->Instance->CR3, USART_CR3_EIE | USART_CR3_DMAR);
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Start receiving into the stream buffer.
+ *
+ * Anything already received is discarded. Call this again after changing the UART's configuration.
+ *
+ * @param   huart  the UART, with a circular DMA stream linked to hdmarx
+ * @retval  HAL status
+ */
+HAL_StatusTypeDef uart_rx_start(UART_HandleTypeDef *huart)
+{
+
+    if (huart->hdmarx == NULL || huart->hdmarx->Init.Mode != DMA_CIRCULAR) {
+        return HAL_ERROR;
+    }
+
+    if (uart_rx_stream == NULL) {
+        uart_rx_stream = xStreamBufferCreateStatic(UART_RX_STREAM_SIZE, 1, uart_rx_stream_storage,
+                                                   &uart_rx_stream_control);
+    }
+
+    // Stop any reception in progress, including one of ours
+    __HAL_UART_DISABLE_IT(huart, UART_IT_IDLE);
+    HAL_UART_AbortReceive(huart);
+
+    uart_rx_huart = huart;
+    xStreamBufferReset(uart_rx_stream);
+
+    return uart_rx_arm();
+
+}
+
+/**
+ * @brief   Receive bytes.
+ *
+ * @param   data     where to store them
+ * @param   size     how many to wait for
+ * @param   timeout  milliseconds to wait for all of them, or HAL_MAX_DELAY
+ * @retval  HAL status: HAL_OK if all arrived, HAL_TIMEOUT if not
+ */
+HAL_StatusTypeDef uart_rx_read(uint8_t *data, uint16_t size, uint32_t timeout)
+{
+
+    uint32_t start = osKernelGetTickCount(), elapsed;
+    uint16_t received = 0;
+
+    if (uart_rx_stream == NULL) {
+        return HAL_ERROR;
+    }
+
+    while (received < size) {
+
+        elapsed = osKernelGetTickCount() - start;
+        if (timeout != HAL_MAX_DELAY && elapsed >= timeout) {
+            return HAL_TIMEOUT;
+        }
+
+        received += xStreamBufferReceive(uart_rx_stream, &data[received], size - received,
+                                         timeout == HAL_MAX_DELAY ? portMAX_DELAY : timeout - elapsed);
+
+    }
+
+    return HAL_OK;
+
+}
+
+/**
+ * @brief   Receive whatever has arrived, waiting only if nothing has.
+ *
+ * @param   data     where to store it
+ * @param   size     the most to take
+ * @param   timeout  milliseconds to wait for the first byte
+ * @retval  the number of bytes received, zero on timeout
+ */
+uint16_t uart_rx_read_some(uint8_t *data, uint16_t size, uint32_t timeout)
+{
+
+    if (uart_rx_stream == NULL) {
+        return 0;
+    }
+
+    return xStreamBufferReceive(uart_rx_stream, data, size, timeout == HAL_MAX_DELAY ? portMAX_DELAY : timeout);
+
+}
+
+/**
+ * @brief   Discard everything received so far.
+ */
+void uart_rx_flush(void)
+{
+
+    xStreamBufferReset(uart_rx_stream);
+
+}
+
+/**
+ * @brief   Count bytes lost because the reader fell too far behind.
+ *
+ * @retval  bytes lost since boot
+ */
+uint32_t uart_rx_dropped(void)
+{
+
+    return uart_rx_lost;
+
+}
+
+/**
+ * @brief   Pass on a burst of data once the line goes idle.
+ *
+ * @param   huart  the UART that interrupted
+ */
+void uart_rx_irq(UART_HandleTypeDef *huart)
+{
+
+    if (huart != uart_rx_huart || __HAL_UART_GET_FLAG(huart, UART_FLAG_IDLE) == RESET
+            || __HAL_UART_GET_IT_SOURCE(huart, UART_IT_IDLE) == RESET) {
+        return;
+    }
+
+    __HAL_UART_CLEAR_IDLEFLAG(huart);
+
+    uart_rx_drain();
+
+}
+
+/**
+ * @brief   Restart reception after a UART error.
+ *
+ * The HAL treats any receive error in DMA mode as fatal and aborts the stream. This runs in interrupt context
+ * while the CLI thread may hold the UART's HAL lock for a transmit, so the stream is rearmed directly.
+ *
+ * @param   huart  the UART that failed
+ */
+void uart_rx_error(UART_HandleTypeDef *huart)
+{
+
+    if (huart != uart_rx_huart || READ_BIT(huart->Instance->CR3, USART_CR3_DMAR)) {
+        return;
+    }
+
+    uart_rx_drain();
+    uart_rx_arm();
+
+}
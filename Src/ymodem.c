@@ -5,8 +5,8 @@
  * 
  *      http://www.blunk-electronic.de/train-z/pdf/xymodem.pdf
  * 
- * Tested against MINICOM's implementation, for receive only. This implementation supports 1024-byte blocks, batch
- * transfers, and of course, CRC-16.
+ * Tested against MINICOM's implementation. This implementation supports 1024-byte blocks, batch transfers, and of
+ * course, CRC-16. Sending is limited to a single file per batch.
  * 
  * The basics of YMODEM are simple. The sender transmits a control byte, which is either SOH, STX, EOT, or CAN. SOH
  * indicates a 128-byte data packet, and STX indicates a 1024-byte data packet. EOT is a single byte indicating the
@@ -27,15 +27,27 @@
  * A final metadata block with a zero-length filename indicates the end of the batch. The receiver ACKs this final
  * block to complete the session.
  * 
+ * YMODEM-g is a streaming variant for error-free links. The receiver asks for it by sending 'G' in place of 'C',
+ * and the sender then transmits data packets back to back without waiting for ACKs. There are no retransmissions:
+ * any error cancels the transfer. Only the EOT is still ACKed. The receiver has to keep up with the line, so this
+ * relies on the UART receive buffering and on the write callback never stalling for longer than that buffer lasts.
+ * 
+ * Sending runs the same exchange from the other end: wait for 'C' or 'G', send the metadata packet, then the data
+ * in 1024-byte packets with the last padded out, then EOT and an empty metadata packet to end the batch.
+ * 
  * This implementation assumes a benign sender. There are several ways that an infinite loop could be triggered, but
  * none are plausible as a result of line noise.
  * 
  */
 
 #include <ctype.h>      // isdigit()
+#include <inttypes.h>
+#include <stdio.h>
 #include <string.h>
 
 #include "ymodem.h"
+#include "uartrx.h"
+#include "crc16.h"
 
 #define SOH     0x01    // start of a 128-byte packet
 #define STX     0x02    // start of a 1024-byte packet
@@ -44,6 +56,8 @@
 #define NAK     0x15    // receive error
 #define CAN     0x18    // cancel transmission
 #define CRCMODE 0x43    // 'C' to indicate CRC desired
+#define GMODE   0x47    // 'G' to indicate CRC and streaming desired
+#define CPMEOF  0x1a    // padding after the end of the file
 
 #define YM_OPER_TIMEOUT  (10*1000)      // 10 second timeout for operation byte
 #define YM_DATA_TIMEOUT  (1*1000)       // 1 second timeout for packet data
@@ -57,9 +71,9 @@ switch (stmt) { \
 }
 
 /* Prototypes */
-static uint16_t ym_crc(const uint8_t *, uint16_t);
 static int ym_read(const YModem_ControlDef *, const uint8_t, uint8_t *);
-static uint16_t ym_get_size(const uint8_t *, uint16_t);
+static uint32_t ym_get_size(const uint8_t *, uint16_t);
+static int ym_response(uint8_t *, uint32_t);
 
 /**
  * Receive a YModem packet of data. This will be one control byte, two sequence bytes, 128 or 1024 data bytes, and
@@ -67,9 +81,9 @@ static uint16_t ym_get_size(const uint8_t *, uint16_t);
  * 
  * This will make ten attempts to receive data. After each timeout, the 'retry' byte will be sent to prompt the
  * remote end to have another go. This should be NAK in most cases, or 'C' when metadata or the first data packet
- * is expected.
+ * is expected. A 'retry' of zero makes a single attempt, for YMODEM-g packets after the first.
  * 
- * Data packets will have their CRCs validated. A CRC error will result in a retry.
+ * Data packets will have their CRCs validated. A CRC error will result in a retry, if retries are allowed.
  * 
  * Returns a YMODEM_XXXX status code.
  */
@@ -77,16 +91,16 @@ static int ym_read(const YModem_ControlDef *ctrl, const uint8_t retry, uint8_t *
 
     HAL_StatusTypeDef result;
     uint8_t _retry = retry; // HAL doesn't mark parameters const appropriately :()
-    uint8_t tries;
+    uint8_t tries, attempts = retry ? 10 : 1;
     uint16_t size;
 
-    for (tries = 0; tries < 10; tries++) {
+    for (tries = 0; tries < attempts; tries++) {
 
         // On the second and subsequent attempts, send the response code again
         if (tries > 1) {
 
             // clear the line of any pending data
-            while (HAL_UART_Receive(ctrl->huart, buf, 1, 100) == HAL_OK) {}
+            while (uart_rx_read(buf, 1, 100) == HAL_OK) {}
 
             // send the retry code byte, with a short timeout
             YM_ERRCHECK(HAL_UART_Transmit(ctrl->huart, &_retry, 1, YM_DATA_TIMEOUT));
@@ -94,7 +108,7 @@ static int ym_read(const YModem_ControlDef *ctrl, const uint8_t retry, uint8_t *
         }
 
         // Read the packet control byte, with a full timeout
-        result = HAL_UART_Receive(ctrl->huart, buf, 1, YM_OPER_TIMEOUT);
+        result = uart_rx_read(buf, 1, YM_OPER_TIMEOUT);
 
         // A timeout causes a re-transmit of the respones code and another loop.
         if (result == HAL_TIMEOUT) {
@@ -109,7 +123,7 @@ static int ym_read(const YModem_ControlDef *ctrl, const uint8_t retry, uint8_t *
             size = buf[0] == SOH ? 128 : 1024;
 
             // Receive data: one second timeouts
-            result = HAL_UART_Receive(ctrl->huart, buf + 1, size + 4, YM_DATA_TIMEOUT);
+            result = uart_rx_read(buf + 1, size + 4, YM_DATA_TIMEOUT);
 
             if (result == HAL_TIMEOUT) {
                 continue;
@@ -124,7 +138,7 @@ static int ym_read(const YModem_ControlDef *ctrl, const uint8_t retry, uint8_t *
             }
 
             // A CRC error? That's a retryin'.
-            if (ym_crc(buf + 3, size + 2)) {
+            if (crc16_xmodem(0, buf + 3, size + 2)) {
                 result = HAL_ERROR;
                 continue;
             }
@@ -135,7 +149,7 @@ static int ym_read(const YModem_ControlDef *ctrl, const uint8_t retry, uint8_t *
         } else if (buf[0] == CAN) {         // A CAN might mean we're aborting the whole session
 
             // Get the next byte along
-            result = HAL_UART_Receive(ctrl->huart, buf + 1, 1, YM_DATA_TIMEOUT);
+            result = uart_rx_read(buf + 1, 1, YM_DATA_TIMEOUT);
 
             // If it's a CAN as well, we're done here
             if (result == HAL_OK && buf[1] == CAN) {
@@ -166,13 +180,13 @@ static int ym_read(const YModem_ControlDef *ctrl, const uint8_t retry, uint8_t *
 
 }
 
-static uint16_t ym_get_size(const uint8_t *buffer, uint16_t maxlen) {
+static uint32_t ym_get_size(const uint8_t *buffer, uint16_t maxlen) {
 
     const uint8_t *end = buffer + maxlen;
-    uint16_t val = 0;
+    uint32_t val = 0;
 
     while (buffer < end && isdigit(*buffer)) {
-        val = val * 10 + (uint16_t)*(buffer++) - '0';
+        val = val * 10 + (uint32_t)*(buffer++) - '0';
     }
 
     return val;
@@ -188,8 +202,8 @@ uint8_t ymodem_receive(const YModem_ControlDef *ctrl) {
 
     // Constants for common messages
     static const uint8_t cancel[2] = { CAN, CAN }; // probably a dancing pun in here somewhere
-    static const uint8_t crc[1] = { CRCMODE };
     static const uint8_t ack[1] = { ACK };
+    const uint8_t crc[1] = { ctrl->streaming ? GMODE : CRCMODE };
 
     uint32_t remaining = 0xffff;    // bytes left to receive
     uint16_t block_number = 0;      // expected block number
@@ -201,7 +215,7 @@ uint8_t ymodem_receive(const YModem_ControlDef *ctrl) {
 
         // Read a metadata packet, or die trying
         YM_ERRCHECK(HAL_UART_Transmit(ctrl->huart, (uint8_t *)crc, 1, YM_DATA_TIMEOUT));
-        if ((result = ym_read(ctrl, 'C', buffer)) != YMODEM_OK) {
+        if ((result = ym_read(ctrl, crc[0], buffer)) != YMODEM_OK) {
             return result;
         }
 
@@ -242,14 +256,17 @@ uint8_t ymodem_receive(const YModem_ControlDef *ctrl) {
             return YMODEM_ERROR;
         }
 
-        // Ack it and begin data transfers
-        HAL_UART_Transmit(ctrl->huart, (uint8_t *)ack, 1, YM_DATA_TIMEOUT);
+        // Ack it and begin data transfers; YMODEM-g doesn't ACK packets, even this one
+        if (!ctrl->streaming) {
+            HAL_UART_Transmit(ctrl->huart, (uint8_t *)ack, 1, YM_DATA_TIMEOUT);
+        }
         HAL_UART_Transmit(ctrl->huart, (uint8_t *)crc, 1, YM_DATA_TIMEOUT);
         block_number = 1;
         do {
 
-            // Get the next packet
-            if ((result = ym_read(ctrl, block_number == 1 ? CRCMODE : NAK, buffer)) != YMODEM_OK) {
+            // Get the next packet. When streaming, only the first can be asked for again.
+            if ((result = ym_read(ctrl, block_number == 1 ? crc[0] : (ctrl->streaming ? 0 : NAK), buffer))
+                    != YMODEM_OK) {
                 HAL_UART_Transmit(ctrl->huart, (uint8_t *)cancel, 2, YM_DATA_TIMEOUT);
                 ctrl->close(ctrl->cb_data, result);
                 return result;
@@ -281,8 +298,8 @@ uint8_t ymodem_receive(const YModem_ControlDef *ctrl) {
             if (buffer[1] != (block_number & 0xff)) {
 
                 // A repeat of the last block - ACK it again and go back for more.
-                // Another infinite loop is possible here.
-                if (buffer[1] == ((block_number - 1) & 0xff)) {
+                // Another infinite loop is possible here. A streaming sender never repeats itself.
+                if (!ctrl->streaming && buffer[1] == ((block_number - 1) & 0xff)) {
                     HAL_UART_Transmit(ctrl->huart, (uint8_t *)ack, 1, YM_DATA_TIMEOUT);
                     continue;
                 }
@@ -314,7 +331,9 @@ uint8_t ymodem_receive(const YModem_ControlDef *ctrl) {
             }
 
             // ACK the received packet and go get more
-            HAL_UART_Transmit(ctrl->huart, (uint8_t *)ack, 1, YM_DATA_TIMEOUT);
+            if (!ctrl->streaming) {
+                HAL_UART_Transmit(ctrl->huart, (uint8_t *)ack, 1, YM_DATA_TIMEOUT);
+            }
 
         } while (1);
 
@@ -323,78 +342,164 @@ uint8_t ymodem_receive(const YModem_ControlDef *ctrl) {
 }
 
 /**
- * CRC constant lookup.
- * 
- * The XMODEM/YMODEM CRC-16 is based on the polynomial x^16 + x^12 + x^5 + x^0, which is a generator of 0x1021.
- * 
- * A 16-bit CRC value computed byte by byte will xor the next input byte into the high byte of the current
- * value, then perform a polynomial division with the generator. The polynomial division loop operates bit
- * by bit:
- * 
- * for (int bit = 0; bit < 8; bit++) {
- *     if (crc & 0x8000)
- *         crc = (crc << 1) ^ generator;
- *     else
- *         crc = crc << 1;
- * }
- * 
- * But since this is dividing a byte, a 256-entry lookup table will also do the trick - work out the table
- * entry from the current CRC high byte and the next byte to process, xor that entry with the shifted CRC,
- * and that's it.
+ * Wait for a response byte from the receiver, and store it in <response>. A single CAN is taken as line noise and
+ * ignored; two in a row cancel.
  * 
- * Going further, that 256-entry lookup table can be computed from two 16-entry lookup tables, one for each
- * nibble of the dividend byte. The shifted CRC is xor'd with each entry to produce the next CRC value.
- * 
- * This table is produced with:
- * 
- *   for (int i = 0; i < 16; i++) {
- *       uint16_t crc = i << 8;
- *       for (int bit = 0; bit < 8; bit++) {
- *           if (crc & 0x8000)
- *               crc = (crc << 1) ^ 0x1021;
- *           else
- *               crc = crc << 1;
- *       }
- *       ym_crc_tab[i] = crc;
- *
- *       crc = i << 12;
- *       for (int bit = 0; bit < 8; bit++) {
- *           if (crc & 0x8000)
- *               crc = (crc << 1) ^ 0x1021;
- *           else
- *               crc = crc << 1;
- *       }
- *       ym_crc_tab[i + 16] = crc;
- *   }
- * 
- * Thanks to the excellent CRC documentation at http://www.sunshine2k.de/articles/coding/crc/understanding_crc.html
- * and Arjen Lentz' 8-bit CRC 32-entry function at https://lentz.com.au/blog/tag/crc-table-generator.
- * 
- * As this is declared static, it will be stored in Flash, not SRAM.
+ * Returns a YMODEM_XXXX status code.
+ */
+static int ym_response(uint8_t *response, uint32_t timeout) {
+
+    uint8_t next;
+
+    do {
+
+        YM_ERRCHECK(uart_rx_read(response, 1, timeout));
+
+        if (*response != CAN) {
+            return YMODEM_OK;
+        }
+
+        if (uart_rx_read(&next, 1, YM_DATA_TIMEOUT) == HAL_OK && next == CAN) {
+            return YMODEM_CANCEL;
+        }
+
+    } while (1);
+
+}
+
+/**
+ * Fill in the control byte, sequence numbers, and CRC of a packet whose data is already in place.
  */
+static void ym_seal(uint8_t *packet, uint8_t block, uint16_t size) {
+
+    uint16_t crc = crc16_xmodem(0, packet + 3, size);
 
-static const uint16_t ym_crc_tab[32] = {
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
-    0x0000, 0x1231, 0x2462, 0x3653, 0x48c4, 0x5af5, 0x6ca6, 0x7e97,
-    0x9188, 0x83b9, 0xb5ea, 0xa7db, 0xd94c, 0xcb7d, 0xfd2e, 0xef1f,
-};
+    packet[0] = size == 1024 ? STX : SOH;
+    packet[1] = block;
+    packet[2] = ~block;
+    packet[3 + size] = crc >> 8;
+    packet[4 + size] = crc & 0xff;
 
+}
 
 /**
- * Compute a YModem CRC-16.
+ * Send something until the receiver answers with <expect>: ACK, or the 'C' or 'G' that follows the metadata packet.
+ * Anything else, usually a NAK, gets it sent again.
  * 
- * If the two bytes of the CRC are included in <buf> this will return zero when no errors are detected.
+ * Returns a YMODEM_XXXX status code.
  */
-static uint16_t ym_crc(const uint8_t *buf, uint16_t size) {
+static int ym_send_until(const YModem_SendDef *ctrl, const uint8_t *data, uint16_t size, uint8_t expect) {
+
+    uint8_t tries, response;
+    int result = YMODEM_TIMEOUT;
 
-    uint16_t crc = 0;
+    for (tries = 0; tries < 10; tries++) {
+
+        YM_ERRCHECK(HAL_UART_Transmit(ctrl->huart, (uint8_t *)data, size, YM_DATA_TIMEOUT));
+
+        result = ym_response(&response, YM_OPER_TIMEOUT);
+        if (result == YMODEM_CANCEL || (result == YMODEM_OK && response == expect)) {
+            return result;
+        }
 
-    for (uint16_t i = 0; i < size; i++) {
-        uint8_t pos = (uint8_t)(crc >> 8) ^ buf[i];
-        crc = (crc << 8) ^ ym_crc_tab[pos & 0xf] ^ ym_crc_tab[(pos >> 4) + 16];
     }
 
-    return crc;
+    return result == YMODEM_OK ? YMODEM_ERROR : result;
+
+}
+
+uint8_t ymodem_send(const YModem_SendDef *ctrl) {
+
+    // Static, like the receive buffer, to spare the thread's stack
+    static uint8_t packet[1024 + 3 + 2];
+
+    static const uint8_t cancel[2] = { CAN, CAN };
+    static const uint8_t eot[1] = { EOT };
+
+    uint32_t offset, chunk;
+    uint16_t size, length;
+    uint8_t block, mode, tries, streaming;
+    int result;
+
+    // The receiver starts things off by asking for CRC mode, or streaming
+    uart_rx_flush();
+    for (tries = 0; ; tries++) {
+
+        result = ym_response(&mode, YM_OPER_TIMEOUT);
+        if (result == YMODEM_OK && (mode == CRCMODE || mode == GMODE)) {
+            break;
+        }
+
+        if (result == YMODEM_CANCEL || result == YMODEM_ERROR || tries == 10) {
+            return result == YMODEM_OK ? YMODEM_TIMEOUT : result;
+        }
+
+    }
+
+    streaming = mode == GMODE;
+
+    // Metadata is the name, NUL, then the size in decimal. The receiver asks again with 'C' or 'G' once it has it,
+    // and a non-streaming receiver ACKs it first.
+    memset(packet + 3, 0, 128);
+    length = strnlen(ctrl->filename, 64);
+    memcpy(packet + 3, ctrl->filename, length);
+    snprintf((char *)packet + 4 + length, 128 - length - 1, "%" PRIu32, ctrl->size);
+    ym_seal(packet, 0, 128);
+
+    if ((result = ym_send_until(ctrl, packet, 128 + 5, streaming ? GMODE : ACK)) != YMODEM_OK) {
+        HAL_UART_Transmit(ctrl->huart, (uint8_t *)cancel, 2, YM_DATA_TIMEOUT);
+        return result;
+    }
+
+    if (!streaming) {
+        if ((result = ym_response(&mode, YM_OPER_TIMEOUT)) != YMODEM_OK || mode != CRCMODE) {
+            HAL_UART_Transmit(ctrl->huart, (uint8_t *)cancel, 2, YM_DATA_TIMEOUT);
+            return result == YMODEM_OK ? YMODEM_ERROR : result;
+        }
+    }
+
+    block = 1;
+    for (offset = 0; offset < ctrl->size; offset += chunk, block++) {
+
+        // A short last packet is padded to 128 bytes if that will hold it
+        chunk = ctrl->size - offset < 1024 ? ctrl->size - offset : 1024;
+        size = chunk > 128 ? 1024 : 128;
+
+        if (ctrl->read(ctrl->cb_data, offset, packet + 3, chunk) != YMODEM_OK) {
+            HAL_UART_Transmit(ctrl->huart, (uint8_t *)cancel, 2, YM_DATA_TIMEOUT);
+            return YMODEM_ERROR;
+        }
+
+        memset(packet + 3 + chunk, CPMEOF, size - chunk);
+        ym_seal(packet, block, size);
+
+        if (streaming) {
+
+            // Nothing comes back unless the receiver gives up
+            YM_ERRCHECK(HAL_UART_Transmit(ctrl->huart, packet, size + 5, YM_DATA_TIMEOUT));
+            if (uart_rx_read_some(&mode, 1, 0) == 1 && mode == CAN
+                    && uart_rx_read(&mode, 1, YM_DATA_TIMEOUT) == HAL_OK && mode == CAN) {
+                return YMODEM_CANCEL;
+            }
+
+        } else if ((result = ym_send_until(ctrl, packet, size + 5, ACK)) != YMODEM_OK) {
+
+            HAL_UART_Transmit(ctrl->huart, (uint8_t *)cancel, 2, YM_DATA_TIMEOUT);
+            return result;
+
+        }
+
+    }
+
+    // EOT is ACKed even when streaming. Then the receiver asks for the next file, and an empty name ends the batch.
+    if ((result = ym_send_until(ctrl, eot, 1, ACK)) != YMODEM_OK
+            || (result = ym_response(&mode, YM_OPER_TIMEOUT)) != YMODEM_OK) {
+        return result;
+    }
+
+    memset(packet + 3, 0, 128);
+    ym_seal(packet, 0, 128);
+
+    return ym_send_until(ctrl, packet, 128 + 5, ACK);
 
 }
@@ -0,0 +1,572 @@
+/**
+ * A ZMODEM receiver.
+ *
+ * Based on Chuck Forsberg's "The ZMODEM Inter Application File Transfer Protocol", and tested against the sz from
+ * lrzsz, for receive only. This implementation supports streaming, CRC-32, and resuming an interrupted transfer.
+ *
+ * Everything ZMODEM sends is either a header or a data subpacket. A header is a frame type and four bytes, which
+ * hold either a file position, least significant byte first, or flags. Headers come in three encodings: hex, which
+ * is printable and carries a CRC-16; binary with a CRC-16; and binary with a CRC-32. This receiver sends hex headers
+ * and accepts all three. Binary data escapes any byte that could upset the link with ZDLE, which is the same byte as
+ * CAN: ZDLE followed by a byte with bit 6 set stands for that byte with bit 6 cleared. Five CANs cancel the session.
+ *
+ * A data subpacket is up to 1024 bytes of escaped data, then ZDLE and a frame end, then a CRC of the data and the
+ * frame end. The CRC is the same kind as the header before it. The frame end says whether the sender wants an ACK
+ * (ZCRCQ, ZCRCW) and whether another subpacket follows (ZCRCG, ZCRCQ) or a header does (ZCRCE, ZCRCW).
+ *
+ * The receiver opens with ZRINIT, saying it can stream with CRC-32. The sender offers a file with a ZFILE header and
+ * a subpacket holding the name and size, and the receiver replies with ZRPOS giving the position to send from -
+ * nonzero to resume an earlier transfer. The sender then streams ZDATA. Errors of every kind are recovered from the
+ * same way: ZRPOS with the position after the last good byte, then ignoring everything up to a ZDATA header at that
+ * position. If the write callback falls so far behind that the UART receive buffer overflows, the damaged data is
+ * simply sent again. ZEOF ends a file, and the receiver sends ZRINIT for the next one; ZFIN ends the session.
+ *
+ * Like the YMODEM receiver, this assumes a benign sender.
+ *
+ */
+
+#include <string.h>
+
+#include "zmodem.h"
+#include "uartrx.h"
+#include "crc16.h"
+#include "crc32.h"
+
+#define ZPAD    '*'     // header lead-in
+#define ZDLE    0x18    // escape, also CAN
+#define ZBIN    'A'     // binary header, CRC-16
+#define ZHEX    'B'     // hex header, CRC-16
+#define ZBIN32  'C'     // binary header, CRC-32
+
+#define CAN     0x18    // cancel transmission
+#define BS      0x08    // backspace
+#define XON     0x11    // flow control, never part of the data
+#define XOFF    0x13
+
+// Frame types
+#define ZRQINIT 0       // sender wants a ZRINIT
+#define ZRINIT  1       // receiver is ready
+#define ZSINIT  2       // sender's options, with a subpacket
+#define ZACK    3       // acknowledge, with a position
+#define ZFILE   4       // file offer, with a subpacket
+#define ZNAK    6       // last header or subpacket was garbled
+#define ZFIN    8       // end of session
+#define ZRPOS   9       // send from this position
+#define ZDATA   10      // subpackets from this position follow
+#define ZEOF    11      // end of file at this position
+
+// Frame ends, following a ZDLE
+#define ZCRCE   'h'     // a header follows, no ACK
+#define ZCRCG   'i'     // a subpacket follows, no ACK
+#define ZCRCQ   'j'     // a subpacket follows, ACK
+#define ZCRCW   'k'     // a header follows, ACK
+#define ZRUB0   'l'     // escaped 0x7f
+#define ZRUB1   'm'     // escaped 0xff
+
+// ZRINIT flags
+#define CANFDX  0x01    // full duplex
+#define CANOVIO 0x02    // can receive while writing
+#define CANFC32 0x20    // CRC-32
+
+#define ZM_MAX_DATA         1024            // longest subpacket
+#define ZM_MAX_GARBAGE      32768           // bytes to skip looking for a header before asking again
+#define ZM_RETRIES          10
+
+#define ZM_HEADER_TIMEOUT   (10*1000)       // 10 second timeout for a header
+#define ZM_DATA_TIMEOUT     (1*1000)        // 1 second timeout within a header or subpacket
+
+// Results from reading the line, besides byte values
+#define ZM_FRAME_END    0x100               // or'ed with the frame end character
+#define ZM_TIMEOUT      (-1)
+#define ZM_ERROR        (-2)
+#define ZM_CANCEL       (-3)
+
+// Bytes received but not yet looked at. Reading the stream buffer a byte at a time would be slow.
+static uint8_t zm_rx[256];
+static uint16_t zm_rx_next = 0, zm_rx_count = 0;
+
+static const uint8_t zm_zero[4] = { 0, 0, 0, 0 };
+static const uint8_t zm_zrinit[4] = { 0, 0, 0, CANFDX | CANOVIO | CANFC32 };   // ZF0 is the last byte
+
+/**
+ * Read a byte, skipping flow control characters. Returns the byte or ZM_TIMEOUT.
+ */
+static int zm_getc(uint32_t timeout) {
+
+    uint8_t c;
+
+    do {
+
+        if (zm_rx_next == zm_rx_count) {
+            zm_rx_next = 0;
+            zm_rx_count = uart_rx_read_some(zm_rx, sizeof(zm_rx), timeout);
+            if (zm_rx_count == 0) {
+                return ZM_TIMEOUT;
+            }
+        }
+
+        c = zm_rx[zm_rx_next++];
+
+    } while ((c & 0x7f) == XON || (c & 0x7f) == XOFF);
+
+    return c;
+
+}
+
+// Throw away everything received so far
+static void zm_purge(void) {
+
+    zm_rx_next = 0;
+    zm_rx_count = 0;
+    uart_rx_flush();
+
+}
+
+/**
+ * Read a byte of binary data, undoing ZDLE escapes. Returns the byte, ZM_FRAME_END with a frame end character, or
+ * ZM_TIMEOUT, ZM_ERROR, or ZM_CANCEL.
+ */
+static int zm_getc_escaped(void) {
+
+    int c, cans = 1;
+
+    if ((c = zm_getc(ZM_DATA_TIMEOUT)) != ZDLE) {
+        return c;
+    }
+
+    // ZDLE is also CAN, so this may be the start of a cancel
+    while ((c = zm_getc(ZM_DATA_TIMEOUT)) == CAN) {
+        if (++cans == 5) {
+            return ZM_CANCEL;
+        }
+    }
+
+    if (c < 0) {
+        return c;
+    }
+
+    switch (c) {
+        case ZCRCE:
+        case ZCRCG:
+        case ZCRCQ:
+        case ZCRCW:
+            return ZM_FRAME_END | c;
+        case ZRUB0:
+            return 0x7f;
+        case ZRUB1:
+            return 0xff;
+    }
+
+    if ((c & 0x60) == 0x40) {
+        return c ^ 0x40;
+    }
+
+    return ZM_ERROR;
+
+}
+
+/**
+ * Read two hex digits. Returns their value, or ZM_TIMEOUT or ZM_ERROR.
+ */
+static int zm_gethex(void) {
+
+    int c, i, value = 0;
+
+    for (i = 0; i < 2; i++) {
+
+        if ((c = zm_getc(ZM_DATA_TIMEOUT)) < 0) {
+            return c;
+        }
+
+        c &= 0x7f;
+        if (c >= '0' && c <= '9') {
+            value = (value << 4) | (c - '0');
+        } else if (c >= 'a' && c <= 'f') {
+            value = (value << 4) | (c - 'a' + 10);
+        } else {
+            return ZM_ERROR;
+        }
+
+    }
+
+    return value;
+
+}
+
+/**
+ * Wait for a header, skipping anything else. The four header bytes are stored in <hdr>, and <crc32> is set if the
+ * header, and so any subpackets after it, use CRC-32.
+ *
+ * Returns the frame type, or ZM_TIMEOUT, ZM_ERROR, or ZM_CANCEL.
+ */
+static int zm_read_header(uint8_t *hdr, uint8_t *crc32, uint32_t timeout) {
+
+    uint8_t raw[9];             // type, four bytes, and up to four bytes of CRC
+    uint32_t garbage = 0, crc;
+    int c, encoding, cans = 0, i, size;
+
+    // Find ZPAD, maybe two, then ZDLE and the encoding
+    do {
+
+        encoding = 0;
+
+        if ((c = zm_getc(timeout)) < 0) {
+            return c;
+        }
+
+        cans = c == CAN ? cans + 1 : 0;
+        if (cans == 5) {
+            return ZM_CANCEL;
+        }
+
+        if (c != ZPAD) {
+            if (++garbage > ZM_MAX_GARBAGE) {
+                return ZM_ERROR;
+            }
+            continue;
+        }
+
+        while ((c = zm_getc(ZM_DATA_TIMEOUT)) == ZPAD) {}
+        if (c == ZDLE) {
+            encoding = zm_getc(ZM_DATA_TIMEOUT);
+        }
+
+    } while (encoding != ZHEX && encoding != ZBIN && encoding != ZBIN32);
+
+    if (encoding == ZHEX) {
+
+        for (i = 0; i < 7; i++) {
+            if ((c = zm_gethex()) < 0) {
+                return c;
+            }
+            raw[i] = c;
+        }
+
+        // Hex headers end with CR and LF
+        if ((zm_getc(ZM_DATA_TIMEOUT) & 0x7f) == '\r') {
+            zm_getc(ZM_DATA_TIMEOUT);
+        }
+
+    } else {
+
+        size = encoding == ZBIN32 ? 9 : 7;
+        for (i = 0; i < size; i++) {
+            if ((c = zm_getc_escaped()) < 0 || c > 0xff) {
+                return c == ZM_CANCEL ? c : ZM_ERROR;
+            }
+            raw[i] = c;
+        }
+
+    }
+
+    if (encoding == ZBIN32) {
+        crc = raw[5] | (raw[6] << 8) | (raw[7] << 16) | ((uint32_t)raw[8] << 24);
+        if (crc32_buffer(0, raw, 5) != crc) {
+            return ZM_ERROR;
+        }
+    } else if (crc16_xmodem(0, raw, 7) != 0) {
+        return ZM_ERROR;
+    }
+
+    *crc32 = encoding == ZBIN32;
+    memcpy(hdr, raw + 1, 4);
+
+    return raw[0];
+
+}
+
+/**
+ * Read a data subpacket of at most <max> bytes into <buf>, and check its CRC.
+ *
+ * Returns the frame end character, or ZM_TIMEOUT, ZM_ERROR, or ZM_CANCEL.
+ */
+static int zm_read_data(uint8_t *buf, uint16_t max, uint16_t *size, uint8_t crc32) {
+
+    uint8_t crc[4], end;
+    uint16_t count = 0;
+    int c, i;
+
+    while ((c = zm_getc_escaped()) >= 0 && !(c & ZM_FRAME_END)) {
+        if (count == max) {
+            return ZM_ERROR;
+        }
+        buf[count++] = c;
+    }
+
+    if (c < 0) {
+        return c;
+    }
+
+    end = c & 0xff;
+
+    for (i = 0; i < (crc32 ? 4 : 2); i++) {
+        if ((c = zm_getc_escaped()) < 0 || c > 0xff) {
+            return c == ZM_CANCEL ? c : ZM_ERROR;
+        }
+        crc[i] = c;
+    }
+
+    // The CRC covers the frame end too
+    if (crc32) {
+        if (crc32_buffer(crc32_buffer(0, buf, count), &end, 1)
+                != (crc[0] | (crc[1] << 8) | (crc[2] << 16) | ((uint32_t)crc[3] << 24))) {
+            return ZM_ERROR;
+        }
+    } else if (crc16_xmodem(crc16_xmodem(crc16_xmodem(0, buf, count), &end, 1), crc, 2) != 0) {
+        return ZM_ERROR;
+    }
+
+    *size = count;
+
+    return end;
+
+}
+
+/**
+ * Send a hex header.
+ */
+static HAL_StatusTypeDef zm_send_header(const ZModem_ControlDef *ctrl, uint8_t type, const uint8_t *hdr) {
+
+    static const char hex[] = "0123456789abcdef";
+    uint8_t raw[7], frame[24], size = 0, i;
+    uint16_t crc;
+
+    raw[0] = type;
+    memcpy(raw + 1, hdr, 4);
+    crc = crc16_xmodem(0, raw, 5);
+    raw[5] = crc >> 8;
+    raw[6] = crc & 0xff;
+
+    frame[size++] = ZPAD;
+    frame[size++] = ZPAD;
+    frame[size++] = ZDLE;
+    frame[size++] = ZHEX;
+    for (i = 0; i < sizeof(raw); i++) {
+        frame[size++] = hex[raw[i] >> 4];
+        frame[size++] = hex[raw[i] & 0x0f];
+    }
+    frame[size++] = '\r';
+    frame[size++] = '\n' | 0x80;
+
+    // Undo any XOFF from line noise, except where the sender might take it for the start of something else
+    if (type != ZACK && type != ZFIN) {
+        frame[size++] = XON;
+    }
+
+    return HAL_UART_Transmit(ctrl->huart, frame, size, ZM_DATA_TIMEOUT);
+
+}
+
+static void zm_put_pos(uint8_t *hdr, uint32_t pos) {
+
+    hdr[0] = pos & 0xff;
+    hdr[1] = (pos >> 8) & 0xff;
+    hdr[2] = (pos >> 16) & 0xff;
+    hdr[3] = (pos >> 24) & 0xff;
+
+}
+
+static uint32_t zm_get_pos(const uint8_t *hdr) {
+
+    return hdr[0] | (hdr[1] << 8) | (hdr[2] << 16) | ((uint32_t)hdr[3] << 24);
+
+}
+
+static uint32_t zm_get_size(const uint8_t *buffer, uint16_t maxlen) {
+
+    const uint8_t *end = buffer + maxlen;
+    uint32_t val = 0;
+
+    while (buffer < end && *buffer >= '0' && *buffer <= '9') {
+        val = val * 10 + (uint32_t)*(buffer++) - '0';
+    }
+
+    return val;
+}
+
+/**
+ * Cancel the session: tell the sender, close any open file, and return the given result.
+ */
+static uint8_t zm_abort(const ZModem_ControlDef *ctrl, uint8_t open, uint8_t result) {
+
+    // Enough CANs to stop the sender, then backspaces to rub them out if it's a terminal
+    static const uint8_t cancel[] = { CAN, CAN, CAN, CAN, CAN, CAN, CAN, CAN, BS, BS, BS, BS, BS, BS, BS, BS };
+
+    HAL_UART_Transmit(ctrl->huart, (uint8_t *)cancel, sizeof(cancel), ZM_DATA_TIMEOUT);
+
+    if (open) {
+        ctrl->close(ctrl->cb_data, result);
+    }
+
+    return result;
+
+}
+
+uint8_t zmodem_receive(const ZModem_ControlDef *ctrl) {
+
+    // Static variables mean zmodem_receive is non-reentrant and not thread safe, but will work even with
+    // FreeRTOS' typically anemic stack depths.
+
+    // The longest subpacket, and a terminator for a ZFILE's name
+    static uint8_t data[ZM_MAX_DATA + 1];
+
+    uint8_t hdr[4], crc32 = 0;
+    uint8_t reply_type = ZRINIT, reply[4];  // what to send again if the sender goes quiet or garbles something
+    uint8_t open = 0, tries = 0, errors = 0;
+    uint32_t pos = 0, size;
+    uint16_t count, length;
+    int type, end;
+
+    zm_rx_next = 0;
+    zm_rx_count = 0;
+
+    memcpy(reply, zm_zrinit, sizeof(reply));
+    zm_send_header(ctrl, reply_type, reply);
+
+    do {
+
+        type = zm_read_header(hdr, &crc32, ZM_HEADER_TIMEOUT);
+
+        if (type == ZM_CANCEL) {
+            return zm_abort(ctrl, open, YMODEM_CANCEL);
+        }
+
+        // Nothing, or nothing intelligible: ask again
+        if (type < 0) {
+            if (++tries == ZM_RETRIES) {
+                return zm_abort(ctrl, open, type == ZM_TIMEOUT ? YMODEM_TIMEOUT : YMODEM_ERROR);
+            }
+            zm_purge();
+            zm_send_header(ctrl, reply_type, reply);
+            continue;
+        }
+
+        tries = 0;
+
+        switch (type) {
+
+            case ZSINIT:
+
+                // The options and attention string are for senders that can't watch for ZRPOS while sending
+                if ((end = zm_read_data(data, ZM_MAX_DATA, &count, crc32)) == ZM_CANCEL) {
+                    return zm_abort(ctrl, open, YMODEM_CANCEL);
+                }
+                zm_send_header(ctrl, end < 0 ? ZNAK : ZACK, zm_zero);
+                break;
+
+            case ZFILE:
+
+                if ((end = zm_read_data(data, ZM_MAX_DATA, &count, crc32)) == ZM_CANCEL) {
+                    return zm_abort(ctrl, open, YMODEM_CANCEL);
+                } else if (end < 0) {
+                    zm_send_header(ctrl, ZNAK, zm_zero);
+                    break;
+                }
+
+                // The same offer again means our ZRPOS was lost
+                if (open) {
+                    zm_send_header(ctrl, reply_type, reply);
+                    break;
+                }
+
+                // The name, a NUL, then the size in decimal, followed by other things we don't need
+                data[count] = '\0';
+                length = strnlen((char *)data, count);
+                size = length < count ? zm_get_size(data + length + 1, count - length - 1) : 0;
+
+                pos = 0;
+                if (ctrl->open(ctrl->cb_data, (char *)data, size, &pos) != YMODEM_OK) {
+                    return zm_abort(ctrl, 0, YMODEM_ERROR);
+                }
+
+                open = 1;
+                errors = 0;
+                reply_type = ZRPOS;
+                zm_put_pos(reply, pos);
+                zm_send_header(ctrl, reply_type, reply);
+                break;
+
+            case ZDATA:
+
+                // Data from before a ZRPOS, or for no file: ask again for what we want
+                if (!open || zm_get_pos(hdr) != pos) {
+                    zm_purge();
+                    zm_send_header(ctrl, reply_type, reply);
+                    break;
+                }
+
+                do {
+
+                    if ((end = zm_read_data(data, ZM_MAX_DATA, &count, crc32)) == ZM_CANCEL) {
+                        return zm_abort(ctrl, open, YMODEM_CANCEL);
+                    } else if (end < 0) {
+                        break;
+                    }
+
+                    // Consume the subpacket, or die trying
+                    if (ctrl->write(ctrl->cb_data, data, count) != YMODEM_OK) {
+                        return zm_abort(ctrl, open, YMODEM_CANCEL);
+                    }
+
+                    pos += count;
+                    errors = 0;
+                    zm_put_pos(reply, pos);
+
+                    if (end == ZCRCQ || end == ZCRCW) {
+                        zm_send_header(ctrl, ZACK, reply);
+                    }
+
+                } while (end == ZCRCG || end == ZCRCQ);
+
+                // A bad subpacket: drop whatever else is in flight and have it sent again from here
+                if (end < 0) {
+                    if (++errors == ZM_RETRIES) {
+                        return zm_abort(ctrl, open, end == ZM_TIMEOUT ? YMODEM_TIMEOUT : YMODEM_ERROR);
+                    }
+                    zm_purge();
+                    zm_send_header(ctrl, reply_type, reply);
+                }
+                break;
+
+            case ZEOF:
+
+                // An end that doesn't match is from before a ZRPOS, and the data after it is on its way
+                if (open && zm_get_pos(hdr) != pos) {
+                    break;
+                }
+
+                // Otherwise it's the end of the file, or a repeat because our ZRINIT was lost
+                if (open) {
+                    ctrl->close(ctrl->cb_data, YMODEM_OK);
+                    open = 0;
+                }
+
+                reply_type = ZRINIT;
+                memcpy(reply, zm_zrinit, sizeof(reply));
+                zm_send_header(ctrl, reply_type, reply);
+                break;
+
+            case ZFIN:
+
+                // Agree, and the sender signs off with "OO"
+                zm_send_header(ctrl, ZFIN, zm_zero);
+                zm_getc(ZM_DATA_TIMEOUT);
+                zm_getc(ZM_DATA_TIMEOUT);
+
+                if (open) {
+                    ctrl->close(ctrl->cb_data, YMODEM_ERROR);
+                    return YMODEM_ERROR;
+                }
+                return YMODEM_OK;
+
+            default:
+
+                // ZRQINIT, and anything we don't support: say what we're waiting for
+                zm_send_header(ctrl, reply_type, reply);
+                break;
+
+        }
+
+    } while (1);
+
+}
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""
+Build a sparse ROM image from a binary, for uploading as <name>.sparse (or <name>.sparse.lz4).
+
+The binary is split into blocks. Runs of blocks holding anything but 0xFF become data chunks; runs of blank blocks
+are left out, so the ROM keeps whatever it had there, or with --fill become fill chunks, which the programmer erases
+without the data being sent. The format is described in Src/sparse.c.
+
+Usage: mksparse.py [--base ADDRESS] [--block SIZE] [--fill] <input.bin> <output.sparse>
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = b'ROMS'
+VERSION = 1
+MAX_CHUNKS = 64         # SPARSE_MAX_CHUNKS
+
+DATA = 0
+FILL = 1
+
+
+def find_runs(image, block):
+    """Split the image into (start, end, blank) runs of whole blocks, the last possibly short."""
+    runs = []
+    for start in range(0, len(image), block):
+        piece = image[start:start + block]
+        blank = piece.count(0xff) == len(piece)
+        if runs and runs[-1][2] == blank:
+            runs[-1][1] = start + len(piece)
+        else:
+            runs.append([start, start + len(piece), blank])
+    return runs
+
+
+def limit_runs(runs, fill):
+    """Turn the shortest blank gaps between data into data until the chunk count fits."""
+    def chunks():
+        return sum(1 for run in runs if fill or not run[2])
+
+    while chunks() > MAX_CHUNKS:
+        gaps = [i for i in range(1, len(runs) - 1) if runs[i][2]]
+        if not gaps:
+            sys.exit('too many chunks')
+        i = min(gaps, key=lambda i: runs[i][1] - runs[i][0])
+        runs[i - 1:i + 2] = [[runs[i - 1][0], runs[i + 1][1], False]]
+
+    return runs
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Build a sparse ROM image from a binary.')
+    parser.add_argument('--base', type=lambda s: int(s, 0), default=0, help='ROM address of the first byte')
+    parser.add_argument('--block', type=lambda s: int(s, 0), default=4096, help='granularity of holes, in bytes')
+    parser.add_argument('--fill', action='store_true', help='erase blank blocks rather than leaving them alone')
+    parser.add_argument('input')
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as source:
+        image = source.read()
+
+    runs = limit_runs(find_runs(image, args.block), args.fill)
+
+    table = b''
+    data = b''
+    for start, end, blank in runs:
+        if blank and not args.fill:
+            continue
+        table += struct.pack('<III', args.base + start, end - start, FILL if blank else DATA)
+        if not blank:
+            data += image[start:end]
+
+    with open(args.output, 'wb') as output:
+        output.write(MAGIC + struct.pack('<HH', VERSION, len(table) // 12) + table + data)
+
+    print('%d chunks, %d of %d bytes sent' % (len(table) // 12, len(data), len(image)))
+
+
+if __name__ == '__main__':
+    main()
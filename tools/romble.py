@@ -0,0 +1,704 @@
+#!/usr/bin/env python3
+"""
+Drive a ROMble programmer from a Linux host: upload, dump, verify and diff ROM images, with progress and throughput.
+
+Everything goes over the binary request protocol described in Src/rpc.c. Requests are pipelined: as many are sent
+ahead as fit in the programmer's receive buffer, so the line never waits on a response, and the ROM programs one
+request's data while the next arrives. Uploads erase only the sectors the image covers, keeping whatever shares
+its first and last sectors, skip blank pages, and check the result with a CRC-32 the programmer computes.
+
+The programmer starts at 115200 baud. If it doesn't answer at the rate asked for, this finds the rate it's at and
+switches it over with the menu's b command; it keeps the new rate until it's reset.
+
+Usage: romble.py [--port PORT] [--baud RATE] [--target spi|sst] <command> ...
+
+    identify                                    describe the programmer and its ROMs
+    upload  <image> [--address A] [--changed]   erase, program and verify; --changed skips sectors that match
+    dump    <output> [--address A] [--length N] read the ROM into a file, the whole of it by default
+    verify  <image> [--address A]               compare CRCs, exit status 1 if the ROM differs
+    diff    <image> [--address A]               list the byte ranges that differ, exit status 1 if any do
+    clock   [HZ]                                set the SPI ROM clock, or calibrate it if no rate is given
+
+Try it without hardware against tools/romblesim.c, the device code running on a pseudo-terminal.
+"""
+
+import argparse
+import binascii
+import os
+import select
+import struct
+import sys
+import termios
+import time
+import tty
+import zlib
+
+# Src/rpc.c and Inc/rpc.h
+VERSION = 1
+
+OP_IDENTIFY = 0x01
+OP_READ = 0x02
+OP_ERASE = 0x03
+OP_PROGRAM = 0x04
+OP_CRC = 0x05
+OP_CLOCK = 0x06
+OP_EXIT = 0x07
+
+TARGETS = {'spi': 0, 'sst': 1}
+
+STATUS = {
+    0: 'ok',
+    1: 'unknown operation',
+    2: 'bad request',
+    3: 'no device',
+    4: 'ROM operation failed',
+    5: 'an earlier program failed',
+}
+
+# The menu's b command offers these, in this order; the first is the rate at reset
+BAUD_RATES = [115200, 460800, 921600, 2000000]
+SPEEDS = {
+    115200: termios.B115200,
+    460800: termios.B460800,
+    921600: termios.B921600,
+    2000000: termios.B2000000,
+}
+
+PROBE_TIMEOUT = 0.5         # seconds to wait for a response when looking for the programmer
+MENU_TIMEOUT = 2.0          # seconds to wait for the menu's baud rate prompts
+REPLY_TIMEOUT = 5.0         # seconds to wait for a quick response
+BOOT_CLOCK_HZ = 1000000     # an SPI clock at or below this is still the boot-time one, and worth calibrating
+DIFF_BLOCK = 4096           # granularity of CRC comparisons
+MAX_READS_AHEAD = 8         # reads in flight; their responses aren't limited by the window
+SHOW_DIFFS = 20             # differing ranges listed before just counting them
+
+
+class RombleError(Exception):
+    pass
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for byte in data:
+        if byte == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+            continue
+        block.append(byte)
+        if len(block) == 254:
+            out += b'\xff' + block
+            block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    """Decode a frame, or return None if it's malformed."""
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xff and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def crc16(data):
+    return binascii.crc_hqx(data, 0)
+
+
+def encoded_size(args):
+    """The most a request with this many argument bytes takes on the line: delimiters, header, CRC and COBS codes."""
+    frame = 3 + args + 2
+    return 1 + frame + frame // 254 + 1 + 1
+
+
+def human(count):
+    for unit in ('', 'K', 'M'):
+        if count < 1024 or count % 1024 or unit == 'M':
+            return '%d%s' % (count, unit) if unit else '%d bytes' % count
+        count //= 1024
+
+
+class Progress:
+    """One phase of a command: a running count on a terminal, then a line with its throughput."""
+
+    def __init__(self, label, total):
+        self.label = label
+        self.total = total
+        self.done = 0
+        self.start = time.monotonic()
+        self.shown = 0
+        self.live = sys.stderr.isatty()
+
+    def rate(self):
+        elapsed = time.monotonic() - self.start
+        return elapsed, (self.done / elapsed / 1024 if elapsed > 0 else 0)
+
+    def add(self, count):
+        self.done += count
+        now = time.monotonic()
+        if self.live and now - self.shown >= 0.1:
+            self.shown = now
+            elapsed, rate = self.rate()
+            percent = 100 * self.done // self.total if self.total else 100
+            sys.stderr.write('\r%s: %d/%d bytes, %d%%, %.1f KB/s ' % (self.label, self.done, self.total, percent,
+                                                                       rate))
+            sys.stderr.flush()
+
+    def finish(self, note=''):
+        elapsed, rate = self.rate()
+        if self.live:
+            sys.stderr.write('\r\033[K')
+        print('%s: %d bytes in %.2fs, %.1f KB/s%s' % (self.label, self.done, elapsed, rate, note))
+
+
+class Link:
+    """The serial line, and the requests sent on it that haven't been answered yet."""
+
+    def __init__(self, port):
+        try:
+            self.fd = os.open(port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        except OSError as e:
+            raise RombleError('%s: %s' % (port, e.strerror))
+        tty.setraw(self.fd)
+        self.baud = None
+        self.buffer = bytearray()
+        self.next_id = 1
+        self.waiting = []           # (id, op, encoded size) of requests sent, oldest first
+        self.window = 256           # until the programmer says how big it is
+        self.sent = 0
+        self.received = 0
+        self.opened = time.monotonic()
+
+    def set_baud(self, baud):
+        attributes = termios.tcgetattr(self.fd)
+        attributes[4] = attributes[5] = SPEEDS[baud]
+        termios.tcsetattr(self.fd, termios.TCSADRAIN, attributes)
+        self.baud = baud
+        self.drain()
+
+    def drain(self, wait=0.0):
+        """Throw away anything received, after letting it settle for a while."""
+        end = time.monotonic() + wait
+        while True:
+            ready, _, _ = select.select([self.fd], [], [], max(0.0, end - time.monotonic()))
+            if not ready:
+                break
+            try:
+                os.read(self.fd, 4096)
+            except BlockingIOError:
+                pass
+        termios.tcflush(self.fd, termios.TCIFLUSH)
+        self.buffer.clear()
+        self.waiting.clear()
+
+    def write(self, data):
+        data = memoryview(data)
+        while data:
+            select.select([], [self.fd], [])
+            try:
+                count = os.write(self.fd, data)
+            except BlockingIOError:
+                continue
+            data = data[count:]
+            self.sent += count
+
+    def read_more(self, deadline):
+        """Read whatever arrives before the deadline. Returns false if nothing did."""
+        ready, _, _ = select.select([self.fd], [], [], max(0.0, deadline - time.monotonic()))
+        if not ready:
+            return False
+        try:
+            data = os.read(self.fd, 65536)
+        except BlockingIOError:
+            return True
+        self.received += len(data)
+        self.buffer += data
+        return True
+
+    def read_text(self, wanted, timeout):
+        """Wait for some menu text to appear."""
+        deadline = time.monotonic() + timeout
+        while wanted not in self.buffer:
+            if not self.read_more(deadline):
+                return False
+        del self.buffer[:self.buffer.index(wanted) + len(wanted)]
+        return True
+
+    def send(self, op, args=b''):
+        request_id = self.next_id
+        self.next_id = (self.next_id + 1) & 0xffff
+        frame = struct.pack('<HB', request_id, op) + args
+        encoded = b'\0' + cobs_encode(frame + struct.pack('<H', crc16(frame))) + b'\0'
+        self.write(encoded)
+        self.waiting.append((request_id, op, len(encoded)))
+
+    def in_flight(self):
+        return sum(size for _, _, size in self.waiting)
+
+    def receive(self, timeout):
+        """Wait for the response to the oldest request. Returns its status and results."""
+        deadline = time.monotonic() + timeout
+        request_id, op, _ = self.waiting[0]
+        while True:
+            while 0 not in self.buffer:
+                if not self.read_more(deadline):
+                    raise RombleError('no response to request %d (op %d)' % (request_id, op))
+            end = self.buffer.index(0)
+            frame = cobs_decode(bytes(self.buffer[:end])) if end > 0 else None
+            del self.buffer[:end + 1]
+            if frame is None or len(frame) < 6 or struct.unpack('<H', frame[-2:])[0] != crc16(frame[:-2]):
+                continue
+            response_id, response_op, status = struct.unpack('<HBB', frame[:4])
+            if response_id != request_id:
+                if any(waiting[0] == response_id for waiting in self.waiting):
+                    raise RombleError('request %d (op %d) was lost on the line' % (request_id, op))
+                continue
+            self.waiting.pop(0)
+            return status, frame[4:-2]
+
+    def request(self, op, args=b'', timeout=REPLY_TIMEOUT):
+        """Send one request and wait for its results."""
+        self.send(op, args)
+        status, results = self.receive(timeout)
+        if status != 0:
+            raise RombleError('request failed: %s' % STATUS.get(status, 'status %d' % status))
+        return results
+
+    def pipeline(self, requests, handle=None, timeout=REPLY_TIMEOUT, most=None):
+        """
+        Send (op, args, context) requests, keeping as many unanswered as fit in the window, and pass each one's
+        context and results to handle() as they come back in order.
+        """
+        contexts = []
+        for op, args, context in requests:
+            size = encoded_size(len(args))
+            while self.waiting and (self.in_flight() + size > self.window
+                                    or (most is not None and len(self.waiting) >= most)):
+                self._collect(contexts, handle, timeout)
+            self.send(op, args)
+            contexts.append(context)
+        while self.waiting:
+            self._collect(contexts, handle, timeout)
+
+    def _collect(self, contexts, handle, timeout):
+        status, results = self.receive(timeout)
+        context = contexts.pop(0)
+        if status != 0:
+            self.drain(0.2)
+            raise RombleError('request failed: %s' % STATUS.get(status, 'status %d' % status))
+        if handle is not None:
+            handle(context, results)
+
+    def close(self):
+        try:
+            if self.baud is not None:
+                self.write(b'\0' + cobs_encode(self._exit_frame()) + b'\0')
+                termios.tcdrain(self.fd)
+        finally:
+            os.close(self.fd)
+
+    def _exit_frame(self):
+        frame = struct.pack('<HB', 0, OP_EXIT)
+        return frame + struct.pack('<H', crc16(frame))
+
+
+class Programmer:
+    """The programmer's ROMs, as described by an identify request."""
+
+    def __init__(self, link):
+        self.link = link
+        info = link.request(OP_IDENTIFY)
+        if len(info) < 41 or info[0] != VERSION:
+            raise RombleError('unsupported protocol version %d' % (info[0] if info else 0))
+        (self.version, self.max_data, self.window, self.spi_present, self.spi_manufacturer, self.spi_device,
+         self.spi_capacity, self.page_size) = struct.unpack('<BHHBBHIH', info[:15])
+        self.erase_sizes = [size for size in struct.unpack('<IIII', info[15:31]) if size]
+        self.spi_clock, self.sst_manufacturer, self.sst_device, self.sst_capacity = struct.unpack('<IBBI',
+                                                                                                   info[31:41])
+        link.window = self.window
+
+    def capacity(self, target):
+        if target == TARGETS['spi']:
+            if not self.spi_present:
+                raise RombleError('no SPI ROM found')
+            return self.spi_capacity
+        return self.sst_capacity
+
+    def align(self, target):
+        return self.erase_sizes[0] if target == TARGETS['spi'] else 4096
+
+    def largest_erase(self, target):
+        return self.erase_sizes[-1] if target == TARGETS['spi'] else 4096
+
+    def program_chunk(self):
+        """The biggest power of two data size for which three requests fit in the window, so the line keeps busy."""
+        chunk = 256
+        while chunk * 2 <= self.max_data and 3 * (chunk * 2 + 16) <= self.window:
+            chunk *= 2
+        return chunk
+
+    def read_seconds(self, target, length):
+        """Generous time for the programmer to read through part of a ROM."""
+        rate = self.spi_clock / 8 if target == TARGETS['spi'] and self.spi_clock else 500000
+        return REPLY_TIMEOUT + 3 * length / rate
+
+
+def connect(port, baud):
+    """Find the programmer, move it to the requested baud rate, and identify it."""
+    if baud not in SPEEDS:
+        raise RombleError('baud rate must be one of %s' % ', '.join(str(rate) for rate in BAUD_RATES))
+
+    link = Link(port)
+
+    try:
+        for rate in [baud] + [rate for rate in BAUD_RATES if rate != baud]:
+            link.set_baud(rate)
+            link.send(OP_IDENTIFY)
+            try:
+                link.receive(PROBE_TIMEOUT)
+            except RombleError:
+                link.drain()
+                continue
+            if rate != baud:
+                switch_baud(link, baud)
+            return link, Programmer(link)
+    except Exception:
+        link.close()
+        raise
+
+    link.close()
+    raise RombleError('no response from the programmer on %s' % port)
+
+
+def switch_baud(link, baud):
+    """Back to the menu, and through the b command to the new rate. The first request there keeps it."""
+    link.write(b'\0' + cobs_encode(link._exit_frame()) + b'\0')
+    link.drain(0.1)
+    link.write(b'b')
+    if not link.read_text(b'2000000\r\n', MENU_TIMEOUT):
+        raise RombleError('the programmer did not offer a baud rate change')
+    link.write(b'%d' % BAUD_RATES.index(baud))
+    if not link.read_text(b'keep it\r\n', MENU_TIMEOUT):
+        raise RombleError('the programmer did not change baud rate')
+    termios.tcdrain(link.fd)
+    link.set_baud(baud)
+
+
+def calibrate_if_slow(link, device, target):
+    """Find the fastest SPI clock the wiring carries, if the ROM is still at the crawl it's identified at."""
+    if target != TARGETS['spi'] or device.spi_clock > BOOT_CLOCK_HZ:
+        return
+    device.spi_clock = struct.unpack('<I', link.request(OP_CLOCK, struct.pack('<I', 0), timeout=30))[0]
+    print('SPI clock calibrated to %d kHz' % (device.spi_clock // 1000))
+
+
+def read_range(link, device, target, address, length, label=None):
+    """Read part of a ROM with pipelined requests."""
+    data = bytearray(length)
+    progress = Progress(label, length) if label else None
+
+    def requests():
+        for offset in range(0, length, device.max_data):
+            size = min(device.max_data, length - offset)
+            yield OP_READ, struct.pack('<BIH', target, address + offset, size), (offset, size)
+
+    def handle(context, results):
+        offset, size = context
+        if len(results) != size:
+            raise RombleError('short read at 0x%x' % (address + offset))
+        data[offset:offset + size] = results
+        if progress:
+            progress.add(size)
+
+    link.pipeline(requests(), handle, device.read_seconds(target, device.max_data), MAX_READS_AHEAD)
+    if progress:
+        progress.finish()
+    return bytes(data)
+
+
+def block_crcs(link, device, target, address, length, block, label):
+    """CRC-32s of each block of a range, as the programmer reads them."""
+    crcs = []
+    progress = Progress(label, length)
+
+    def requests():
+        for offset in range(0, length, block):
+            size = min(block, length - offset)
+            yield OP_CRC, struct.pack('<BII', target, address + offset, size), size
+
+    def handle(size, results):
+        crcs.append(struct.unpack('<I', results)[0])
+        progress.add(size)
+
+    link.pipeline(requests(), handle, device.read_seconds(target, block))
+    progress.finish()
+    return crcs
+
+
+def range_crc(link, device, target, address, length):
+    results = link.request(OP_CRC, struct.pack('<BII', target, address, length),
+                           timeout=device.read_seconds(target, length))
+    return struct.unpack('<I', results)[0]
+
+
+def erase_pieces(device, target, start, end):
+    """Split an aligned range at multiples of the largest erase, so progress shows and the programmer plans each."""
+    capacity = device.capacity(target)
+    if start == 0 and end == capacity:
+        yield start, end
+        return
+    largest = device.largest_erase(target)
+    while start < end:
+        piece = min(end, (start // largest + 1) * largest)
+        yield start, piece
+        start = piece
+
+
+def upload(link, device, target, address, image, changed):
+    capacity = device.capacity(target)
+    if address < 0 or address + len(image) > capacity:
+        raise RombleError('image does not fit: %s at 0x%x in a %s ROM' % (human(len(image)), address,
+                                                                         human(capacity)))
+
+    align = device.align(target)
+    start = address // align * align
+    end = -(-(address + len(image)) // align) * align
+    begun = time.monotonic()
+
+    calibrate_if_slow(link, device, target)
+
+    # Keep what shares the first and last sectors
+    head = read_range(link, device, target, start, address - start) if address > start else b''
+    tail_start = address + len(image)
+    tail = read_range(link, device, target, tail_start, end - tail_start) if end > tail_start else b''
+    image = head + image + tail
+
+    blocks = list(range(start, end, align))
+    if changed:
+        crcs = block_crcs(link, device, target, start, end - start, align, 'compare')
+        blocks = [block for block, crc in zip(blocks, crcs)
+                  if zlib.crc32(image[block - start:block - start + align]) != crc]
+        print('%d of %d sectors differ' % (len(blocks), len(crcs)))
+        if not blocks:
+            return
+
+    # Runs of consecutive sectors
+    runs = []
+    for block in blocks:
+        if runs and runs[-1][1] == block:
+            runs[-1][1] = block + align
+        else:
+            runs.append([block, block + align])
+
+    total = sum(run_end - run_start for run_start, run_end in runs)
+
+    progress = Progress('erase', total)
+    link.pipeline(((OP_ERASE, struct.pack('<BII', target, piece_start, piece_end - piece_start),
+                    piece_end - piece_start)
+                   for run_start, run_end in runs
+                   for piece_start, piece_end in erase_pieces(device, target, run_start, run_end)),
+                  lambda size, results: progress.add(size), timeout=300 if total == capacity else 60)
+    progress.finish()
+
+    # Erased ROM is already all ones, so blank chunks needn't be sent
+    chunk = device.program_chunk()
+    progress = Progress('program', total)
+    skipped = [0]
+
+    def requests():
+        for run_start, run_end in runs:
+            for offset in range(run_start, run_end, chunk):
+                data = image[offset - start:min(offset + chunk, run_end) - start]
+                if data.count(0xff) == len(data):
+                    skipped[0] += len(data)
+                    progress.add(len(data))
+                    continue
+                yield OP_PROGRAM, struct.pack('<BI', target, offset) + data, len(data)
+
+    link.pipeline(requests(), lambda size, results: progress.add(size))
+    progress.finish(', %d blank bytes skipped' % skipped[0] if skipped[0] else '')
+
+    # Everything programmed is checked in one go; whatever failed shows up here too
+    progress = Progress('verify', end - start)
+    crc = range_crc(link, device, target, start, end - start)
+    progress.add(end - start)
+    progress.finish()
+
+    if crc != zlib.crc32(image):
+        raise RombleError('verify failed: the ROM has CRC %08x, the image %08x' % (crc, zlib.crc32(image)))
+
+    print('uploaded %s at 0x%x in %.2fs' % (human(len(image) - len(head) - len(tail)), address,
+                                          time.monotonic() - begun))
+
+
+def compare_blocks(link, device, target, address, image):
+    """Offsets into the image of the DIFF_BLOCK blocks whose CRCs differ from the ROM's."""
+    crcs = block_crcs(link, device, target, address, len(image), DIFF_BLOCK, 'compare')
+    return [offset for offset, crc in zip(range(0, len(image), DIFF_BLOCK), crcs)
+            if zlib.crc32(image[offset:offset + DIFF_BLOCK]) != crc]
+
+
+def check_fits(device, target, address, length):
+    if address < 0 or address + length > device.capacity(target):
+        raise RombleError('0x%x bytes at 0x%x run past the end of the ROM' % (length, address))
+
+
+def verify(link, device, target, address, image):
+    check_fits(device, target, address, len(image))
+    calibrate_if_slow(link, device, target)
+
+    progress = Progress('verify', len(image))
+    crc = range_crc(link, device, target, address, len(image))
+    progress.add(len(image))
+    progress.finish()
+
+    if crc == zlib.crc32(image):
+        print('ROM matches the image')
+        return 0
+
+    differ = compare_blocks(link, device, target, address, image)
+    print('ROM differs from the image in %d of %d %s blocks, the first at 0x%x'
+          % (len(differ), -(-len(image) // DIFF_BLOCK), human(DIFF_BLOCK), address + differ[0]) if differ
+          else 'ROM differs from the image')
+    return 1
+
+
+def diff(link, device, target, address, image):
+    check_fits(device, target, address, len(image))
+    calibrate_if_slow(link, device, target)
+
+    differ = compare_blocks(link, device, target, address, image)
+    ranges = []
+
+    def requests():
+        for block in differ:
+            for offset in range(block, min(block + DIFF_BLOCK, len(image)), device.max_data):
+                size = min(device.max_data, len(image) - offset, block + DIFF_BLOCK - offset)
+                yield OP_READ, struct.pack('<BIH', target, address + offset, size), (offset, size)
+
+    def handle(context, actual):
+        offset, size = context
+        expected = image[offset:offset + size]
+        if len(actual) != size:
+            raise RombleError('short read at 0x%x' % (address + offset))
+        for i in range(size):
+            if expected[i] == actual[i]:
+                continue
+            if ranges and ranges[-1][1] == offset + i:
+                ranges[-1][1] += 1
+            else:
+                ranges.append([offset + i, offset + i + 1])
+        progress.add(size)
+
+    if differ:
+        progress = Progress('read', sum(min(DIFF_BLOCK, len(image) - block) for block in differ))
+        link.pipeline(requests(), handle, device.read_seconds(target, device.max_data), MAX_READS_AHEAD)
+        progress.finish()
+
+    for first, last in ranges[:SHOW_DIFFS]:
+        print('0x%06x-0x%06x  %d bytes differ' % (address + first, address + last - 1, last - first))
+    if len(ranges) > SHOW_DIFFS:
+        print('... and %d more ranges' % (len(ranges) - SHOW_DIFFS))
+    print('%d bytes differ in %d ranges' % (sum(last - first for first, last in ranges), len(ranges))
+          if ranges else 'ROM matches the image')
+
+    return 1 if ranges else 0
+
+
+def identify(device, link):
+    print('Protocol version %d, %d bytes per request, %d byte window, %d baud'
+          % (device.version, device.max_data, device.window, link.baud))
+    if device.spi_present:
+        print('SPI ROM: manufacturer %02x, device %04x, %s, %d-byte pages, erases %s, clock %d kHz'
+              % (device.spi_manufacturer, device.spi_device, human(device.spi_capacity), device.page_size,
+                 ' '.join(human(size) for size in device.erase_sizes), device.spi_clock // 1000))
+    else:
+        print('SPI ROM: not found')
+    print('SST ROM: manufacturer %02x, device %02x, %s'
+          % (device.sst_manufacturer, device.sst_device, human(device.sst_capacity)))
+
+
+def read_image(path):
+    with open(path, 'rb') as source:
+        return source.read()
+
+
+def main():
+    number = lambda s: int(s, 0)
+
+    parser = argparse.ArgumentParser(description='Upload, dump, verify and diff ROM images on a ROMble programmer.')
+    parser.add_argument('--port', default=os.environ.get('ROMBLE_PORT', '/dev/ttyACM0'),
+                        help='serial port, or $ROMBLE_PORT (default /dev/ttyACM0)')
+    parser.add_argument('--baud', type=int, default=BAUD_RATES[-1], help='baud rate (default %(default)d)')
+    parser.add_argument('--target', choices=TARGETS, default='spi', help='which ROM (default spi)')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    commands.add_parser('identify', help='describe the programmer and its ROMs')
+
+    command = commands.add_parser('upload', help='erase, program and verify an image')
+    command.add_argument('image')
+    command.add_argument('--address', type=number, default=0)
+    command.add_argument('--changed', action='store_true', help='only rewrite sectors that differ')
+
+    command = commands.add_parser('dump', help='read the ROM into a file')
+    command.add_argument('output')
+    command.add_argument('--address', type=number, default=0)
+    command.add_argument('--length', type=number, help='bytes to read (default to the end of the ROM)')
+
+    for name, text in (('verify', 'check the ROM holds an image'), ('diff', 'list where the ROM and an image differ')):
+        command = commands.add_parser(name, help=text)
+        command.add_argument('image')
+        command.add_argument('--address', type=number, default=0)
+
+    command = commands.add_parser('clock', help='set the SPI ROM clock, or calibrate it')
+    command.add_argument('hz', type=number, nargs='?', default=0)
+
+    args = parser.parse_args()
+    target = TARGETS[args.target]
+    status = 0
+
+    try:
+        link, device = connect(args.port, args.baud)
+    except RombleError as e:
+        sys.exit('romble: %s' % e)
+
+    try:
+        if args.command == 'identify':
+            identify(device, link)
+        elif args.command == 'upload':
+            upload(link, device, target, args.address, read_image(args.image), args.changed)
+        elif args.command == 'dump':
+            calibrate_if_slow(link, device, target)
+            length = args.length if args.length is not None else device.capacity(target) - args.address
+            check_fits(device, target, args.address, length)
+            data = read_range(link, device, target, args.address, length, 'dump')
+            with open(args.output, 'wb') as output:
+                output.write(data)
+        elif args.command == 'verify':
+            status = verify(link, device, target, args.address, read_image(args.image))
+        elif args.command == 'diff':
+            status = diff(link, device, target, args.address, read_image(args.image))
+        elif args.command == 'clock':
+            results = link.request(OP_CLOCK, struct.pack('<I', args.hz), timeout=30)
+            print('SPI clock %d kHz' % (struct.unpack('<I', results)[0] // 1000))
+        elapsed = time.monotonic() - link.opened
+        print('line: %d bytes out, %d bytes in, %.2fs at %d baud' % (link.sent, link.received, elapsed, link.baud))
+    except (RombleError, OSError) as e:
+        status = 'romble: %s' % e
+    except KeyboardInterrupt:
+        status = 'romble: interrupted'
+    finally:
+        link.close()
+
+    sys.exit(status)
+
+
+if __name__ == '__main__':
+    main()
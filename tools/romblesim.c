@@ -0,0 +1,1618 @@
+/**
+ * Host simulator for the ROMble programmer, so host tools can be run, tested and benchmarked without the hardware.
+ *
+ * The device's own code - the CLI, YMODEM and ZMODEM, the binary protocol, the ROM writer and the SPI Flash driver -
+ * is compiled for the host unchanged, against the real HAL and FreeRTOS headers. Underneath it, this file supplies:
+ *
+ *      the UART        a pseudo-terminal, whose slave side the host opens like any serial port
+ *      the RTOS        the CMSIS-RTOS2 calls the code makes, over POSIX threads
+ *      the SPI ROM     a W25Q-style part on the SPI bus, decoding the commands clocked into it, with an SFDP table
+ *      the SST ROM     an SST39LF020 behind the sstrom.h calls
+ *      the rest        timing over the host clock, a software CRC-32
+ *
+ * Both ROMs behave like Flash: programming can only clear bits, and erasing sets them again. The SPI ROM complains
+ * about commands the real part would ignore, such as a program without a write enable, or anything but a status
+ * read while it's busy. The SST ROM fails programs that need an erase first, as the real part's data polling would.
+ *
+ * The serial line speed matters as it does with the hardware: bytes only get through while the host has the
+ * pseudo-terminal set to the UART's current baud rate, so baud rate changes are exercised too. The receive side
+ * holds no more than the device's DMA and stream buffers, and drops what doesn't fit. With -t, the UART takes as
+ * long as a real one to move each byte, the SPI bus as long as its clock takes, and the ROMs their datasheet times
+ * to program and erase, so throughput is close to the hardware's; without it, everything runs as fast as it can.
+ *
+ * Build from the repository root with "make sim", then run
+ *
+ *   build/romblesim [-t] [-l LINK] [-f SPI_IMAGE] [-p SST_IMAGE] [-s SIZE] [-m HZ] [-n]
+ *
+ *      -t      real timing, as above
+ *      -l      make LINK a symbolic link to the pseudo-terminal, for a fixed name to connect to
+ *      -f, -p  keep the SPI or SST ROM's contents in a file, created erased if it doesn't exist
+ *      -s      SPI ROM capacity in bytes, a power of two from 64K to 16M, with an optional K or M (default 4M)
+ *      -m      the fastest SPI clock the simulated wiring carries; reads any faster come back corrupted
+ *      -n      leave out the SFDP table, as older parts do
+ *
+ * It prints the pseudo-terminal's path. Interrupt it to stop, and it prints counts of what went over the line and
+ * into the ROMs.
+ */
+
+#define _GNU_SOURCE                 // posix_openpt() and friends
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cmsis_os.h"
+#include "task.h"
+
+#include "main.h"
+#include "cli.h"
+#include "crc32.h"
+#include "sstrom.h"
+#include "uartrx.h"
+#include "timing.h"
+
+// After the HAL: the CMSIS register structs have fields named after the termios output delay macros, unused here
+#include <termios.h>
+#undef CR0
+#undef CR1
+#undef CR2
+#undef CR3
+
+#define SIM_BAUD_DEFAULT        115200      // the rate MX_USART2_UART_Init() starts the UART at
+#define SIM_RX_SIZE             (UART_RX_DMA_SIZE + UART_RX_STREAM_SIZE)    // all the receive buffering there is
+#define SIM_TX_STALL_MS         1000        // output the host leaves unread for this long is thrown away
+#define SIM_CYCLES_PER_US       100         // timing_cycles() counts at the STM32's 100MHz
+#define SIM_PCLK_HZ             50000000    // APB1, which SPI3 hangs off
+#define SIM_SPI_SLEEP_NS        200000      // SPI transfer time is slept off once this much has built up
+
+// SPI ROM commands understood
+#define SIM_CMD_PAGE_PROGRAM    0x02
+#define SIM_CMD_READ            0x03
+#define SIM_CMD_WRITE_DISABLE   0x04
+#define SIM_CMD_READ_STATUS_1   0x05
+#define SIM_CMD_WRITE_ENABLE    0x06
+#define SIM_CMD_READ_FAST       0x0B
+#define SIM_CMD_ERASE_SECTOR    0x20
+#define SIM_CMD_ERASE_BLOCK     0x52
+#define SIM_CMD_READ_SFDP       0x5A
+#define SIM_CMD_ERASE_CHIP_ALT  0x60
+#define SIM_CMD_JEDEC_ID        0x9F
+#define SIM_CMD_ERASE_CHIP      0xC7
+#define SIM_CMD_ERASE_LARGE     0xD8
+
+#define SIM_SPI_MANUFACTURER    0xEF        // Winbond
+#define SIM_SPI_MEMORY_TYPE     0x40        // W25Q, followed by the capacity as a power of two
+#define SIM_SPI_PAGE            256
+#define SIM_SPI_MIN_SIZE        (64 * 1024)
+#define SIM_SPI_MAX_SIZE        (16 * 1024 * 1024)
+
+// W25Q32JV typical times, which the SFDP table advertises rounded up to its units
+#define SIM_SPI_PROGRAM_US      400
+#define SIM_SPI_SECTOR_US       45000
+#define SIM_SPI_BLOCK_US        120000
+#define SIM_SPI_LARGE_US        150000
+#define SIM_SPI_CHIP_US_PER_MB  2500000
+
+#define SIM_SFDP_SIZE           256
+#define SIM_SFDP_BFPT           0x80        // where the basic flash parameter table sits in the SFDP space
+#define SIM_SFDP_BFPT_DWORDS    11
+
+#define SIM_SST_MANUFACTURER    0xBF        // SST
+#define SIM_SST_DEVICE          0xD6        // SST39LF020
+#define SIM_SST_PROGRAM_US      14
+#define SIM_SST_SECTOR_US       18000
+#define SIM_SST_CHIP_US         70000
+
+typedef struct __Sim_Thread {
+    pthread_t thread;
+    osThreadFunc_t func;
+    void *argument;
+} Sim_Thread;
+
+typedef struct __Sim_Semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint32_t count;
+    uint32_t max;
+} Sim_Semaphore;
+
+typedef struct __Sim_Queue {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    uint8_t *data;
+    uint32_t size;                  // bytes per message
+    uint32_t slots;
+    uint32_t head;                  // slot of the oldest message
+    uint32_t count;
+} Sim_Queue;
+
+// Everything the UART has received that the device hasn't read yet
+typedef struct __Sim_Receiver {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    uint8_t data[SIM_RX_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint32_t dropped;
+} Sim_Receiver;
+
+typedef struct __Sim_SPIFlash {
+    uint8_t *memory;
+    uint32_t capacity;
+    uint8_t sfdp[SIM_SFDP_SIZE];
+    uint32_t max_hz;                // fastest clock that reads back cleanly, zero for any
+    uint8_t selected;
+    uint8_t command;
+    uint8_t ignored;                // the current command is being ignored
+    uint32_t index;                 // bytes clocked in since chip select went low
+    uint32_t address;
+    uint8_t write_enabled;
+    uint64_t busy_until;            // host clock nanoseconds
+    uint8_t page[SIM_SPI_PAGE];     // page program data, wrapping within the page like the real thing
+} Sim_SPIFlash;
+
+typedef struct __Sim_Stats {
+    uint64_t rx_bytes;
+    uint64_t rx_garbled;            // sent at the wrong baud rate
+    uint64_t tx_bytes;
+    uint64_t tx_garbled;
+    uint64_t tx_lost;               // the host didn't read them
+    uint64_t spi_programs;
+    uint64_t spi_erases;
+    uint64_t sst_programs;
+    uint64_t sst_erases;
+    uint64_t warnings;
+} Sim_Stats;
+
+static uint8_t sim_timed = 0;
+static int sim_master = -1;
+static uint64_t sim_epoch;
+
+static UART_HandleTypeDef sim_uart;
+static SPI_TypeDef sim_spi_regs;
+static SPI_HandleTypeDef sim_spi;
+
+static Sim_Receiver sim_rx;
+static Sim_SPIFlash sim_flash;
+static uint8_t *sim_sst;
+static Sim_Stats sim_stats;
+
+static __thread uint64_t sim_spi_owed = 0;
+
+static uint32_t sim_crc32_table[256];
+static uint32_t sim_crc32_stream;
+
+/*
+ * Host support
+ */
+
+static uint64_t sim_now_ns(void)
+{
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+
+}
+
+static void sim_sleep_until(uint64_t when)
+{
+
+    struct timespec ts;
+
+    ts.tv_sec = when / 1000000000u;
+    ts.tv_nsec = when % 1000000000u;
+
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+
+}
+
+static void sim_sleep_ns(uint64_t ns)
+{
+
+    sim_sleep_until(sim_now_ns() + ns);
+
+}
+
+static void sim_warn(const char *format, ...)
+{
+
+    va_list args;
+
+    va_start(args, format);
+    fprintf(stderr, "romblesim: ");
+    vfprintf(stderr, format, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+
+    sim_stats.warnings++;
+
+}
+
+static void sim_cond_init(pthread_cond_t *cond)
+{
+
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+}
+
+// The absolute time an RTOS timeout in ticks runs out
+static struct timespec sim_deadline(uint32_t timeout)
+{
+
+    uint64_t when = sim_now_ns() + (uint64_t)timeout * 1000000u;
+    struct timespec ts = { when / 1000000000u, when % 1000000000u };
+
+    return ts;
+
+}
+
+/*
+ * Wait for a condition to be signalled, with the RTOS's timeout conventions. Returns false once the deadline has
+ * passed, or straight away for a zero timeout.
+ */
+static uint8_t sim_wait(pthread_cond_t *cond, pthread_mutex_t *lock, uint32_t timeout, const struct timespec *deadline)
+{
+
+    if (timeout == 0) {
+        return 0;
+    }
+
+    if (timeout == osWaitForever) {
+        pthread_cond_wait(cond, lock);
+        return 1;
+    }
+
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+
+}
+
+/*
+ * CMSIS-RTOS2 and FreeRTOS
+ */
+
+static void *sim_thread(void *arg)
+{
+
+    Sim_Thread *thread = (Sim_Thread *)arg;
+
+    thread->func(thread->argument);
+
+    return NULL;
+
+}
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void *argument, const osThreadAttr_t *attr)
+{
+
+    Sim_Thread *thread = calloc(1, sizeof(Sim_Thread));
+
+    UNUSED(attr);
+
+    if (thread == NULL) {
+        return NULL;
+    }
+
+    thread->func = func;
+    thread->argument = argument;
+
+    if (pthread_create(&thread->thread, NULL, sim_thread, thread) != 0) {
+        free(thread);
+        return NULL;
+    }
+
+    pthread_detach(thread->thread);
+
+    return (osThreadId_t)thread;
+
+}
+
+uint32_t osKernelGetTickCount(void)
+{
+
+    return (sim_now_ns() - sim_epoch) / 1000000u;
+
+}
+
+osStatus_t osDelay(uint32_t ticks)
+{
+
+    sim_sleep_ns((uint64_t)ticks * 1000000u);
+
+    return osOK;
+
+}
+
+osSemaphoreId_t osSemaphoreNew(uint32_t max_count, uint32_t initial_count, const osSemaphoreAttr_t *attr)
+{
+
+    Sim_Semaphore *semaphore = calloc(1, sizeof(Sim_Semaphore));
+
+    UNUSED(attr);
+
+    if (semaphore == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&semaphore->lock, NULL);
+    sim_cond_init(&semaphore->changed);
+    semaphore->count = initial_count;
+    semaphore->max = max_count;
+
+    return (osSemaphoreId_t)semaphore;
+
+}
+
+osStatus_t osSemaphoreAcquire(osSemaphoreId_t semaphore_id, uint32_t timeout)
+{
+
+    Sim_Semaphore *semaphore = (Sim_Semaphore *)semaphore_id;
+    struct timespec deadline = sim_deadline(timeout);
+    osStatus_t status = osOK;
+
+    pthread_mutex_lock(&semaphore->lock);
+
+    while (semaphore->count == 0) {
+        if (!sim_wait(&semaphore->changed, &semaphore->lock, timeout, &deadline)) {
+            break;
+        }
+    }
+
+    if (semaphore->count > 0) {
+        semaphore->count--;
+    } else {
+        status = timeout == 0 ? osErrorResource : osErrorTimeout;
+    }
+
+    pthread_mutex_unlock(&semaphore->lock);
+
+    return status;
+
+}
+
+osStatus_t osSemaphoreRelease(osSemaphoreId_t semaphore_id)
+{
+
+    Sim_Semaphore *semaphore = (Sim_Semaphore *)semaphore_id;
+    osStatus_t status = osErrorResource;
+
+    pthread_mutex_lock(&semaphore->lock);
+
+    if (semaphore->count < semaphore->max) {
+        semaphore->count++;
+        pthread_cond_broadcast(&semaphore->changed);
+        status = osOK;
+    }
+
+    pthread_mutex_unlock(&semaphore->lock);
+
+    return status;
+
+}
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t *attr)
+{
+
+    Sim_Queue *queue = calloc(1, sizeof(Sim_Queue));
+
+    UNUSED(attr);
+
+    if (queue == NULL || (queue->data = calloc(msg_count, msg_size)) == NULL) {
+        free(queue);
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    sim_cond_init(&queue->changed);
+    queue->size = msg_size;
+    queue->slots = msg_count;
+
+    return (osMessageQueueId_t)queue;
+
+}
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void *msg_ptr, uint8_t msg_prio, uint32_t timeout)
+{
+
+    Sim_Queue *queue = (Sim_Queue *)mq_id;
+    struct timespec deadline = sim_deadline(timeout);
+    osStatus_t status = osOK;
+
+    UNUSED(msg_prio);
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == queue->slots) {
+        if (!sim_wait(&queue->changed, &queue->lock, timeout, &deadline)) {
+            break;
+        }
+    }
+
+    if (queue->count < queue->slots) {
+        memcpy(queue->data + ((queue->head + queue->count) % queue->slots) * queue->size, msg_ptr, queue->size);
+        queue->count++;
+        pthread_cond_broadcast(&queue->changed);
+    } else {
+        status = timeout == 0 ? osErrorResource : osErrorTimeout;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return status;
+
+}
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void *msg_ptr, uint8_t *msg_prio, uint32_t timeout)
+{
+
+    Sim_Queue *queue = (Sim_Queue *)mq_id;
+    struct timespec deadline = sim_deadline(timeout);
+    osStatus_t status = osOK;
+
+    pthread_mutex_lock(&queue->lock);
+
+    while (queue->count == 0) {
+        if (!sim_wait(&queue->changed, &queue->lock, timeout, &deadline)) {
+            break;
+        }
+    }
+
+    if (queue->count > 0) {
+        memcpy(msg_ptr, queue->data + queue->head * queue->size, queue->size);
+        queue->head = (queue->head + 1) % queue->slots;
+        queue->count--;
+        pthread_cond_broadcast(&queue->changed);
+        if (msg_prio != NULL) {
+            *msg_prio = 0;
+        }
+    } else {
+        status = timeout == 0 ? osErrorResource : osErrorTimeout;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    return status;
+
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+
+    return osKernelGetTickCount();
+
+}
+
+// Host threads have stacks in megabytes, so there's nothing useful to report
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t xTask)
+{
+
+    UNUSED(xTask);
+
+    return 0;
+
+}
+
+uint32_t HAL_GetTick(void)
+{
+
+    return osKernelGetTickCount();
+
+}
+
+/*
+ * Timing
+ */
+
+HAL_StatusTypeDef timing_init(TIM_HandleTypeDef *htim)
+{
+
+    UNUSED(htim);
+
+    return HAL_OK;
+
+}
+
+void timing_sleep_us(uint32_t us)
+{
+
+    sim_sleep_ns((uint64_t)us * 1000u);
+
+}
+
+void timing_timer_elapsed(TIM_HandleTypeDef *htim)
+{
+
+    UNUSED(htim);
+
+}
+
+uint32_t timing_cycles(void)
+{
+
+    return (uint32_t)(sim_now_ns() * SIM_CYCLES_PER_US / 1000u);
+
+}
+
+uint32_t timing_elapsed_us(uint32_t since)
+{
+
+    return (timing_cycles() - since) / SIM_CYCLES_PER_US;
+
+}
+
+void timing_spin_us(uint32_t us)
+{
+
+    uint64_t until = sim_now_ns() + (uint64_t)us * 1000u;
+
+    while (sim_now_ns() < until) {}
+
+}
+
+/*
+ * CRC-32, in software only
+ */
+
+HAL_StatusTypeDef crc32_init(CRC_HandleTypeDef *hcrc)
+{
+
+    uint32_t i, j, crc;
+
+    UNUSED(hcrc);
+
+    for (i = 0; i < 256; i++) {
+        crc = i;
+        for (j = 0; j < 8; j++) {
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+        }
+        sim_crc32_table[i] = crc;
+    }
+
+    return HAL_OK;
+
+}
+
+uint32_t crc32_buffer(uint32_t crc, const uint8_t *data, uint32_t size)
+{
+
+    crc = ~crc;
+
+    while (size--) {
+        crc = sim_crc32_table[(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    }
+
+    return ~crc;
+
+}
+
+void crc32_start(void)
+{
+
+    sim_crc32_stream = 0;
+
+}
+
+void crc32_update(const uint8_t *data, uint32_t size)
+{
+
+    sim_crc32_stream = crc32_buffer(sim_crc32_stream, data, size);
+
+}
+
+uint32_t crc32_value(void)
+{
+
+    return sim_crc32_stream;
+
+}
+
+/*
+ * UART, over the pseudo-terminal
+ */
+
+static speed_t sim_speed(uint32_t baud)
+{
+
+    switch (baud) {
+        case 115200:    return B115200;
+        case 230400:    return B230400;
+        case 460800:    return B460800;
+        case 921600:    return B921600;
+        case 1000000:   return B1000000;
+        case 2000000:   return B2000000;
+        default:        return B0;
+    }
+
+}
+
+// Whether the host has its end of the line at the same speed as the UART, without which nothing gets through
+static uint8_t sim_line_matches(uint32_t baud)
+{
+
+    struct termios tio;
+
+    if (tcgetattr(sim_master, &tio) != 0) {
+        return 0;
+    }
+
+    return cfgetospeed(&tio) == sim_speed(baud);
+
+}
+
+// Nanoseconds to move a number of bytes at a baud rate, at ten bits a byte
+static uint64_t sim_line_ns(uint32_t bytes, uint32_t baud)
+{
+
+    return (uint64_t)bytes * 10000000000u / baud;
+
+}
+
+// Receive from the host, at the line's pace if timing is real, into the buffer the device reads from
+static void *sim_receive(void *arg)
+{
+
+    struct pollfd fd = { sim_master, POLLIN, 0 };
+    uint8_t data[64];
+    uint64_t due = 0, now;
+    uint32_t baud;
+    ssize_t count, i;
+
+    UNUSED(arg);
+
+    while (1) {
+
+        poll(&fd, 1, -1);
+
+        if ((count = read(sim_master, data, sizeof(data))) <= 0) {
+            continue;
+        }
+
+        baud = sim_uart.Init.BaudRate;
+
+        if (!sim_line_matches(baud)) {
+            sim_stats.rx_garbled += count;
+            continue;
+        }
+
+        if (sim_timed) {
+            now = sim_now_ns();
+            due = (due > now ? due : now) + sim_line_ns(count, baud);
+            sim_sleep_until(due);
+        }
+
+        sim_stats.rx_bytes += count;
+
+        pthread_mutex_lock(&sim_rx.lock);
+        for (i = 0; i < count; i++) {
+            if (sim_rx.count == SIM_RX_SIZE) {
+                sim_rx.dropped++;
+                continue;
+            }
+            sim_rx.data[(sim_rx.head + sim_rx.count++) % SIM_RX_SIZE] = data[i];
+        }
+        pthread_cond_broadcast(&sim_rx.ready);
+        pthread_mutex_unlock(&sim_rx.lock);
+
+    }
+
+    return NULL;
+
+}
+
+// Take up to the given number of bytes from the receive buffer. Called with the lock held.
+static uint16_t sim_take(uint8_t *data, uint16_t size)
+{
+
+    uint16_t count = 0;
+
+    while (count < size && sim_rx.count > 0) {
+        data[count++] = sim_rx.data[sim_rx.head];
+        sim_rx.head = (sim_rx.head + 1) % SIM_RX_SIZE;
+        sim_rx.count--;
+    }
+
+    return count;
+
+}
+
+HAL_StatusTypeDef uart_rx_start(UART_HandleTypeDef *huart)
+{
+
+    UNUSED(huart);
+
+    uart_rx_flush();
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef uart_rx_read(uint8_t *data, uint16_t size, uint32_t timeout)
+{
+
+    struct timespec deadline = sim_deadline(timeout);
+    uint16_t received = 0;
+
+    pthread_mutex_lock(&sim_rx.lock);
+
+    while ((received += sim_take(data + received, size - received)) < size) {
+        if (!sim_wait(&sim_rx.ready, &sim_rx.lock, timeout, &deadline)) {
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&sim_rx.lock);
+
+    return received == size ? HAL_OK : HAL_TIMEOUT;
+
+}
+
+uint16_t uart_rx_read_some(uint8_t *data, uint16_t size, uint32_t timeout)
+{
+
+    struct timespec deadline = sim_deadline(timeout);
+    uint16_t received;
+
+    pthread_mutex_lock(&sim_rx.lock);
+
+    while (sim_rx.count == 0) {
+        if (!sim_wait(&sim_rx.ready, &sim_rx.lock, timeout, &deadline)) {
+            break;
+        }
+    }
+
+    received = sim_take(data, size);
+
+    pthread_mutex_unlock(&sim_rx.lock);
+
+    return received;
+
+}
+
+void uart_rx_flush(void)
+{
+
+    pthread_mutex_lock(&sim_rx.lock);
+    sim_rx.head = 0;
+    sim_rx.count = 0;
+    pthread_mutex_unlock(&sim_rx.lock);
+
+}
+
+uint32_t uart_rx_dropped(void)
+{
+
+    return sim_rx.dropped;
+
+}
+
+// The baud rate is already in huart->Init, which is all the simulated line looks at
+HAL_StatusTypeDef HAL_UART_Init(UART_HandleTypeDef *huart)
+{
+
+    UNUSED(huart);
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef HAL_UART_Transmit(UART_HandleTypeDef *huart, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+
+    struct pollfd fd = { sim_master, POLLOUT, 0 };
+    uint32_t baud = huart->Init.BaudRate;
+    uint16_t sent = 0;
+    ssize_t count;
+
+    UNUSED(Timeout);
+
+    // The host sees the last byte once it has crossed the wire, and the HAL returns about then too
+    if (sim_timed) {
+        sim_sleep_ns(sim_line_ns(Size, baud));
+    }
+
+    if (!sim_line_matches(baud)) {
+        sim_stats.tx_garbled += Size;
+        sent = Size;
+    }
+
+    // Nothing stops a real UART transmitting, so whatever the host doesn't take in time is lost
+    while (sent < Size) {
+        if (poll(&fd, 1, SIM_TX_STALL_MS) <= 0) {
+            sim_stats.tx_lost += Size - sent;
+            break;
+        }
+        if ((count = write(sim_master, pData + sent, Size - sent)) > 0) {
+            sent += count;
+            sim_stats.tx_bytes += count;
+        }
+    }
+
+    return HAL_OK;
+
+}
+
+/*
+ * SPI ROM, on the SPI bus
+ */
+
+/*
+ * Pack a time into an SFDP field: a five-bit count, less one, followed by the code for its units. The smallest units
+ * that can express the time are chosen, rounding up.
+ */
+static uint32_t sim_sfdp_time(uint32_t time, const uint32_t *units, uint8_t codes)
+{
+
+    uint32_t count;
+    uint8_t code;
+
+    for (code = 0; code < codes - 1 && (time + units[code] - 1) / units[code] > 32; code++) {}
+
+    count = (time + units[code] - 1) / units[code];
+    count = count < 1 ? 1 : count > 32 ? 32 : count;
+
+    return (count - 1) | ((uint32_t)code << 5);
+
+}
+
+// Lay out the SFDP header, one parameter header, and a JESD216A basic flash parameter table
+static void sim_flash_sfdp(Sim_SPIFlash *flash, uint8_t present)
+{
+
+    static const uint32_t erase_ms[4] = { 1, 16, 128, 1000 };
+    static const uint32_t chip_ms[4] = { 16, 256, 4000, 64000 };
+    static const uint32_t program_us[2] = { 8, 64 };
+    static const uint8_t header[16] = {
+        'S', 'F', 'D', 'P', 0x06, 0x01, 0x00, 0xff,                         // JESD216A, one parameter header
+        0x00, 0x06, 0x01, SIM_SFDP_BFPT_DWORDS, SIM_SFDP_BFPT, 0x00, 0x00, 0xff,  // basic table, and where it is
+    };
+    uint32_t bfpt[SIM_SFDP_BFPT_DWORDS];
+    uint32_t chip_us = (uint64_t)SIM_SPI_CHIP_US_PER_MB * flash->capacity / (1024 * 1024);
+    uint8_t i;
+
+    memset(flash->sfdp, 0xff, sizeof(flash->sfdp));
+
+    if (!present) {
+        return;
+    }
+
+    memset(bfpt, 0, sizeof(bfpt));
+    bfpt[1] = flash->capacity * 8 - 1;
+    bfpt[7] = 12 | (SIM_CMD_ERASE_SECTOR << 8) | (15 << 16) | (SIM_CMD_ERASE_BLOCK << 24);
+    bfpt[8] = 16 | (SIM_CMD_ERASE_LARGE << 8);
+    bfpt[9] = 2                                                             // maximum is six times typical
+        | sim_sfdp_time(SIM_SPI_SECTOR_US / 1000, erase_ms, 4) << 4
+        | sim_sfdp_time(SIM_SPI_BLOCK_US / 1000, erase_ms, 4) << 11
+        | sim_sfdp_time(SIM_SPI_LARGE_US / 1000, erase_ms, 4) << 18;
+    bfpt[10] = 2                                                            // the same for programs
+        | 8 << 4                                                            // 256-byte pages
+        | sim_sfdp_time(SIM_SPI_PROGRAM_US, program_us, 2) << 8
+        | sim_sfdp_time(chip_us / 1000, chip_ms, 4) << 24;
+
+    memcpy(flash->sfdp, header, sizeof(header));
+    for (i = 0; i < SIM_SFDP_BFPT_DWORDS; i++) {
+        flash->sfdp[SIM_SFDP_BFPT + i * 4 + 0] = bfpt[i] & 0xff;
+        flash->sfdp[SIM_SFDP_BFPT + i * 4 + 1] = (bfpt[i] >> 8) & 0xff;
+        flash->sfdp[SIM_SFDP_BFPT + i * 4 + 2] = (bfpt[i] >> 16) & 0xff;
+        flash->sfdp[SIM_SFDP_BFPT + i * 4 + 3] = bfpt[i] >> 24;
+    }
+
+}
+
+static uint32_t sim_spi_hz(void)
+{
+
+    return SIM_PCLK_HZ >> ((sim_spi_regs.CR1 & SPI_CR1_BR) / SPI_CR1_BR_0 + 1);
+
+}
+
+// Start an internal operation, which needs a write enable first. Returns true if it goes ahead.
+static uint8_t sim_flash_start(Sim_SPIFlash *flash, const char *name, uint32_t typical_us)
+{
+
+    if (!flash->write_enabled) {
+        sim_warn("SPI ROM %s without a write enable, ignored", name);
+        return 0;
+    }
+
+    flash->write_enabled = 0;
+
+    if (sim_timed) {
+        flash->busy_until = sim_now_ns() + (uint64_t)typical_us * 1000u;
+    }
+
+    return 1;
+
+}
+
+static void sim_flash_erase(Sim_SPIFlash *flash, uint32_t size, uint32_t typical_us)
+{
+
+    uint32_t address = flash->address & (flash->capacity - 1);
+
+    if (flash->index != 4) {
+        sim_warn("SPI ROM erase with %u bytes clocked in, ignored", flash->index);
+        return;
+    }
+
+    if ((address & (size - 1)) != 0) {
+        sim_warn("SPI ROM %uK erase at unaligned address 0x%06x", size / 1024, address);
+    }
+
+    if (sim_flash_start(flash, "erase", typical_us)) {
+        memset(flash->memory + (address & ~(size - 1)), 0xff, size);
+        sim_stats.spi_erases++;
+    }
+
+}
+
+static void sim_flash_program(Sim_SPIFlash *flash)
+{
+
+    uint32_t base = flash->address & (flash->capacity - 1) & ~(SIM_SPI_PAGE - 1);
+    uint16_t i, unerased = 0;
+
+    if (flash->index < 5) {
+        return;
+    }
+
+    if (flash->index - 4 > SIM_SPI_PAGE) {
+        sim_warn("SPI ROM page program of %u bytes wrapped within its page", flash->index - 4);
+    }
+
+    if (!sim_flash_start(flash, "page program", SIM_SPI_PROGRAM_US)) {
+        return;
+    }
+
+    for (i = 0; i < SIM_SPI_PAGE; i++) {
+        unerased += (flash->memory[base + i] & flash->page[i]) != flash->page[i];
+        flash->memory[base + i] &= flash->page[i];
+    }
+
+    if (unerased > 0) {
+        sim_warn("SPI ROM page program at 0x%06x needed %u bytes erased first", base, unerased);
+    }
+
+    sim_stats.spi_programs++;
+
+}
+
+static void sim_flash_select(Sim_SPIFlash *flash, uint8_t select)
+{
+
+    if (select) {
+        if (!flash->selected) {
+            flash->selected = 1;
+            flash->index = 0;
+            flash->address = 0;
+            flash->ignored = 0;
+            memset(flash->page, 0xff, sizeof(flash->page));
+        }
+        return;
+    }
+
+    if (!flash->selected) {
+        return;
+    }
+
+    flash->selected = 0;
+
+    if (flash->index == 0 || flash->ignored) {
+        return;
+    }
+
+    // Commands that take effect when chip select goes high
+    switch (flash->command) {
+        case SIM_CMD_WRITE_ENABLE:
+            flash->write_enabled = 1;
+            break;
+        case SIM_CMD_WRITE_DISABLE:
+            flash->write_enabled = 0;
+            break;
+        case SIM_CMD_PAGE_PROGRAM:
+            sim_flash_program(flash);
+            break;
+        case SIM_CMD_ERASE_SECTOR:
+            sim_flash_erase(flash, 4 * 1024, SIM_SPI_SECTOR_US);
+            break;
+        case SIM_CMD_ERASE_BLOCK:
+            sim_flash_erase(flash, 32 * 1024, SIM_SPI_BLOCK_US);
+            break;
+        case SIM_CMD_ERASE_LARGE:
+            sim_flash_erase(flash, 64 * 1024, SIM_SPI_LARGE_US);
+            break;
+        case SIM_CMD_ERASE_CHIP:
+        case SIM_CMD_ERASE_CHIP_ALT:
+            if (sim_flash_start(flash, "chip erase",
+                    (uint64_t)SIM_SPI_CHIP_US_PER_MB * flash->capacity / (1024 * 1024))) {
+                memset(flash->memory, 0xff, flash->capacity);
+                sim_stats.spi_erases++;
+            }
+            break;
+        default:
+            break;
+    }
+
+}
+
+// Clock one byte through the ROM, returning what it drives onto MISO
+static uint8_t sim_flash_byte(Sim_SPIFlash *flash, uint8_t mosi)
+{
+
+    uint8_t miso = 0xff, busy;
+    uint32_t n, skip;
+
+    if (!flash->selected) {
+        return 0xff;                // MISO floats, pulled up
+    }
+
+    n = flash->index++;
+    busy = sim_now_ns() < flash->busy_until;
+
+    if (n == 0) {
+        flash->command = mosi;
+        if (busy && mosi != SIM_CMD_READ_STATUS_1) {
+            sim_warn("SPI ROM command 0x%02x while busy, ignored", mosi);
+            flash->ignored = 1;
+        }
+        return 0xff;
+    }
+
+    if (flash->ignored) {
+        return 0xff;
+    }
+
+    switch (flash->command) {
+
+        case SIM_CMD_JEDEC_ID:
+            miso = n == 1 ? SIM_SPI_MANUFACTURER : n == 2 ? SIM_SPI_MEMORY_TYPE : n == 3 ? __builtin_ctz(flash->capacity) : 0;
+            break;
+
+        case SIM_CMD_READ_STATUS_1:
+            miso = busy | (flash->write_enabled << 1);
+            break;
+
+        case SIM_CMD_READ:
+        case SIM_CMD_READ_FAST:
+        case SIM_CMD_READ_SFDP:
+            skip = flash->command == SIM_CMD_READ ? 4 : 5;      // fast reads have a dummy byte after the address
+            if (n < 4) {
+                flash->address = (flash->address << 8) | mosi;
+            } else if (n >= skip && flash->command == SIM_CMD_READ_SFDP) {
+                miso = flash->address < SIM_SFDP_SIZE ? flash->sfdp[flash->address] : 0xff;
+                flash->address++;
+            } else if (n >= skip) {
+                miso = flash->memory[flash->address++ & (flash->capacity - 1)];
+            }
+            break;
+
+        case SIM_CMD_PAGE_PROGRAM:
+            if (n < 4) {
+                flash->address = (flash->address << 8) | mosi;
+            } else {
+                flash->page[(flash->address + n - 4) & (SIM_SPI_PAGE - 1)] = mosi;
+            }
+            break;
+
+        case SIM_CMD_ERASE_SECTOR:
+        case SIM_CMD_ERASE_BLOCK:
+        case SIM_CMD_ERASE_LARGE:
+            if (n < 4) {
+                flash->address = (flash->address << 8) | mosi;
+            }
+            break;
+
+        default:
+            break;
+
+    }
+
+    // Too fast for the wiring: the odd bit gets missed
+    if (flash->max_hz != 0 && sim_spi_hz() > flash->max_hz) {
+        miso ^= n & 1;
+    }
+
+    return miso;
+
+}
+
+// Account for the time a transfer takes on the bus, sleeping once enough has built up to be worth it
+static void sim_spi_pace(uint16_t size)
+{
+
+    if (!sim_timed) {
+        return;
+    }
+
+    sim_spi_owed += (uint64_t)size * 8000000000u / sim_spi_hz();
+
+    if (sim_spi_owed >= SIM_SPI_SLEEP_NS) {
+        sim_sleep_ns(sim_spi_owed);
+        sim_spi_owed = 0;
+    }
+
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+
+    uint16_t i;
+
+    UNUSED(hspi);
+    UNUSED(Timeout);
+
+    for (i = 0; i < Size; i++) {
+        sim_flash_byte(&sim_flash, pData[i]);
+    }
+
+    sim_spi_pace(Size);
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size,
+    uint32_t Timeout)
+{
+
+    uint16_t i;
+
+    UNUSED(hspi);
+    UNUSED(Timeout);
+
+    for (i = 0; i < Size; i++) {
+        pRxData[i] = sim_flash_byte(&sim_flash, pTxData[i]);
+    }
+
+    sim_spi_pace(Size);
+
+    return HAL_OK;
+
+}
+
+// The simulated bus has no DMA linked, so the driver never asks for it
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+
+    UNUSED(hspi);
+    UNUSED(pData);
+    UNUSED(Size);
+
+    return HAL_ERROR;
+
+}
+
+HAL_StatusTypeDef HAL_SPI_Receive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+
+    UNUSED(hspi);
+    UNUSED(pData);
+    UNUSED(Size);
+
+    return HAL_ERROR;
+
+}
+
+HAL_StatusTypeDef HAL_SPI_Abort(SPI_HandleTypeDef *hspi)
+{
+
+    UNUSED(hspi);
+
+    return HAL_OK;
+
+}
+
+// The simulated bus stands in for SPI3 on APB1, whichever peripheral the driver takes it for
+uint32_t HAL_RCC_GetPCLK1Freq(void)
+{
+
+    return SIM_PCLK_HZ;
+
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+
+    return SIM_PCLK_HZ;
+
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+
+    if (GPIOx == SPI3_SS_GPIO_Port && GPIO_Pin == SPI3_SS_Pin) {
+        sim_flash_select(&sim_flash, PinState == GPIO_PIN_RESET);
+    }
+
+}
+
+/*
+ * SST ROM, behind the sstrom.h calls
+ */
+
+static HAL_StatusTypeDef sim_sst_range(uint32_t address, uint32_t size)
+{
+
+    return address <= SST_ROM_SIZE && size <= SST_ROM_SIZE - address ? HAL_OK : HAL_ERROR;
+
+}
+
+static HAL_StatusTypeDef sim_sst_program(uint32_t address, const uint8_t *data, uint32_t size, uint8_t skip_erased)
+{
+
+    uint32_t i, programmed = 0;
+
+    if (sim_sst_range(address, size) != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    for (i = 0; i < size; i++) {
+
+        if (skip_erased && data[i] == 0xff) {
+            continue;
+        }
+
+        sim_sst[address + i] &= data[i];
+        programmed++;
+
+        // Data polling never sees the byte it expects
+        if (sim_sst[address + i] != data[i]) {
+            sim_warn("SST ROM program at 0x%05x needed an erase first", address + i);
+            return HAL_TIMEOUT;
+        }
+
+    }
+
+    sim_stats.sst_programs += programmed;
+
+    if (sim_timed) {
+        sim_sleep_ns((uint64_t)programmed * SIM_SST_PROGRAM_US * 1000u);
+    }
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef sst_rom_init(TIM_HandleTypeDef *htim)
+{
+
+    UNUSED(htim);
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef sst_rom_read_id(uint8_t *manufacturer, uint8_t *device_id)
+{
+
+    *manufacturer = SIM_SST_MANUFACTURER;
+    *device_id = SIM_SST_DEVICE;
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef sst_rom_erase(uint32_t address, uint8_t type)
+{
+
+    if (type == SST_ROM_ERASE_ALL) {
+        memset(sim_sst, 0xff, SST_ROM_SIZE);
+    } else {
+        memset(sim_sst + (address & (SST_ROM_SIZE - 1) & ~(SST_ROM_SECTOR_SIZE - 1)), 0xff, SST_ROM_SECTOR_SIZE);
+    }
+
+    sim_stats.sst_erases++;
+
+    if (sim_timed) {
+        sim_sleep_ns((type == SST_ROM_ERASE_ALL ? SIM_SST_CHIP_US : SIM_SST_SECTOR_US) * 1000u);
+    }
+
+    return HAL_OK;
+
+}
+
+HAL_StatusTypeDef sst_rom_program(uint32_t address, const uint8_t *data, uint32_t size)
+{
+
+    return sim_sst_program(address, data, size, 0);
+
+}
+
+HAL_StatusTypeDef sst_rom_program_erased(uint32_t address, const uint8_t *data, uint32_t size)
+{
+
+    return sim_sst_program(address, data, size, 1);
+
+}
+
+HAL_StatusTypeDef sst_rom_read(uint32_t address, uint8_t *data, uint32_t size)
+{
+
+    if (sim_sst_range(address, size) != HAL_OK) {
+        return HAL_ERROR;
+    }
+
+    memcpy(data, sim_sst + address, size);
+
+    return HAL_OK;
+
+}
+
+// Reads finish straight away, so the wait just reports how the read went
+static HAL_StatusTypeDef sim_sst_read_status = HAL_OK;
+
+HAL_StatusTypeDef sst_rom_read_start(uint32_t address, uint8_t *data, uint32_t size)
+{
+
+    sim_sst_read_status = sst_rom_read(address, data, size);
+
+    return sim_sst_read_status;
+
+}
+
+HAL_StatusTypeDef sst_rom_read_wait(void)
+{
+
+    return sim_sst_read_status;
+
+}
+
+HAL_StatusTypeDef sst_rom_read_sector(uint32_t address, uint8_t *data)
+{
+
+    return sst_rom_read(address & ~(SST_ROM_SECTOR_SIZE - 1), data, SST_ROM_SECTOR_SIZE);
+
+}
+
+/*
+ * Setting up
+ */
+
+// Map a ROM's contents, from a file if given, which is extended with erased bytes to the ROM's size
+static uint8_t *sim_memory(const char *path, uint32_t size)
+{
+
+    static uint8_t erased[4096];
+    struct stat st;
+    uint8_t *memory;
+    off_t length;
+    int fd;
+
+    if (path == NULL) {
+        memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory != MAP_FAILED) {
+            memset(memory, 0xff, size);
+        }
+        return memory == MAP_FAILED ? NULL : memory;
+    }
+
+    if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        return NULL;
+    }
+
+    memset(erased, 0xff, sizeof(erased));
+    for (length = st.st_size; length < size; length += sizeof(erased)) {
+        if (pwrite(fd, erased, (off_t)sizeof(erased) < size - length ? sizeof(erased) : (size_t)(size - length),
+                length) < 0) {
+            perror(path);
+            close(fd);
+            return NULL;
+        }
+    }
+
+    memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (memory == MAP_FAILED) {
+        perror(path);
+        return NULL;
+    }
+
+    return memory;
+
+}
+
+// Open the pseudo-terminal, returning the slave's path
+static const char *sim_open_line(void)
+{
+
+    struct termios tio;
+    const char *name;
+    int slave;
+
+    if ((sim_master = posix_openpt(O_RDWR | O_NOCTTY)) < 0 || grantpt(sim_master) != 0 || unlockpt(sim_master) != 0
+            || (name = ptsname(sim_master)) == NULL) {
+        perror("pseudo-terminal");
+        return NULL;
+    }
+
+    // Keep the slave open, so the line stays up between host connections, and set it up raw at the UART's rate
+    if ((slave = open(name, O_RDWR | O_NOCTTY)) < 0 || tcgetattr(slave, &tio) != 0) {
+        perror(name);
+        return NULL;
+    }
+
+    cfmakeraw(&tio);
+    cfsetspeed(&tio, sim_speed(SIM_BAUD_DEFAULT));
+    tcsetattr(slave, TCSANOW, &tio);
+
+    fcntl(sim_master, F_SETFL, fcntl(sim_master, F_GETFL) | O_NONBLOCK);
+
+    return name;
+
+}
+
+static void sim_cli(void *argument)
+{
+
+    cli_loop((CLI_SetupTypeDef *)argument);
+
+}
+
+static uint32_t sim_size(const char *text)
+{
+
+    char *end;
+    unsigned long size = strtoul(text, &end, 0);
+
+    if (*end == 'K' || *end == 'k') {
+        size *= 1024;
+        end++;
+    } else if (*end == 'M' || *end == 'm') {
+        size *= 1024 * 1024;
+        end++;
+    }
+
+    return *end == '\0' ? size : 0;
+
+}
+
+static void sim_usage(void)
+{
+
+    fprintf(stderr, "usage: romblesim [-t] [-l LINK] [-f SPI_IMAGE] [-p SST_IMAGE] [-s SIZE] [-m HZ] [-n]\n");
+    exit(2);
+
+}
+
+int main(int argc, char **argv)
+{
+
+    static SPI_ROM_DeviceDef device;
+    static CLI_SetupTypeDef config = {
+        &sim_uart,
+        {
+            &sim_spi,
+            SPI3_SS_GPIO_Port,
+            SPI3_SS_Pin,
+            &device
+        }
+    };
+    const char *link_path = NULL, *spi_path = NULL, *sst_path = NULL, *name;
+    uint32_t capacity = 4 * 1024 * 1024;
+    uint8_t sfdp = 1;
+    pthread_t receiver;
+    sigset_t signals;
+    int option, signal;
+
+    while ((option = getopt(argc, argv, "tl:f:p:s:m:n")) != -1) {
+        switch (option) {
+            case 't':
+                sim_timed = 1;
+                break;
+            case 'l':
+                link_path = optarg;
+                break;
+            case 'f':
+                spi_path = optarg;
+                break;
+            case 'p':
+                sst_path = optarg;
+                break;
+            case 's':
+                capacity = sim_size(optarg);
+                break;
+            case 'm':
+                sim_flash.max_hz = sim_size(optarg);
+                break;
+            case 'n':
+                sfdp = 0;
+                break;
+            default:
+                sim_usage();
+        }
+    }
+
+    if (optind != argc || capacity < SIM_SPI_MIN_SIZE || capacity > SIM_SPI_MAX_SIZE
+            || (capacity & (capacity - 1)) != 0) {
+        sim_usage();
+    }
+
+    sim_epoch = sim_now_ns();
+
+    sim_flash.capacity = capacity;
+    sim_flash_sfdp(&sim_flash, sfdp);
+    if ((sim_flash.memory = sim_memory(spi_path, capacity)) == NULL
+            || (sim_sst = sim_memory(sst_path, SST_ROM_SIZE)) == NULL) {
+        return 1;
+    }
+
+    pthread_mutex_init(&sim_rx.lock, NULL);
+    sim_cond_init(&sim_rx.ready);
+
+    sim_uart.Init.BaudRate = SIM_BAUD_DEFAULT;
+
+    sim_spi_regs.CR1 = SPI_BAUDRATEPRESCALER_128;
+    sim_spi.Instance = &sim_spi_regs;
+    sim_spi.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_128;
+
+    if ((name = sim_open_line()) == NULL) {
+        return 1;
+    }
+
+    if (link_path != NULL) {
+        unlink(link_path);
+        if (symlink(name, link_path) != 0) {
+            perror(link_path);
+            return 1;
+        }
+    }
+
+    // Only this thread takes the signals to stop
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    crc32_init(NULL);
+
+    if (pthread_create(&receiver, NULL, sim_receive, NULL) != 0 || osThreadNew(sim_cli, &config, NULL) == NULL) {
+        fprintf(stderr, "romblesim: can't start threads\n");
+        return 1;
+    }
+
+    printf("ROMble simulator on %s\n", name);
+    fflush(stdout);
+
+    sigwait(&signals, &signal);
+
+    fprintf(stderr, "romblesim: line in %llu bytes, %llu at the wrong baud rate, %u dropped; "
+        "out %llu bytes, %llu at the wrong baud rate, %llu unread\n",
+        (unsigned long long)sim_stats.rx_bytes, (unsigned long long)sim_stats.rx_garbled, sim_rx.dropped,
+        (unsigned long long)sim_stats.tx_bytes, (unsigned long long)sim_stats.tx_garbled,
+        (unsigned long long)sim_stats.tx_lost);
+    fprintf(stderr, "romblesim: SPI ROM %llu page programs, %llu erases; SST ROM %llu bytes programmed, "
+        "%llu erases; %llu warnings\n",
+        (unsigned long long)sim_stats.spi_programs, (unsigned long long)sim_stats.spi_erases,
+        (unsigned long long)sim_stats.sst_programs, (unsigned long long)sim_stats.sst_erases,
+        (unsigned long long)sim_stats.warnings);
+
+    if (spi_path != NULL) {
+        msync(sim_flash.memory, capacity, MS_SYNC);
+    }
+    if (sst_path != NULL) {
+        msync(sim_sst, SST_ROM_SIZE, MS_SYNC);
+    }
+    if (link_path != NULL) {
+        unlink(link_path);
+    }
+
+    return 0;
+
+}
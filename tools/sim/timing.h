@@ -0,0 +1,34 @@
+/**
+ * @brief   Host stand-in for Inc/timing.h, for tools/romblesim.c
+ *
+ * The real header reads the DWT cycle counter at its fixed Cortex-M address, which a host process can't. The same
+ * calls are declared here as functions over the host's monotonic clock, counting cycles at 100MHz. This directory
+ * goes ahead of Inc on the include path, so the device sources pick this up unchanged.
+ */
+
+#ifndef TIMING_H
+#define TIMING_H
+
+#include "stm32f4xx_hal.h"
+
+#define TIMING_SPIN_US          20          // sleeps shorter than this spin rather than pay for two context switches
+
+/* Nothing to set up on the host. */
+HAL_StatusTypeDef timing_init(TIM_HandleTypeDef *);
+
+/* Block the calling thread for at least the given number of microseconds. */
+void timing_sleep_us(uint32_t);
+
+/* Not used on the host. */
+void timing_timer_elapsed(TIM_HandleTypeDef *);
+
+/* The free-running cycle counter, counting at 100MHz. It wraps after about 42 seconds, as on the device. */
+uint32_t timing_cycles(void);
+
+/* Microseconds since a timing_cycles() reading. */
+uint32_t timing_elapsed_us(uint32_t);
+
+/* Spin for at least the given number of microseconds without yielding. */
+void timing_spin_us(uint32_t);
+
+#endif
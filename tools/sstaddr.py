@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+Generate the SST39LF020 address lookup tables from the pin definitions in main.h.
+
+The ROM's address lines are scattered across GPIOA and GPIOB. Rather than shuffle bits on every bus cycle, the
+address is split into a low and a high half, and each half indexes a table of ready-made BSRR words for each
+port. A port's BSRR word is then the OR of its two table entries - or just one, if only one half of the address
+has lines on that port.
+
+Usage: sstaddr.py <main.h> <output directory>
+
+Writes sstaddr.h and sstaddr.c into the output directory.
+"""
+
+import os
+import re
+import sys
+
+ADDRESS_BITS = 18       # A0-A17
+SPLIT_BITS = 9          # low table covers A0-A8, high table A9-A17
+
+PIN_RE = re.compile(r'^#define\s+SST_A(\d+)_Pin\s+GPIO_PIN_(\d+)\s*$')
+PORT_RE = re.compile(r'^#define\s+SST_A(\d+)_GPIO_Port\s+GPIO([A-Z])\s*$')
+
+
+def read_pins(path):
+    pins = {}
+    ports = {}
+    with open(path) as header:
+        for line in header:
+            match = PIN_RE.match(line)
+            if match:
+                pins[int(match.group(1))] = int(match.group(2))
+            match = PORT_RE.match(line)
+            if match:
+                ports[int(match.group(1))] = match.group(2)
+
+    lines = {}
+    for bit in range(ADDRESS_BITS):
+        if bit not in pins or bit not in ports:
+            sys.exit('%s: no pin definition for SST_A%d' % (path, bit))
+        lines[bit] = (ports[bit], pins[bit])
+
+    return lines
+
+
+def table(lines, port, first, count):
+    """BSRR words for each value of address bits first..first+count-1, for the lines on one port."""
+    mine = [(bit - first, pin) for bit, (p, pin) in lines.items() if p == port and first <= bit < first + count]
+    if not mine:
+        return None
+
+    words = []
+    for value in range(1 << count):
+        word = 0
+        for bit, pin in mine:
+            if value & (1 << bit):
+                word |= 1 << pin
+            else:
+                word |= 1 << (pin + 16)
+        words.append(word)
+
+    return words
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+
+    lines = read_pins(sys.argv[1])
+    outdir = sys.argv[2]
+    ports = sorted(set(port for port, _ in lines.values()))
+    halves = (('lo', 0, SPLIT_BITS), ('hi', SPLIT_BITS, ADDRESS_BITS - SPLIT_BITS))
+
+    tables = []
+    for port in ports:
+        for name, first, count in halves:
+            words = table(lines, port, first, count)
+            if words is not None:
+                tables.append((port, name, count, words))
+
+    banner = '/* Generated by tools/sstaddr.py from %s - do not edit */\n' % sys.argv[1]
+
+    with open(os.path.join(outdir, 'sstaddr.h'), 'w') as out:
+        out.write(banner)
+        out.write('\n#ifndef SSTADDR_H\n#define SSTADDR_H\n\n#include "stm32f4xx_hal.h"\n\n')
+        out.write('#define SST_ADDRESS_BITS    %d\n' % ADDRESS_BITS)
+        out.write('#define SST_ADDRESS_SPLIT   %d\n\n' % SPLIT_BITS)
+        for port, name, count, _ in tables:
+            out.write('extern const uint32_t sst_address_gpio%s_%s[%d];\n' % (port.lower(), name, 1 << count))
+        lo_ports = [port for port, name, _, _ in tables if name == 'lo']
+        if len(lo_ports) == 1:
+            # Walking the low half then only takes stores to one port, which a DMA stream can make
+            out.write('\n/* The low address lines all sit on one port. */\n')
+            out.write('#define SST_ADDRESS_LO_GPIO     GPIO%s\n' % lo_ports[0])
+            out.write('#define SST_ADDRESS_LO_TABLE    sst_address_gpio%s_lo\n' % lo_ports[0].lower())
+        out.write('\n/* Drive the address lines: one or two table loads per port. */\n')
+        out.write('static inline void sst_address_set(uint32_t address)\n{\n')
+        out.write('    uint32_t lo = address & ((1 << SST_ADDRESS_SPLIT) - 1);\n')
+        out.write('    uint32_t hi = (address >> SST_ADDRESS_SPLIT) '
+                  '& ((1 << (SST_ADDRESS_BITS - SST_ADDRESS_SPLIT)) - 1);\n\n')
+        for port in ports:
+            terms = ['sst_address_gpio%s_%s[%s]' % (port.lower(), name, name)
+                     for p, name, _, _ in tables if p == port]
+            out.write('    GPIO%s->BSRR = %s;\n' % (port, ' | '.join(terms)))
+        if not any(name == 'lo' for _, name, _, _ in tables):
+            out.write('    (void)lo;\n')
+        if not any(name == 'hi' for _, name, _, _ in tables):
+            out.write('    (void)hi;\n')
+        out.write('}\n\n#endif\n')
+
+    with open(os.path.join(outdir, 'sstaddr.c'), 'w') as out:
+        out.write(banner)
+        out.write('\n#include "sstaddr.h"\n')
+        for port, name, count, words in tables:
+            out.write('\nconst uint32_t sst_address_gpio%s_%s[%d] = {\n' % (port.lower(), name, 1 << count))
+            for row in range(0, len(words), 4):
+                out.write('    ' + ' '.join('0x%08x,' % word for word in words[row:row + 4]) + '\n')
+            out.write('};\n')
+
+
+if __name__ == '__main__':
+    main()